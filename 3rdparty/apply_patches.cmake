@@ -0,0 +1,25 @@
+# Applies the patches in 3rdparty/patches to the extracted libvisiontransfer
+# sources. Patches that have already been applied are skipped, such that
+# this script can be run after every (re-)extraction.
+#
+# Usage: cmake -DVT_SOURCE_DIR=<extracted source dir> -P apply_patches.cmake
+
+file(GLOB VT_PATCHES ${CMAKE_CURRENT_LIST_DIR}/patches/*.patch)
+list(SORT VT_PATCHES)
+
+foreach(VT_PATCH ${VT_PATCHES})
+    # A patch that can be reverted has already been applied
+    execute_process(COMMAND patch -p1 -R -s -f --dry-run -i ${VT_PATCH}
+        WORKING_DIRECTORY ${VT_SOURCE_DIR}
+        RESULT_VARIABLE VT_PATCH_APPLIED
+        OUTPUT_QUIET ERROR_QUIET)
+    if(NOT VT_PATCH_APPLIED EQUAL 0)
+        message(STATUS "Applying ${VT_PATCH}")
+        execute_process(COMMAND patch -p1 -s -f -N -i ${VT_PATCH}
+            WORKING_DIRECTORY ${VT_SOURCE_DIR}
+            RESULT_VARIABLE VT_PATCH_RESULT)
+        if(VT_PATCH_RESULT)
+            message(FATAL_ERROR "Failed applying ${VT_PATCH}")
+        endif()
+    endif()
+endforeach()
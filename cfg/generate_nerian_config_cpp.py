@@ -35,9 +35,8 @@ using namespace visiontransfer;
 
 namespace nerian_stereo {
 
-// Callback that receives an updated config from ROS
-void StereoNodeBase::autogen_dynamicReconfigureCallback(nerian_stereo::NerianStereoConfig &config, uint32_t level) {
-    std::stringstream ss;
+// Callback that receives an updated config from ROS; collects all changes into one batch
+void StereoNodeBase::autogen_dynamicReconfigureCallback(nerian_stereo::NerianStereoConfig &config, uint32_t level, ParameterBatch& batch) {
     // == START of autogenerated parameter blocks ==
 %s
     // == END of autogenerated parameter blocks ==
@@ -47,12 +46,27 @@ void StereoNodeBase::autogen_dynamicReconfigureCallback(nerian_stereo::NerianSte
 void StereoNodeBase::autogen_updateParameterServerFromDevice(param::ParameterSet& cfg) {
     ROS_INFO("Setting initial parameters in the parameter server");
     std::string node_name = ros::this_node::getName();
+    // All values are written with a single parameter server call; existing
+    // entries in our namespace are fetched first, such that they are preserved
+    XmlRpc::XmlRpcValue params;
+    if(!getNH().getParam(node_name, params) || params.getType() != XmlRpc::XmlRpcValue::TypeStruct) {
+        params = XmlRpc::XmlRpcValue();
+    }
     // Publish reboot flag to definitely be set to false in the parameter server
-    getNH().setParam(node_name + "/reboot", false);
+    params["reboot"] = false;
     // Publish the current config to the parameter server
     // == START of autogenerated parameter blocks ==
 %s
     // == END of autogenerated parameter blocks ==
+    getNH().setParam(node_name, params);
+}
+
+// Copy the current parameter values from the device into a configuration
+void StereoNodeBase::autogen_updateConfigFromDevice(param::ParameterSet& cfg, nerian_stereo::NerianStereoConfig& config) {
+    // == START of autogenerated parameter blocks ==
+%s
+    // == END of autogenerated parameter blocks ==
+    config.reboot = false;
 }
 
 // Override the default parameter bounds with current (run-time) config
@@ -75,10 +89,12 @@ void StereoNodeBase::autogen_updateDynamicReconfigureFromDevice(param::Parameter
 
 TEMPLATE_PARAMETER_CHANGE = '''        if (config.{varname} != lastKnownConfig.{varname}) {{
             ROS_INFO("Request to set {varname} = %s", std::to_string(config.{varname}).c_str());
-            deviceParameters->setParameter("{varname}", config.{varname});
+            batch.set("{varname}", config.{varname});
         }}'''
 
-TEMPLATE_SETPARAM = '''    getNH().setParam(node_name + "/{varname}", cfg.get("{varname}").getCurrent<{typ}>());'''
+TEMPLATE_SETPARAM = '''    params["{varname}"] = cfg.get("{varname}").getCurrent<{typ}>();'''
+
+TEMPLATE_SETCONFIG = '''    config.{varname} = cfg.get("{varname}").getCurrent<{typ}>();'''
 
 TEMPLATE_SETDEFAULTS = '''
     config_default.{varname} = cfg.get("{varname}").getCurrent<{typ}>();
@@ -105,6 +121,7 @@ if __name__ == '__main__':
     # Dump code for each parameter. 'reboot' is handled specially (must not be True initially)
     paramchange = '\n'.join(TEMPLATE_PARAMETER_CHANGE.format(varname=vt[0]) for vt in varnames_and_types)
     setparam = '\n'.join(TEMPLATE_SETPARAM.format(varname=vt[0], typ=vt[1]) for vt in varnames_and_types if vt[0] != 'reboot')
+    setconfig = '\n'.join(TEMPLATE_SETCONFIG.format(varname=vt[0], typ=vt[1]) for vt in varnames_and_types if vt[0] != 'reboot')
     setdefaults = '\n'.join(TEMPLATE_SETDEFAULTS.format(varname=vt[0], typ=vt[1]) for vt in varnames_and_types if vt[0] != 'reboot')
-    outfile.write(CODE_TEMPLATE % (paramchange, setparam, setdefaults))
+    outfile.write(CODE_TEMPLATE % (paramchange, setparam, setconfig, setdefaults))
 
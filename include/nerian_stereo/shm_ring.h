@@ -0,0 +1,264 @@
+/*******************************************************************************
+ * Copyright (c) 2022 Nerian Vision GmbH
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *******************************************************************************/
+
+#ifndef __NERIAN_STEREO_SHM_RING_H__
+#define __NERIAN_STEREO_SHM_RING_H__
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
+
+/**
+ * Shared memory ring buffer for handing image sets and point clouds to
+ * other processes on the same host.
+ *
+ * The driver writes each frame once into the next slot of a POSIX shared
+ * memory segment. Any number of readers can map the segment and copy out
+ * the most recent frame. Slots are protected by a sequence lock: the writer
+ * never waits for readers, and readers detect and retry reads that were
+ * overtaken by the writer.
+ *
+ * Segment layout: RingHeader, followed by numSlots slots of slotStride
+ * bytes each. Every slot starts with a SlotHeader, followed by the entry
+ * payloads. All entry offsets are relative to the end of the SlotHeader.
+ *
+ * This header and the reader only depend on the C++ standard library and
+ * POSIX, such that consumers do not need to link against ROS.
+ */
+
+namespace nerian_stereo {
+namespace shm {
+
+static const uint32_t RING_MAGIC = 0x4d52534e; // "NSRM"
+static const uint32_t RING_VERSION = 1;
+static const int MAX_ENTRIES = 8;
+static const int ENCODING_LENGTH = 24;
+
+/// Content of a slot entry
+enum EntryType {
+    ENTRY_LEFT = 0,
+    ENTRY_RIGHT = 1,
+    ENTRY_COLOR = 2,
+    ENTRY_DISPARITY = 3,
+    ENTRY_POINT_CLOUD = 4
+};
+
+/**
+ * \brief Describes one image or point cloud inside a slot.
+ *
+ * Images use the ROS image encodings (mono8, mono16, rgb8); disparity maps
+ * are stored unscaled as mono16 with 4 bits of subpixel precision. Point
+ * clouds are stored in the same memory layout as the published PointCloud2
+ * messages, with step being the number of bytes per row and the encoding
+ * naming the point format (xyz, xyz_intensity, xyz_rgb, xyz_rgb_separate).
+ */
+struct EntryDescriptor {
+    uint32_t type;
+    uint32_t width;
+    uint32_t height;
+    uint32_t step;
+    uint64_t offset;
+    uint64_t size;
+    char encoding[ENCODING_LENGTH];
+};
+
+/**
+ * \brief Header of a single slot.
+ *
+ * The sequence lock is odd while the slot is being written.
+ */
+struct alignas(64) SlotHeader {
+    std::atomic<uint64_t> seqlock;
+    uint64_t frameIndex;
+    uint32_t sequence;
+    uint32_t stampSec;
+    uint32_t stampNsec;
+    uint32_t numEntries;
+    EntryDescriptor entries[MAX_ENTRIES];
+};
+
+/**
+ * \brief Header at the beginning of the shared memory segment.
+ *
+ * writeCount is the number of frames that have been written; the most
+ * recent frame is located in slot (writeCount-1) % numSlots. The writer
+ * sets closed before removing the segment, e.g. when it needs to grow the
+ * slots or shuts down, which tells readers to map the segment again.
+ */
+struct alignas(64) RingHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t numSlots;
+    uint32_t reserved;
+    uint64_t slotCapacity;
+    uint64_t slotStride;
+    std::atomic<uint64_t> writeCount;
+    std::atomic<uint32_t> closed;
+};
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+    "Shared memory synchronization requires lock-free atomics");
+
+} // namespace shm
+
+/**
+ * \brief Input for a single entry, as passed to ShmRingWriter::write()
+ */
+struct ShmBuffer {
+    shm::EntryType type;
+    int width;
+    int height;
+    int step;
+    std::string encoding;
+    const unsigned char* data;
+    size_t size;
+};
+
+/**
+ * \brief A single entry that has been copied out of the ring
+ */
+struct ShmImage {
+    shm::EntryType type;
+    int width;
+    int height;
+    int step;
+    std::string encoding;
+    std::vector<unsigned char> data;
+};
+
+/**
+ * \brief A frame that has been copied out of the ring
+ */
+struct ShmFrame {
+    uint64_t frameIndex;
+    uint32_t sequence;
+    uint32_t stampSec;
+    uint32_t stampNsec;
+    std::vector<ShmImage> entries;
+
+    /**
+     * \brief Returns the entry of the given type, or nullptr if not included
+     */
+    const ShmImage* find(shm::EntryType type) const;
+};
+
+/**
+ * \brief Writes frames into a shared memory ring.
+ *
+ * The segment is created with the first write and grown automatically if
+ * a frame does not fit into the current slots. It is removed when the
+ * writer is destroyed.
+ */
+class ShmRingWriter {
+public:
+    /**
+     * \brief Creates a new writer
+     *
+     * \param name Name of the POSIX shared memory segment (e.g. "/nerian_stereo")
+     * \param numSlots Number of frames that are kept in the ring
+     */
+    ShmRingWriter(const std::string& name, int numSlots = 4);
+    ~ShmRingWriter();
+
+    /**
+     * \brief Copies all buffers into the next slot and publishes it to readers.
+     *
+     * Returns the index of the written frame. Throws a std::runtime_error if
+     * the shared memory segment cannot be created.
+     */
+    uint64_t write(uint32_t sequence, uint32_t stampSec, uint32_t stampNsec,
+        const std::vector<ShmBuffer>& buffers);
+
+    const std::string& getName() const { return name; }
+    int getNumSlots() const { return numSlots; }
+
+private:
+    std::string name;
+    int numSlots;
+    int fd;
+    unsigned char* mapping;
+    size_t mappingSize;
+    shm::RingHeader* header;
+    uint64_t writeCount;
+
+    void create(uint64_t slotCapacity);
+    void close();
+
+    // This class cannot be copied
+    ShmRingWriter(const ShmRingWriter& other);
+    ShmRingWriter& operator=(const ShmRingWriter&);
+};
+
+/**
+ * \brief Reads frames from a shared memory ring.
+ *
+ * The reader never blocks the writer. If the writer is not running yet,
+ * or restarts, the segment is (re-)opened on the next read. A writer that
+ * crashed cannot mark its segment as closed; while no new frames arrive,
+ * the reader therefore periodically checks whether the segment has been
+ * replaced by a new one.
+ */
+class ShmRingReader {
+public:
+    ShmRingReader(const std::string& name);
+    ~ShmRingReader();
+
+    /**
+     * \brief Copies the most recent frame, if it is newer than the
+     * previously read one.
+     *
+     * Buffers of the frame object are reused between calls. Returns false
+     * if no new frame is available.
+     */
+    bool readLatest(ShmFrame& frame);
+
+    /**
+     * \brief Waits up to timeout seconds for a new frame and copies it
+     */
+    bool waitForFrame(ShmFrame& frame, double timeout);
+
+    /**
+     * \brief Number of frames that were written but not read, because
+     * the reader was too slow
+     */
+    uint64_t getSkippedFrames() const { return skippedFrames; }
+
+private:
+    std::string name;
+    int fd;
+    const unsigned char* mapping;
+    size_t mappingSize;
+    const shm::RingHeader* header;
+    uint64_t inode;
+    std::chrono::steady_clock::time_point lastActivity;
+    bool haveLastIndex;
+    uint64_t lastIndex;
+    uint64_t skippedFrames;
+
+    bool open();
+    void close();
+    bool isReplaced();
+    bool copySlot(uint64_t index, ShmFrame& frame);
+
+    // This class cannot be copied
+    ShmRingReader(const ShmRingReader& other);
+    ShmRingReader& operator=(const ShmRingReader&);
+};
+
+} // namespace
+
+#endif
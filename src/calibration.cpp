@@ -0,0 +1,190 @@
+/*******************************************************************************
+ * Copyright (c) 2022 Nerian Vision GmbH
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *******************************************************************************/
+
+#include "calibration.h"
+
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+#include <algorithm>
+#include <opencv2/opencv.hpp>
+
+namespace nerian_stereo {
+
+namespace {
+
+// Header of a binary calibration snapshot
+struct SnapshotHeader {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int dataSize;
+    unsigned long long sourceSize;
+    unsigned long long sourceHash;
+};
+
+const unsigned int SNAPSHOT_MAGIC = 0x4243534e; // "NSCB"
+const unsigned int SNAPSHOT_VERSION = 1;
+
+// Computes size and FNV-1a hash of a file. Hashing the raw bytes is much
+// cheaper than parsing the YAML, and unlike the modification time it does
+// not change if an identical calibration is downloaded again.
+bool getFileStamp(const std::string& fileName, unsigned long long& size, unsigned long long& hash) {
+    FILE* file = fileName == "" ? nullptr : fopen(fileName.c_str(), "rb");
+    if(file == nullptr) {
+        return false;
+    }
+    size = 0;
+    hash = 14695981039346656037ULL;
+    unsigned char buffer[4096];
+    size_t len;
+    while((len = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        for(size_t i = 0; i < len; i++) {
+            hash = (hash ^ buffer[i]) * 1099511628211ULL;
+        }
+        size += len;
+    }
+    fclose(file);
+    return true;
+}
+
+void readArray(const cv::FileStorage& fs, const char* key, double* dest, int size) {
+    std::vector<double> doubleVec;
+    fs[key] >> doubleVec;
+    if(static_cast<int>(doubleVec.size()) != size) {
+        throw std::runtime_error(std::string("Calibration file format error in entry ") + key);
+    }
+    std::copy(doubleVec.begin(), doubleVec.end(), dest);
+}
+
+int readDistortion(const cv::FileStorage& fs, const char* key, double* dest) {
+    std::vector<double> doubleVec;
+    fs[key] >> doubleVec;
+    if(doubleVec.size() > static_cast<size_t>(CalibrationData::MAX_DIST_COEFFS)) {
+        throw std::runtime_error(std::string("Calibration file format error in entry ") + key);
+    }
+    std::copy(doubleVec.begin(), doubleVec.end(), dest);
+    return static_cast<int>(doubleVec.size());
+}
+
+} // namespace
+
+StereoCalibration::StereoCalibration(): valid(false) {
+    memset(&data, 0, sizeof(data));
+}
+
+bool StereoCalibration::loadFile(const std::string& fileName) {
+    cv::FileStorage fs;
+    try {
+        if(!fs.open(fileName, cv::FileStorage::READ)) {
+            return false;
+        }
+    } catch(...) {
+        return false;
+    }
+
+    CalibrationData newData;
+    memset(&newData, 0, sizeof(newData));
+
+    std::vector<int> sizeVec;
+    fs["size"] >> sizeVec;
+    if(sizeVec.size() != 2) {
+        throw std::runtime_error("Calibration file format error in entry size");
+    }
+    newData.width = sizeVec[0];
+    newData.height = sizeVec[1];
+
+    readArray(fs, "M1", newData.M1, 9);
+    newData.numD1 = readDistortion(fs, "D1", newData.D1);
+    readArray(fs, "R1", newData.R1, 9);
+    readArray(fs, "P1", newData.P1, 12);
+
+    readArray(fs, "M2", newData.M2, 9);
+    newData.numD2 = readDistortion(fs, "D2", newData.D2);
+    readArray(fs, "R2", newData.R2, 9);
+    readArray(fs, "P2", newData.P2, 12);
+
+    readArray(fs, "Q", newData.Q, 16);
+    readArray(fs, "T", newData.T, 3);
+    readArray(fs, "R", newData.R, 9);
+
+    // The parser is not needed anymore once everything has been validated
+    fs.release();
+
+    data = newData;
+    valid = true;
+    return true;
+}
+
+bool StereoCalibration::loadSnapshot(const std::string& snapshotFile, const std::string& sourceFile) {
+    FILE* file = fopen(snapshotFile.c_str(), "rb");
+    if(file == nullptr) {
+        return false;
+    }
+
+    SnapshotHeader header;
+    CalibrationData newData;
+    bool ok = fread(&header, sizeof(header), 1, file) == 1
+        && header.magic == SNAPSHOT_MAGIC
+        && header.version == SNAPSHOT_VERSION
+        && header.dataSize == sizeof(CalibrationData)
+        && fread(&newData, sizeof(newData), 1, file) == 1;
+    fclose(file);
+
+    if(ok) {
+        // Reject outdated snapshots if the source file is available
+        unsigned long long size = 0, hash = 0;
+        if(getFileStamp(sourceFile, size, hash)
+                && (size != header.sourceSize || hash != header.sourceHash)) {
+            ok = false;
+        }
+    }
+
+    if(ok) {
+        data = newData;
+        valid = true;
+    }
+    return ok;
+}
+
+bool StereoCalibration::saveSnapshot(const std::string& snapshotFile, const std::string& sourceFile) const {
+    if(!valid) {
+        return false;
+    }
+
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = SNAPSHOT_MAGIC;
+    header.version = SNAPSHOT_VERSION;
+    header.dataSize = sizeof(CalibrationData);
+    getFileStamp(sourceFile, header.sourceSize, header.sourceHash);
+
+    // Write to a temporary file first, such that concurrent readers never see partial data
+    std::string tmpFile = snapshotFile + ".tmp";
+    FILE* file = fopen(tmpFile.c_str(), "wb");
+    if(file == nullptr) {
+        return false;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+        && fwrite(&data, sizeof(data), 1, file) == 1;
+    ok = (fclose(file) == 0) && ok;
+
+    if(!ok || rename(tmpFile.c_str(), snapshotFile.c_str()) != 0) {
+        remove(tmpFile.c_str());
+        return false;
+    }
+    return true;
+}
+
+} // namespace
@@ -0,0 +1,102 @@
+/*******************************************************************************
+ * Copyright (c) 2022 Nerian Vision GmbH
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *******************************************************************************/
+
+#ifndef __NERIAN_STEREO_CALIBRATION_H__
+#define __NERIAN_STEREO_CALIBRATION_H__
+
+#include <string>
+
+namespace nerian_stereo {
+
+/**
+ * \brief Plain camera calibration data, as contained in the calibration file
+ * that is downloaded from the device.
+ *
+ * All matrices are stored in row-major order. The structure is trivially
+ * copyable, such that it can be written to and read from a binary snapshot.
+ */
+struct CalibrationData {
+    static const int MAX_DIST_COEFFS = 14;
+
+    int width;
+    int height;
+
+    double M1[9];
+    double D1[MAX_DIST_COEFFS];
+    int numD1;
+    double R1[9];
+    double P1[12];
+
+    double M2[9];
+    double D2[MAX_DIST_COEFFS];
+    int numD2;
+    double R2[9];
+    double P2[12];
+
+    double Q[16];
+    double T[3];
+    double R[9];
+};
+
+/**
+ * \brief Loads and validates the camera calibration once at startup.
+ *
+ * The calibration is parsed from the YAML file that is produced by the
+ * device, and can optionally be cached as a binary snapshot. A snapshot is
+ * only used if it was created from a calibration file with identical
+ * contents, or if the calibration file is not available at all (e.g.
+ * because the device could not be reached for downloading it).
+ */
+class StereoCalibration {
+public:
+    StereoCalibration();
+
+    /**
+     * \brief Parses and validates a YAML calibration file.
+     *
+     * Returns false if the file cannot be read. Throws a std::runtime_error
+     * if the file contents are malformed.
+     */
+    bool loadFile(const std::string& fileName);
+
+    /**
+     * \brief Loads a binary snapshot that was created from the given source file.
+     *
+     * Returns false if the snapshot is missing, corrupt or outdated.
+     */
+    bool loadSnapshot(const std::string& snapshotFile, const std::string& sourceFile);
+
+    /**
+     * \brief Writes the current calibration to a binary snapshot
+     */
+    bool saveSnapshot(const std::string& snapshotFile, const std::string& sourceFile) const;
+
+    /**
+     * \brief Returns true if calibration data has been loaded
+     */
+    bool isValid() const { return valid; }
+
+    /**
+     * \brief Returns the loaded calibration data
+     */
+    const CalibrationData& getData() const { return data; }
+
+private:
+    CalibrationData data;
+    bool valid;
+};
+
+} // namespace
+
+#endif
@@ -0,0 +1,159 @@
+/*******************************************************************************
+ * Copyright (c) 2022 Nerian Vision GmbH
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *******************************************************************************/
+
+#include "change_detector.h"
+
+#include <cmath>
+#include <algorithm>
+
+using namespace visiontransfer;
+
+namespace nerian_stereo {
+
+ChangeDetector::ChangeDetector(double imageThreshold, double disparityThreshold)
+    : imageThreshold(imageThreshold), disparityThreshold(disparityThreshold),
+    haveReference(false) {
+}
+
+bool ChangeDetector::hasChanged(const ImageSet& imageSet) {
+    int imageIndex = imageSet.getIndexOf(ImageSet::IMAGE_LEFT);
+    if(imageIndex < 0) {
+        imageIndex = imageSet.getIndexOf(ImageSet::IMAGE_COLOR);
+    }
+    int disparityIndex = imageSet.getIndexOf(ImageSet::IMAGE_DISPARITY);
+
+    if(imageIndex >= 0) {
+        computeBlockMeans(imageSet, imageIndex, false, current[CHANNEL_IMAGE]);
+    } else {
+        current[CHANNEL_IMAGE].clear();
+    }
+    if(disparityIndex >= 0) {
+        computeBlockMeans(imageSet, disparityIndex, true, current[CHANNEL_DISPARITY]);
+    } else {
+        current[CHANNEL_DISPARITY].clear();
+    }
+
+    bool changed = !haveReference;
+    const float thresholds[NUM_CHANNELS] = {imageThreshold, disparityThreshold};
+    for(int c = 0; c < NUM_CHANNELS && !changed; c++) {
+        // A different resolution or set of channels is always a change
+        if(current[c].size() != reference[c].size()) {
+            changed = true;
+            break;
+        }
+        for(size_t i = 0; i < current[c].size(); i++) {
+            if(std::fabs(current[c][i] - reference[c][i]) > thresholds[c]) {
+                changed = true;
+                break;
+            }
+        }
+    }
+
+    if(changed) {
+        for(int c = 0; c < NUM_CHANNELS; c++) {
+            reference[c].swap(current[c]);
+        }
+        haveReference = true;
+    }
+    return changed;
+}
+
+void ChangeDetector::computeBlockMeans(const ImageSet& imageSet, int imageIndex, bool disparity,
+        std::vector<float>& means) {
+    int width = imageSet.getWidth();
+    int height = imageSet.getHeight();
+    int blocksX = (width + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    int blocksY = (height + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    blockSums.assign(blocksX * blocksY, 0);
+    blockCounts.assign(blocksX * blocksY, 0);
+
+    // Scale factor for converting sums to means in 8-bit gray levels or
+    // disparity pixels
+    float scale = 1.0f;
+    int channels = 1;
+    switch(imageSet.getPixelFormat(imageIndex)) {
+        case ImageSet::FORMAT_8_BIT_MONO:
+            sumBlocks<unsigned char, false>(imageSet, imageIndex, 1);
+            break;
+        case ImageSet::FORMAT_8_BIT_RGB:
+            channels = 3;
+            sumBlocks<unsigned char, false>(imageSet, imageIndex, 3);
+            break;
+        case ImageSet::FORMAT_12_BIT_MONO:
+            if(disparity) {
+                scale = 1.0f / imageSet.getSubpixelFactor();
+                sumBlocks<unsigned short, true>(imageSet, imageIndex, 1);
+            } else {
+                scale = 1.0f / 16;
+                sumBlocks<unsigned short, false>(imageSet, imageIndex, 1);
+            }
+            break;
+        default:
+            means.clear();
+            return;
+    }
+
+    means.resize(blockSums.size());
+    for(int by = 0; by < blocksY; by++) {
+        int rows = std::min(BLOCK_SIZE, height - by*BLOCK_SIZE);
+        for(int bx = 0; bx < blocksX; bx++) {
+            int cols = std::min(BLOCK_SIZE, width - bx*BLOCK_SIZE);
+            int index = by*blocksX + bx;
+            if(disparity) {
+                // Average over valid disparities only, as invalid pixels tend
+                // to flicker. Mostly invalid blocks have a mean of zero.
+                means[index] = blockCounts[index] * 4 >= static_cast<uint32_t>(rows * cols) ?
+                    blockSums[index] * scale / blockCounts[index] : 0.0f;
+            } else {
+                means[index] = blockSums[index] * scale / (rows * cols * channels);
+            }
+        }
+    }
+}
+
+template <typename T, bool disparity>
+void ChangeDetector::sumBlocks(const ImageSet& imageSet, int imageIndex, int channels) {
+    int width = imageSet.getWidth();
+    int height = imageSet.getHeight();
+    int rowStride = imageSet.getRowStride(imageIndex);
+    int blocksX = (width + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    const unsigned char* data = imageSet.getPixelData(imageIndex);
+
+    for(int y = 0; y < height; y++) {
+        const T* row = reinterpret_cast<const T*>(data + y*rowStride);
+        uint32_t* sums = &blockSums[(y / BLOCK_SIZE) * blocksX];
+        uint32_t* counts = &blockCounts[(y / BLOCK_SIZE) * blocksX];
+
+        for(int bx = 0; bx < blocksX; bx++) {
+            int start = bx * BLOCK_SIZE * channels;
+            int end = std::min(width, (bx + 1) * BLOCK_SIZE) * channels;
+
+            // Simple reduction that the compiler can vectorize
+            uint32_t sum = 0, count = 0;
+            for(int x = start; x < end; x++) {
+                uint32_t value = row[x];
+                if(disparity) {
+                    uint32_t valid = value < 0xFFF;
+                    value *= valid;
+                    count += valid;
+                }
+                sum += value;
+            }
+            sums[bx] += sum;
+            counts[bx] += count;
+        }
+    }
+}
+
+} // namespace
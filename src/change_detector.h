@@ -0,0 +1,85 @@
+/*******************************************************************************
+ * Copyright (c) 2022 Nerian Vision GmbH
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *******************************************************************************/
+
+#ifndef __NERIAN_STEREO_CHANGE_DETECTOR_H__
+#define __NERIAN_STEREO_CHANGE_DETECTOR_H__
+
+#include <vector>
+#include <stdint.h>
+#include <visiontransfer/imageset.h>
+
+namespace nerian_stereo {
+
+/**
+ * \brief Detects whether the scene has changed since the last accepted frame.
+ *
+ * The left image (or the color image, if no left image is transmitted) and
+ * the disparity map are reduced to the mean values of 16x16 pixel blocks.
+ * A frame is considered changed if any block mean differs from the
+ * reference by more than the respective threshold. Averaging suppresses
+ * sensor noise, while local changes such as a moving object still affect
+ * individual blocks.
+ *
+ * The reference is only replaced when a change is detected, such that slow
+ * gradual changes accumulate until they exceed the threshold.
+ */
+class ChangeDetector {
+public:
+    /**
+     * \brief Creates a new detector
+     *
+     * \param imageThreshold Threshold for image block means in 8-bit gray levels
+     * \param disparityThreshold Threshold for disparity block means in pixels
+     */
+    ChangeDetector(double imageThreshold, double disparityThreshold);
+
+    /**
+     * \brief Returns true if the image set differs from the reference, in
+     * which case it becomes the new reference
+     */
+    bool hasChanged(const visiontransfer::ImageSet& imageSet);
+
+    /**
+     * \brief Discards the reference, such that the next frame is reported
+     * as changed
+     */
+    void reset() { haveReference = false; }
+
+private:
+    static const int BLOCK_SIZE = 16;
+
+    enum Channel {
+        CHANNEL_IMAGE,
+        CHANNEL_DISPARITY,
+        NUM_CHANNELS
+    };
+
+    float imageThreshold;
+    float disparityThreshold;
+    bool haveReference;
+    std::vector<float> reference[NUM_CHANNELS];
+    std::vector<float> current[NUM_CHANNELS];
+    std::vector<uint32_t> blockSums;
+    std::vector<uint32_t> blockCounts;
+
+    void computeBlockMeans(const visiontransfer::ImageSet& imageSet, int imageIndex,
+        bool disparity, std::vector<float>& means);
+
+    template <typename T, bool disparity>
+    void sumBlocks(const visiontransfer::ImageSet& imageSet, int imageIndex, int channels);
+};
+
+} // namespace
+
+#endif
@@ -0,0 +1,129 @@
+/*******************************************************************************
+ * Copyright (c) 2022 Nerian Vision GmbH
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *******************************************************************************/
+
+#include "clock_sync.h"
+
+#include <cmath>
+#include <algorithm>
+
+namespace nerian_stereo {
+
+ClockSync::ClockSync(double windowSize, double resetThreshold)
+    : windowSize(windowSize), resetThreshold(resetThreshold), numResets(0) {
+    reset();
+}
+
+void ClockSync::reset() {
+    samples.clear();
+    hull.clear();
+    deviceReference = 0.0;
+    haveReference = false;
+    valid = false;
+    baseX = 0.0;
+    baseOffset = 0.0;
+    slope = 0.0;
+    jitter = 0.0;
+    meanDelay = 0.0;
+}
+
+void ClockSync::addSample(double deviceTime, double hostTime) {
+    if(!haveReference) {
+        deviceReference = deviceTime;
+        haveReference = true;
+    }
+
+    Sample s;
+    s.x = deviceTime - deviceReference;
+    s.y = hostTime - deviceTime;
+
+    // Detect device clock jumps (e.g. after a device reboot or PTP step)
+    bool jumped = (!samples.empty() && s.x <= samples.back().x)
+        || (valid && std::fabs(s.y - offsetAt(s.x)) > resetThreshold);
+    if(jumped) {
+        int resets = numResets + 1;
+        reset();
+        numResets = resets;
+        deviceReference = deviceTime;
+        haveReference = true;
+        s.x = 0.0;
+    }
+
+    samples.push_back(s);
+    while(samples.size() > 2 && samples.back().x - samples.front().x > windowSize) {
+        samples.pop_front();
+    }
+
+    updateEstimate();
+}
+
+void ClockSync::updateEstimate() {
+    // Lower convex hull of the (sorted) samples via monotone chain
+    hull.clear();
+    double sumX = 0.0;
+    for(const Sample& p: samples) {
+        while(hull.size() >= 2) {
+            const Sample& a = hull[hull.size()-2];
+            const Sample& b = hull[hull.size()-1];
+            double cross = (b.x - a.x)*(p.y - a.y) - (b.y - a.y)*(p.x - a.x);
+            if(cross > 0.0) {
+                break;
+            }
+            hull.pop_back();
+        }
+        hull.push_back(p);
+        sumX += p.x;
+    }
+
+    if(hull.size() < 2) {
+        // A single sample only provides an offset
+        baseX = samples.back().x;
+        baseOffset = samples.back().y;
+        slope = 0.0;
+    } else {
+        // The hull edge spanning the mean x minimizes the sum of all
+        // sample distances above the line
+        double meanX = sumX / samples.size();
+        size_t i = 0;
+        while(i + 2 < hull.size() && hull[i+1].x < meanX) {
+            i++;
+        }
+        baseX = hull[i].x;
+        baseOffset = hull[i].y;
+        slope = (hull[i+1].y - hull[i].y) / (hull[i+1].x - hull[i].x);
+    }
+
+    // Delay statistics relative to the minimum-delay line; the jitter is
+    // the standard deviation of the delay about its mean
+    double sumDelay = 0.0, sumSq = 0.0;
+    for(const Sample& p: samples) {
+        double d = p.y - offsetAt(p.x);
+        sumDelay += d;
+        sumSq += d*d;
+    }
+    meanDelay = sumDelay / samples.size();
+    jitter = std::sqrt(std::max(0.0, sumSq / samples.size() - meanDelay*meanDelay));
+
+    // Require a few samples before the drift estimate becomes meaningful
+    valid = samples.size() >= 10;
+}
+
+double ClockSync::toHostTime(double deviceTime) const {
+    return deviceTime + offsetAt(deviceTime - deviceReference);
+}
+
+double ClockSync::getOffset() const {
+    return samples.empty() ? 0.0 : offsetAt(samples.back().x);
+}
+
+} // namespace
@@ -0,0 +1,128 @@
+/*******************************************************************************
+ * Copyright (c) 2022 Nerian Vision GmbH
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *******************************************************************************/
+
+#ifndef __NERIAN_STEREO_CLOCK_SYNC_H__
+#define __NERIAN_STEREO_CLOCK_SYNC_H__
+
+#include <deque>
+#include <vector>
+
+namespace nerian_stereo {
+
+/**
+ * \brief Estimates offset and drift between the device clock and the host clock.
+ *
+ * Each received frame yields a sample pairing the device capture time with
+ * the host reception time. The difference (host - device) is the clock offset
+ * plus a strictly positive, variable transfer delay. The estimator keeps the
+ * lower convex hull of these samples over a sliding window and selects the
+ * hull edge that minimizes the summed distance to all samples (the edge that
+ * spans the mean device time). This line follows the minimum-delay envelope,
+ * so it is insensitive to network and poll jitter, and its slope is the
+ * relative clock drift.
+ *
+ * All times are given in seconds.
+ */
+class ClockSync {
+public:
+    /**
+     * \brief Creates a new estimator
+     *
+     * \param windowSize Length of the sliding sample window in seconds
+     * \param resetThreshold Deviation from the current estimate (in seconds)
+     *        beyond which the estimator assumes a device clock jump and restarts
+     */
+    ClockSync(double windowSize = 30.0, double resetThreshold = 1.0);
+
+    /**
+     * \brief Adds a new pair of device capture time and host reception time
+     */
+    void addSample(double deviceTime, double hostTime);
+
+    /**
+     * \brief Returns true if enough samples are available for an estimate
+     */
+    bool isValid() const { return valid; }
+
+    /**
+     * \brief Converts a device timestamp into the host time base
+     */
+    double toHostTime(double deviceTime) const;
+
+    /**
+     * \brief Clock offset (host - device) at the most recent sample
+     */
+    double getOffset() const;
+
+    /**
+     * \brief Relative drift of the host clock against the device clock in ppm
+     */
+    double getDriftPpm() const { return slope * 1e6; }
+
+    /**
+     * \brief Standard deviation of the transfer delay above the
+     * minimum-delay line, i.e. about the mean delay
+     */
+    double getJitter() const { return jitter; }
+
+    /**
+     * \brief Mean transfer delay above the minimum-delay line
+     */
+    double getMeanDelay() const { return meanDelay; }
+
+    /**
+     * \brief Number of samples in the current window
+     */
+    int getNumSamples() const { return static_cast<int>(samples.size()); }
+
+    /**
+     * \brief Number of detected clock jumps that caused a restart
+     */
+    int getNumResets() const { return numResets; }
+
+    /**
+     * \brief Discards all samples
+     */
+    void reset();
+
+private:
+    struct Sample {
+        double x; // device time relative to reference
+        double y; // host - device
+    };
+
+    double windowSize;
+    double resetThreshold;
+
+    std::deque<Sample> samples;
+    std::vector<Sample> hull;
+    double deviceReference;
+    bool haveReference;
+
+    // Current estimate: offset(x) = baseOffset + slope * (x - baseX)
+    bool valid;
+    double baseX;
+    double baseOffset;
+    double slope;
+    double jitter;
+    double meanDelay;
+    int numResets;
+
+    void updateEstimate();
+    double offsetAt(double x) const { return baseOffset + slope * (x - baseX); }
+};
+
+} // namespace
+
+#endif
@@ -0,0 +1,122 @@
+/*******************************************************************************
+ * Copyright (c) 2022 Nerian Vision GmbH
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *******************************************************************************/
+
+#include "disparity_converter.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace nerian_stereo {
+
+namespace {
+
+const unsigned short INVALID_DISPARITY = 0xFFF;
+const float INVALID_FLOAT_DISPARITY = -1.0f;
+
+} // namespace
+
+DisparityConverter::DisparityConverter()
+    : validX(0), validY(0), validWidth(0), validHeight(0) {
+}
+
+void DisparityConverter::convert(const unsigned short* dispMap, int width, int height, int rowStride,
+        int subpixelFactor, float* dst) {
+    float scale = 1.0f / subpixelFactor;
+    validColumns.assign(width, 0);
+
+    int firstRow = height, lastRow = -1;
+    for(int y = 0; y < height; y++) {
+        const unsigned short* src = reinterpret_cast<const unsigned short*>(
+            reinterpret_cast<const unsigned char*>(dispMap) + y*rowStride);
+        if(convertRow(src, dst + y*width, width, scale)) {
+            if(firstRow == height) {
+                firstRow = y;
+            }
+            lastRow = y;
+        }
+    }
+
+    int firstColumn = 0, lastColumn = width - 1;
+    while(firstColumn < width && validColumns[firstColumn] == 0) {
+        firstColumn++;
+    }
+    while(lastColumn >= firstColumn && validColumns[lastColumn] == 0) {
+        lastColumn--;
+    }
+
+    if(lastRow < 0) {
+        validX = validY = validWidth = validHeight = 0;
+    } else {
+        validX = firstColumn;
+        validY = firstRow;
+        validWidth = lastColumn - firstColumn + 1;
+        validHeight = lastRow - firstRow + 1;
+    }
+}
+
+bool DisparityConverter::convertRow(const unsigned short* src, float* dst, int width, float scale) {
+    uint16_t* columns = &validColumns[0];
+    uint16_t rowValid = 0;
+    int x = 0;
+
+#ifdef __SSE2__
+    const __m128i invalid = _mm_set1_epi16(INVALID_DISPARITY);
+    const __m128i ones = _mm_set1_epi16(-1);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 scaleVec = _mm_set1_ps(scale);
+    const __m128 invalidFloat = _mm_set1_ps(INVALID_FLOAT_DISPARITY);
+    __m128i rowValidVec = zero;
+
+    for(; x + 8 <= width; x += 8) {
+        __m128i disp = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x));
+        __m128i invalidMask = _mm_cmpeq_epi16(disp, invalid);
+        __m128i validMask = _mm_xor_si128(invalidMask, ones);
+
+        __m128i* columnPtr = reinterpret_cast<__m128i*>(columns + x);
+        _mm_storeu_si128(columnPtr, _mm_or_si128(_mm_loadu_si128(columnPtr), validMask));
+        rowValidVec = _mm_or_si128(rowValidVec, validMask);
+
+        // Widen to 32 bit, convert and scale
+        __m128 low = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(disp, zero)), scaleVec);
+        __m128 high = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(disp, zero)), scaleVec);
+        __m128 invalidLow = _mm_castsi128_ps(_mm_unpacklo_epi16(invalidMask, invalidMask));
+        __m128 invalidHigh = _mm_castsi128_ps(_mm_unpackhi_epi16(invalidMask, invalidMask));
+        low = _mm_or_ps(_mm_and_ps(invalidLow, invalidFloat), _mm_andnot_ps(invalidLow, low));
+        high = _mm_or_ps(_mm_and_ps(invalidHigh, invalidFloat), _mm_andnot_ps(invalidHigh, high));
+
+        _mm_storeu_ps(dst + x, low);
+        _mm_storeu_ps(dst + x + 4, high);
+    }
+    rowValid = _mm_movemask_epi8(rowValidVec) != 0;
+#endif
+
+    for(; x < width; x++) {
+        uint16_t valid = src[x] != INVALID_DISPARITY;
+        dst[x] = valid ? src[x] * scale : INVALID_FLOAT_DISPARITY;
+        columns[x] |= valid;
+        rowValid |= valid;
+    }
+
+    return rowValid != 0;
+}
+
+void DisparityConverter::getValidWindow(int& x, int& y, int& width, int& height) const {
+    x = validX;
+    y = validY;
+    width = validWidth;
+    height = validHeight;
+}
+
+} // namespace
@@ -0,0 +1,63 @@
+/*******************************************************************************
+ * Copyright (c) 2022 Nerian Vision GmbH
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *******************************************************************************/
+
+#ifndef __NERIAN_STEREO_DISPARITY_CONVERTER_H__
+#define __NERIAN_STEREO_DISPARITY_CONVERTER_H__
+
+#include <vector>
+#include <stdint.h>
+
+namespace nerian_stereo {
+
+/**
+ * \brief Converts 12-bit fixed-point disparity maps to floating point.
+ *
+ * Valid disparities are divided by the subpixel factor, and invalid
+ * disparities are set to -1, which is below the minimum disparity as
+ * expected by stereo_msgs/DisparityImage consumers. The bounding box of
+ * all valid disparities is determined during the conversion.
+ */
+class DisparityConverter {
+public:
+    DisparityConverter();
+
+    /**
+     * \brief Converts a disparity map
+     *
+     * \param dispMap 12-bit disparity map
+     * \param width Width of the disparity map
+     * \param height Height of the disparity map
+     * \param rowStride Row stride of the disparity map in bytes
+     * \param subpixelFactor Subpixel factor of the disparity map
+     * \param dst Destination buffer with width * height floats
+     */
+    void convert(const unsigned short* dispMap, int width, int height, int rowStride,
+        int subpixelFactor, float* dst);
+
+    /**
+     * \brief Returns the bounding box of valid disparities in the last
+     * converted map, which is empty if there are none
+     */
+    void getValidWindow(int& x, int& y, int& width, int& height) const;
+
+private:
+    std::vector<uint16_t> validColumns;
+    int validX, validY, validWidth, validHeight;
+
+    bool convertRow(const unsigned short* src, float* dst, int width, float scale);
+};
+
+} // namespace
+
+#endif
@@ -0,0 +1,187 @@
+/*******************************************************************************
+ * Copyright (c) 2022 Nerian Vision GmbH
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *******************************************************************************/
+
+#include "disparity_filter.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace nerian_stereo {
+
+namespace {
+
+const unsigned short INVALID_DISPARITY = 0xFFF;
+
+inline unsigned short* getRow(unsigned short* dispMap, int rowStride, int y) {
+    return reinterpret_cast<unsigned short*>(reinterpret_cast<unsigned char*>(dispMap) + y*rowStride);
+}
+
+} // namespace
+
+class HoleFillingBody: public cv::ParallelLoopBody {
+public:
+    HoleFillingBody(const DisparityFilter& filter, unsigned short* dispMap, int width,
+        int rowStride, int maxDiff)
+        : filter(filter), dispMap(dispMap), width(width), rowStride(rowStride), maxDiff(maxDiff) {
+    }
+
+    virtual void operator()(const cv::Range& range) const {
+        for(int y = range.start; y < range.end; y++) {
+            filter.fillHoles(getRow(dispMap, rowStride, y), width, maxDiff);
+        }
+    }
+
+private:
+    const DisparityFilter& filter;
+    unsigned short* dispMap;
+    int width;
+    int rowStride;
+    int maxDiff;
+};
+
+class TemporalMedianBody: public cv::ParallelLoopBody {
+public:
+    TemporalMedianBody(const DisparityFilter& filter, unsigned short* dispMap, int width,
+        int rowStride, const unsigned short* previous, unsigned short* older)
+        : filter(filter), dispMap(dispMap), width(width), rowStride(rowStride),
+        previous(previous), older(older) {
+    }
+
+    virtual void operator()(const cv::Range& range) const {
+        for(int y = range.start; y < range.end; y++) {
+            filter.medianRow(getRow(dispMap, rowStride, y), previous + y*width,
+                older + y*width, width);
+        }
+    }
+
+private:
+    const DisparityFilter& filter;
+    unsigned short* dispMap;
+    int width;
+    int rowStride;
+    const unsigned short* previous;
+    unsigned short* older;
+};
+
+DisparityFilter::DisparityFilter(int speckleSize, double speckleRange, int holeSize,
+        double holeRange, bool temporalMedian)
+    : speckleSize(speckleSize), speckleRange(speckleRange), holeSize(holeSize),
+    holeRange(holeRange), temporalMedian(temporalMedian), historyFrames(0), newest(0),
+    historyWidth(0), historyHeight(0) {
+}
+
+void DisparityFilter::process(unsigned short* dispMap, int width, int height, int rowStride,
+        int subpixelFactor) {
+    if(speckleSize > 0) {
+        // Disparities only use 12 bits and can be processed as signed values
+        cv::Mat disp(height, width, CV_16SC1, dispMap, rowStride);
+        cv::filterSpeckles(disp, INVALID_DISPARITY, speckleSize,
+            speckleRange * subpixelFactor, speckleBuffer);
+    }
+
+    if(holeSize > 0) {
+        cv::parallel_for_(cv::Range(0, height), HoleFillingBody(*this, dispMap, width, rowStride,
+            static_cast<int>(holeRange * subpixelFactor)));
+    }
+
+    if(temporalMedian) {
+        if(width != historyWidth || height != historyHeight) {
+            historyFrames = 0;
+            historyWidth = width;
+            historyHeight = height;
+        }
+
+        if(historyFrames < 2) {
+            // Only collect frames until the history is complete
+            newest = historyFrames;
+            history[newest].resize(width * height);
+            for(int y = 0; y < height; y++) {
+                memcpy(&history[newest][y*width], getRow(dispMap, rowStride, y),
+                    width*sizeof(unsigned short));
+            }
+            historyFrames++;
+        } else {
+            // The current frame replaces the older history frame
+            int older = 1 - newest;
+            cv::parallel_for_(cv::Range(0, height), TemporalMedianBody(*this, dispMap, width,
+                rowStride, &history[newest][0], &history[older][0]));
+            newest = older;
+        }
+    }
+}
+
+void DisparityFilter::fillHoles(unsigned short* dispRow, int width, int maxDiff) const {
+    int x = 0;
+    while(x < width) {
+        if(dispRow[x] != INVALID_DISPARITY) {
+            x++;
+            continue;
+        }
+
+        // Find the end of the hole
+        int start = x;
+        while(x < width && dispRow[x] == INVALID_DISPARITY) {
+            x++;
+        }
+        int length = x - start;
+
+        // Only interpolate holes that are bounded on both sides by
+        // similar disparities
+        if(start == 0 || x == width || length > holeSize) {
+            continue;
+        }
+        int left = dispRow[start - 1];
+        int right = dispRow[x];
+        if(std::abs(right - left) > maxDiff) {
+            continue;
+        }
+
+        for(int i = 0; i < length; i++) {
+            dispRow[start + i] = static_cast<unsigned short>(
+                left + (right - left) * (i + 1) / (length + 1));
+        }
+    }
+}
+
+void DisparityFilter::medianRow(unsigned short* dispRow, const unsigned short* previous,
+        unsigned short* older, int width) const {
+    // Invalid disparities are larger than all valid ones, hence a pixel
+    // only remains invalid if it was invalid in two of the three frames
+    int x = 0;
+#ifdef __SSE2__
+    for(; x + 8 <= width; x += 8) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dispRow + x));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(previous + x));
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(older + x));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(older + x), a);
+
+        // 12-bit values can be compared as signed 16-bit integers
+        __m128i median = _mm_max_epi16(_mm_min_epi16(a, b),
+            _mm_min_epi16(_mm_max_epi16(a, b), c));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dispRow + x), median);
+    }
+#endif
+    for(; x < width; x++) {
+        unsigned short a = dispRow[x], b = previous[x], c = older[x];
+        older[x] = a;
+        dispRow[x] = std::max(std::min(a, b), std::min(std::max(a, b), c));
+    }
+}
+
+} // namespace
@@ -0,0 +1,90 @@
+/*******************************************************************************
+ * Copyright (c) 2022 Nerian Vision GmbH
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *******************************************************************************/
+
+#ifndef __NERIAN_STEREO_DISPARITY_FILTER_H__
+#define __NERIAN_STEREO_DISPARITY_FILTER_H__
+
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+namespace nerian_stereo {
+
+/**
+ * \brief Post-filters for 12-bit disparity maps, applied in place.
+ *
+ * The following filters are available, and are applied in this order:
+ *
+ * - Speckle removal: Connected regions of similar disparity that are smaller
+ *   than a given number of pixels are invalidated.
+ * - Hole filling: Horizontal runs of invalid pixels up to a given length are
+ *   interpolated linearly, if the disparities on both ends are similar.
+ * - Temporal median: Each pixel is replaced by the median of the current
+ *   and the two previous frames, which removes flickering measurements.
+ *
+ * Invalid pixels have a disparity of 0xFFF. All buffers are kept between
+ * frames, and rows are processed in parallel where possible.
+ */
+class DisparityFilter {
+public:
+    /**
+     * \brief Creates a new filter
+     *
+     * \param speckleSize Maximum size of a speckle in pixels, or 0 to disable
+     * \param speckleRange Maximum disparity difference within a speckle in pixels
+     * \param holeSize Maximum length of a hole in pixels, or 0 to disable
+     * \param holeRange Maximum disparity difference across a hole in pixels
+     * \param temporalMedian Enables the temporal median filter
+     */
+    DisparityFilter(int speckleSize, double speckleRange, int holeSize, double holeRange,
+        bool temporalMedian);
+
+    /**
+     * \brief Filters a disparity map in place
+     */
+    void process(unsigned short* dispMap, int width, int height, int rowStride, int subpixelFactor);
+
+    /**
+     * \brief Discards the frame history of the temporal filter, e.g. after a
+     * reconnect
+     */
+    void reset() { historyFrames = 0; }
+
+private:
+    int speckleSize;
+    double speckleRange;
+    int holeSize;
+    double holeRange;
+    bool temporalMedian;
+
+    cv::Mat speckleBuffer;
+
+    // The two previous frames for the temporal median; newest is the
+    // index of the most recent one
+    std::vector<unsigned short> history[2];
+    int historyFrames;
+    int newest;
+    int historyWidth;
+    int historyHeight;
+
+    void fillHoles(unsigned short* dispRow, int width, int maxDiff) const;
+    void medianRow(unsigned short* dispRow, const unsigned short* previous, unsigned short* older,
+        int width) const;
+
+    friend class HoleFillingBody;
+    friend class TemporalMedianBody;
+};
+
+} // namespace
+
+#endif
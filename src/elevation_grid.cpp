@@ -0,0 +1,100 @@
+/*******************************************************************************
+ * Copyright (c) 2022 Nerian Vision GmbH
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *******************************************************************************/
+
+#include "elevation_grid.h"
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+namespace nerian_stereo {
+
+ElevationGridBuilder::ElevationGridBuilder(double resolution, double length, double width, double cameraHeight,
+        double minHeight, double maxHeight, double obstacleHeight, int minPoints)
+    : resolution(resolution), cameraHeight(cameraHeight), minHeight(minHeight),
+    maxHeight(maxHeight), obstacleHeight(obstacleHeight), minPoints(std::max(minPoints, 1)),
+    cellsX(std::max(1, static_cast<int>(std::ceil(length / resolution)))),
+    cellsY(std::max(1, static_cast<int>(std::ceil(width / resolution)))) {
+
+    static const float identity[9] = {1, 0, 0, 0, 1, 0, 0, 0, 1};
+    setRotation(identity);
+
+    minHeights.resize(cellsX * cellsY);
+    maxHeights.resize(cellsX * cellsY);
+    counts.resize(cellsX * cellsY);
+}
+
+void ElevationGridBuilder::setRotation(const float* rot) {
+    std::copy(rot, rot + 9, rotation);
+}
+
+void ElevationGridBuilder::update(const float* points, int pointStride, int numPoints) {
+    const float inf = std::numeric_limits<float>::infinity();
+    std::fill(minHeights.begin(), minHeights.end(), inf);
+    std::fill(maxHeights.begin(), maxHeights.end(), -inf);
+    std::fill(counts.begin(), counts.end(), 0);
+
+    const float scale = 1.0f / resolution;
+    const float offsetY = 0.5f * cellsY; // Grid is centered laterally
+    const float* r = rotation;
+
+    for(int i = 0; i < numPoints; i++) {
+        const float* p = points + static_cast<size_t>(i) * pointStride;
+
+        // Rotate into the grid frame. Invalid points have NaN or infinite
+        // coordinates and fail all range checks below.
+        float x = r[0]*p[0] + r[1]*p[1] + r[2]*p[2];
+        float y = r[3]*p[0] + r[4]*p[1] + r[5]*p[2];
+        float z = r[6]*p[0] + r[7]*p[1] + r[8]*p[2] + cameraHeight;
+
+        if(!(z >= minHeight && z <= maxHeight)) {
+            continue;
+        }
+
+        float cx = x * scale;
+        float cy = y * scale + offsetY;
+        if(!(cx >= 0.0f && cx < cellsX && cy >= 0.0f && cy < cellsY)) {
+            continue;
+        }
+
+        int index = static_cast<int>(cy) * cellsX + static_cast<int>(cx);
+        minHeights[index] = std::min(minHeights[index], z);
+        maxHeights[index] = std::max(maxHeights[index], z);
+        if(counts[index] != std::numeric_limits<uint16_t>::max()) {
+            counts[index]++;
+        }
+    }
+
+    // Mark empty cells
+    for(size_t i = 0; i < counts.size(); i++) {
+        if(counts[i] == 0) {
+            minHeights[i] = maxHeights[i] = std::numeric_limits<float>::quiet_NaN();
+        }
+    }
+}
+
+void ElevationGridBuilder::getOccupancy(std::vector<int8_t>& occupancy) const {
+    occupancy.resize(counts.size());
+    for(size_t i = 0; i < counts.size(); i++) {
+        if(counts[i] < minPoints) {
+            occupancy[i] = -1;
+        } else if(maxHeights[i] > obstacleHeight) {
+            occupancy[i] = 100;
+        } else {
+            occupancy[i] = 0;
+        }
+    }
+}
+
+} // namespace
@@ -0,0 +1,120 @@
+/*******************************************************************************
+ * Copyright (c) 2022 Nerian Vision GmbH
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *******************************************************************************/
+
+#ifndef __NERIAN_STEREO_ELEVATION_GRID_H__
+#define __NERIAN_STEREO_ELEVATION_GRID_H__
+
+#include <vector>
+#include <stdint.h>
+
+namespace nerian_stereo {
+
+/**
+ * \brief Bins an organized point cloud into a 2.5D elevation grid.
+ *
+ * Points are rotated into a gravity-aligned frame with x pointing forward,
+ * y to the left and z up, with the origin at the camera. The grid covers
+ * 0 to length meters in x and -width/2 to width/2 meters in y. Heights are
+ * measured above the ground plane, which is cameraHeight meters below the
+ * camera. Points outside of the height band [minHeight, maxHeight] (e.g.
+ * ceilings or reflections below the floor) are ignored.
+ *
+ * For each cell the minimum and maximum height and the number of points are
+ * recorded. A cell is an obstacle if it has been observed by at least
+ * minPoints points and its maximum height exceeds obstacleHeight.
+ *
+ * Cells are stored in row-major order with x running fastest, which is the
+ * layout of nav_msgs/OccupancyGrid.
+ */
+class ElevationGridBuilder {
+public:
+    /**
+     * \brief Creates a new grid
+     *
+     * \param resolution Cell size in meters
+     * \param length Extent of the grid in forward direction in meters
+     * \param width Extent of the grid in lateral direction in meters
+     * \param cameraHeight Height of the camera above the ground in meters
+     * \param minHeight Minimum height of points that are considered
+     * \param maxHeight Maximum height of points that are considered
+     * \param obstacleHeight Height above which a cell is an obstacle
+     * \param minPoints Minimum number of points for an observed cell
+     */
+    ElevationGridBuilder(double resolution, double length, double width, double cameraHeight,
+        double minHeight, double maxHeight, double obstacleHeight, int minPoints);
+
+    /**
+     * \brief Sets the rotation from point cloud coordinates into the
+     * gravity-aligned grid frame, as row-major 3x3 matrix
+     */
+    void setRotation(const float* rotation);
+
+    /**
+     * \brief Clears the grid and bins all points of the given point map
+     *
+     * \param points Point map with x, y, z at the beginning of each point
+     * \param pointStride Distance between two points in floats
+     * \param numPoints Number of points in the point map
+     */
+    void update(const float* points, int pointStride, int numPoints);
+
+    /**
+     * \brief Writes the grid as occupancy values: -1 for unobserved cells,
+     * 100 for obstacles and 0 for free cells
+     */
+    void getOccupancy(std::vector<int8_t>& occupancy) const;
+
+    int getCellsX() const { return cellsX; }
+    int getCellsY() const { return cellsY; }
+    float getResolution() const { return resolution; }
+    float getCameraHeight() const { return cameraHeight; }
+
+    /**
+     * \brief Minimum heights of all cells (NaN for cells without points)
+     */
+    const std::vector<float>& getMinHeights() const { return minHeights; }
+
+    /**
+     * \brief Maximum heights of all cells (NaN for cells without points)
+     */
+    const std::vector<float>& getMaxHeights() const { return maxHeights; }
+
+    const std::vector<uint16_t>& getCounts() const { return counts; }
+
+    /**
+     * \brief Returns true if the cell is considered an obstacle
+     */
+    bool isObstacle(int index) const {
+        return counts[index] >= minPoints && maxHeights[index] > obstacleHeight;
+    }
+
+private:
+    float resolution;
+    float cameraHeight;
+    float minHeight;
+    float maxHeight;
+    float obstacleHeight;
+    int minPoints;
+    int cellsX;
+    int cellsY;
+    float rotation[9];
+
+    std::vector<float> minHeights;
+    std::vector<float> maxHeights;
+    std::vector<uint16_t> counts;
+};
+
+} // namespace
+
+#endif
@@ -0,0 +1,104 @@
+/*******************************************************************************
+ * Copyright (c) 2022 Nerian Vision GmbH
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *******************************************************************************/
+
+#include "host_matcher.h"
+
+#include <algorithm>
+
+using namespace visiontransfer;
+
+namespace nerian_stereo {
+
+HostMatcher::HostMatcher(Algorithm algorithm, int numDisparities, int blockSize, int uniquenessRatio) {
+    // OpenCV requires a multiple of 16, and 12-bit disparities with a
+    // subpixel factor of 16 cannot exceed 256 pixels
+    this->numDisparities = std::min(std::max((numDisparities + 15) / 16 * 16, 16), 256);
+    blockSize = std::max(blockSize | 1, 3);
+
+    if(algorithm == BLOCK_MATCHING) {
+        cv::Ptr<cv::StereoBM> bm = cv::StereoBM::create(this->numDisparities, std::max(blockSize, 5));
+        bm->setUniquenessRatio(uniquenessRatio);
+        matcher = bm;
+    } else {
+        // The 3-way variant processes image rows in parallel, unlike the
+        // default single-threaded mode
+        cv::Ptr<cv::StereoSGBM> sgbm = cv::StereoSGBM::create(0, this->numDisparities, blockSize,
+            8 * blockSize * blockSize, 32 * blockSize * blockSize, 1, 63, uniquenessRatio,
+            0, 0, cv::StereoSGBM::MODE_SGBM_3WAY);
+        matcher = sgbm;
+    }
+}
+
+bool HostMatcher::getGrayImage(const ImageSet& imageSet, ImageSet::ImageType type,
+        cv::Mat& buffer, cv::Mat& gray) {
+    int index = imageSet.getIndexOf(type);
+    if(index < 0) {
+        return false;
+    }
+
+    switch(imageSet.getPixelFormat(index)) {
+        case ImageSet::FORMAT_8_BIT_MONO:
+            gray = cv::Mat(imageSet.getHeight(), imageSet.getWidth(), CV_8UC1,
+                imageSet.getPixelData(index), imageSet.getRowStride(index));
+            return true;
+        case ImageSet::FORMAT_12_BIT_MONO:
+            cv::Mat(imageSet.getHeight(), imageSet.getWidth(), CV_16UC1,
+                imageSet.getPixelData(index), imageSet.getRowStride(index)).convertTo(buffer, CV_8U, 1.0/16);
+            gray = buffer;
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool HostMatcher::compute(ImageSet& imageSet) {
+    if(imageSet.getNumberOfImages() >= ImageSet::MAX_SUPPORTED_IMAGES
+            || imageSet.hasImageType(ImageSet::IMAGE_DISPARITY)) {
+        return false;
+    }
+
+    cv::Mat left, right;
+    if(!getGrayImage(imageSet, ImageSet::IMAGE_LEFT, leftGray, left)
+            || !getGrayImage(imageSet, ImageSet::IMAGE_RIGHT, rightGray, right)) {
+        return false;
+    }
+
+    matcher->compute(left, right, disparity);
+
+    // Convert to 12-bit disparities; OpenCV marks invalid matches with
+    // negative values
+    int width = imageSet.getWidth();
+    int height = imageSet.getHeight();
+    dispBuffer.resize(width * height);
+    for(int y = 0; y < height; y++) {
+        const short* src = disparity.ptr<short>(y);
+        unsigned short* dst = &dispBuffer[y * width];
+        for(int x = 0; x < width; x++) {
+            short d = src[x];
+            dst[x] = d < 0 ? INVALID_DISPARITY : std::min<unsigned short>(d, INVALID_DISPARITY - 1);
+        }
+    }
+
+    int index = imageSet.getNumberOfImages();
+    imageSet.setNumberOfImages(index + 1);
+    imageSet.setPixelFormat(index, ImageSet::FORMAT_12_BIT_MONO);
+    imageSet.setRowStride(index, width * sizeof(unsigned short));
+    imageSet.setPixelData(index, reinterpret_cast<unsigned char*>(&dispBuffer[0]));
+    imageSet.setIndexOf(ImageSet::IMAGE_DISPARITY, index);
+    imageSet.setSubpixelFactor(16);
+    imageSet.setDisparityRange(0, numDisparities - 1);
+    return true;
+}
+
+} // namespace
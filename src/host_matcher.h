@@ -0,0 +1,78 @@
+/*******************************************************************************
+ * Copyright (c) 2022 Nerian Vision GmbH
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *******************************************************************************/
+
+#ifndef __NERIAN_STEREO_HOST_MATCHER_H__
+#define __NERIAN_STEREO_HOST_MATCHER_H__
+
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include <visiontransfer/imageset.h>
+
+namespace nerian_stereo {
+
+/**
+ * \brief Computes disparity maps on the host from the rectified left and
+ * right images.
+ *
+ * Used when the disparity output of the device is deactivated. Matching is
+ * performed with OpenCV's block matcher or semi-global matcher, which both
+ * use SIMD instructions and process bands of image rows in parallel. The
+ * result is converted to the 12-bit format of the device, with a subpixel
+ * factor of 16, and added to the image set. All subsequent processing hence
+ * works as for disparity maps received from the device.
+ */
+class HostMatcher {
+public:
+    enum Algorithm {
+        BLOCK_MATCHING,
+        SEMI_GLOBAL_MATCHING
+    };
+
+    /**
+     * \brief Creates a new matcher
+     *
+     * \param algorithm Matching algorithm
+     * \param numDisparities Size of the disparity range, which is rounded up
+     *        to a multiple of 16 and limited to 256
+     * \param blockSize Size of the matching window (odd)
+     * \param uniquenessRatio Margin in percent by which the best match must
+     *        win over the second best match, or 0 for no uniqueness check
+     */
+    HostMatcher(Algorithm algorithm, int numDisparities, int blockSize, int uniquenessRatio);
+
+    /**
+     * \brief Computes the disparity map for an image set with left and right
+     * image, and adds it to the set
+     *
+     * The added disparity map remains valid until the next call. Returns
+     * false if the image set does not contain a matchable image pair.
+     */
+    bool compute(visiontransfer::ImageSet& imageSet);
+
+private:
+    static const unsigned short INVALID_DISPARITY = 0xFFF;
+
+    int numDisparities;
+    cv::Ptr<cv::StereoMatcher> matcher;
+    cv::Mat leftGray, rightGray;
+    cv::Mat disparity;
+    std::vector<unsigned short> dispBuffer;
+
+    bool getGrayImage(const visiontransfer::ImageSet& imageSet, visiontransfer::ImageSet::ImageType type,
+        cv::Mat& buffer, cv::Mat& gray);
+};
+
+} // namespace
+
+#endif
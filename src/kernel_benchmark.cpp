@@ -0,0 +1,842 @@
+/*******************************************************************************
+ * Copyright (c) 2022 Nerian Vision GmbH
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *******************************************************************************/
+
+/*
+ * Microbenchmark and correctness check for the conversion kernels of the
+ * driver. Each kernel is run on randomized inputs with edge cases (odd
+ * widths, row stride padding, invalid disparities and values at the
+ * maximum depth), and its output is compared bit by bit against a simple
+ * scalar reference implementation. For the SSE2 kernels, the reference
+ * performs the same floating point operations as the scalar path. The throughput of each kernel is then
+ * measured on a full-resolution image.
+ *
+ * Usage: nerian_stereo_kernel_benchmark [seconds per measurement]
+ *
+ * The exit code is non-zero if any kernel differs from its reference.
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <random>
+#include <chrono>
+#include <limits>
+#include <cmath>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+
+#include <opencv2/opencv.hpp>
+#include <visiontransfer/imageset.h>
+#include <colorcoder.h>
+
+#include "point_cloud_kernels.h"
+#include "disparity_converter.h"
+#include "tone_mapper.h"
+#include "disparity_filter.h"
+#include "normal_estimation.h"
+#include "laser_scan.h"
+
+using namespace visiontransfer;
+using namespace nerian_stereo;
+
+namespace {
+
+struct TestSize {
+    int width;
+    int height;
+    int padding; // Additional bytes at the end of each image row
+};
+
+// The first size is used for the throughput measurements
+const TestSize testSizes[] = {
+    {1024, 768, 0},
+    {1027, 771, 52},
+    {641, 3, 0},
+    {7, 5, 14},
+    {1, 1, 4}
+};
+
+const unsigned short INVALID_DISPARITY = 0xFFF;
+
+double minSeconds = 0.2;
+int numFailures = 0;
+std::mt19937 rng(1234);
+
+std::string formatSize(const TestSize& size) {
+    std::stringstream ss;
+    ss << size.width << "x" << size.height << "+" << size.padding;
+    return ss.str();
+}
+
+/**
+ * Runs the function repeatedly for at least minSeconds and returns the
+ * average time per call in seconds
+ */
+template <class F> double measure(const F& function) {
+    function(); // Warm-up
+
+    int iterations = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    double elapsed = 0;
+    do {
+        function();
+        iterations++;
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    } while(elapsed < minSeconds);
+
+    return elapsed / iterations;
+}
+
+void reportCheck(const std::string& kernel, const TestSize& size, size_t mismatches, size_t total) {
+    if(mismatches > 0) {
+        numFailures++;
+        std::cout << "FAIL  " << std::left << std::setw(46) << kernel << std::setw(14) << formatSize(size)
+            << mismatches << " of " << total << " elements differ" << std::endl;
+    }
+}
+
+void reportTiming(const std::string& kernel, const TestSize& size, double seconds, size_t bytes) {
+    double pixels = static_cast<double>(size.width) * size.height;
+    std::cout << "      " << std::left << std::setw(46) << kernel << std::setw(14) << formatSize(size)
+        << std::right << std::fixed << std::setprecision(3) << std::setw(9) << seconds * 1e9 / pixels
+        << " ns/px" << std::setprecision(2) << std::setw(9) << bytes / seconds * 1e-9 << " GB/s" << std::endl;
+}
+
+// Counts the elements of the given size that differ in any bit
+size_t countMismatches(const void* a, const void* b, size_t numElements, size_t elementSize) {
+    const unsigned char* pa = reinterpret_cast<const unsigned char*>(a);
+    const unsigned char* pb = reinterpret_cast<const unsigned char*>(b);
+    size_t mismatches = 0;
+    for(size_t i = 0; i < numElements; i++) {
+        if(memcmp(pa + i*elementSize, pb + i*elementSize, elementSize) != 0) {
+            mismatches++;
+        }
+    }
+    return mismatches;
+}
+
+// Image with randomized content, including the row padding
+struct TestImage {
+    std::vector<unsigned char> data;
+    int rowStride;
+
+    TestImage(const TestSize& size, int bytesPerPixel)
+        : data(static_cast<size_t>(size.width * bytesPerPixel + size.padding) * size.height + 16),
+        rowStride(size.width * bytesPerPixel + size.padding) {
+        std::uniform_int_distribution<int> dist(0, 255);
+        for(unsigned char& value: data) {
+            value = static_cast<unsigned char>(dist(rng));
+        }
+    }
+
+    unsigned char* row(int y) {
+        return &data[static_cast<size_t>(y) * rowStride];
+    }
+};
+
+// Fills a 12-bit image, with edge values and invalid values at the given rate
+void fill12Bit(TestImage& image, const TestSize& size, double invalidRate) {
+    std::uniform_int_distribution<int> dist(0, 4095);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    for(int y = 0; y < size.height; y++) {
+        unsigned short* row = reinterpret_cast<unsigned short*>(image.row(y));
+        for(int x = 0; x < size.width; x++) {
+            double r = uniform(rng);
+            if(r < invalidRate) {
+                row[x] = INVALID_DISPARITY;
+            } else if(r < invalidRate + 0.01) {
+                row[x] = 0;
+            } else if(r < invalidRate + 0.02) {
+                row[x] = 4094;
+            } else {
+                row[x] = dist(rng) % 4095;
+            }
+        }
+    }
+}
+
+ImageSet createImageSet(const TestSize& size, ImageSet::ImageFormat format, ImageSet::ImageType type,
+        TestImage& image) {
+    ImageSet imageSet;
+    imageSet.setWidth(size.width);
+    imageSet.setHeight(size.height);
+    imageSet.setNumberOfImages(1);
+    imageSet.setPixelFormat(0, format);
+    imageSet.setRowStride(0, image.rowStride);
+    imageSet.setPixelData(0, &image.data[0]);
+    imageSet.setIndexOf(ImageSet::IMAGE_LEFT, -1);
+    imageSet.setIndexOf(ImageSet::IMAGE_RIGHT, -1);
+    imageSet.setIndexOf(ImageSet::IMAGE_DISPARITY, -1);
+    imageSet.setIndexOf(ImageSet::IMAGE_COLOR, -1);
+    imageSet.setIndexOf(type, 0);
+    return imageSet;
+}
+
+/******************************* Point cloud *******************************/
+
+void referenceClamped(const float* src, float* dst, int size, int coord, double maxDepth) {
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    for(int i = 0; i < size; i++) {
+        bool clamp = src[4*i + coord] > maxDepth;
+        for(int k = 0; k < 3; k++) {
+            dst[4*i + k] = clamp ? nan : src[4*i + k];
+        }
+    }
+}
+
+void testCopyPointCloudClamped() {
+    const double maxDepths[] = {0.0, 5.0, 1e6};
+    for(const TestSize& size: testSizes) {
+        int numPoints = size.width * size.height;
+        std::vector<float> points(4 * numPoints);
+        std::vector<float> result(4 * numPoints), reference(4 * numPoints);
+
+        for(double maxDepth: maxDepths) {
+            // Random points with NaN, infinite and boundary values
+            std::uniform_real_distribution<float> dist(-10.0f, 20.0f);
+            const float specials[] = {std::numeric_limits<float>::quiet_NaN(),
+                std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity(),
+                static_cast<float>(maxDepth), std::nextafter(static_cast<float>(maxDepth), 1e30f),
+                std::nextafter(static_cast<float>(maxDepth), -1e30f), -0.0f};
+            for(size_t i = 0; i < points.size(); i++) {
+                points[i] = (i % 5 == 0) ? specials[(i / 5) % 7] : dist(rng);
+            }
+
+            for(int coord = 0; coord <= 2; coord += 2) {
+                // The fourth float of each point must remain untouched
+                std::fill(result.begin(), result.end(), 1.5f);
+                std::fill(reference.begin(), reference.end(), 1.5f);
+                if(coord == 0) {
+                    copyPointCloudClamped<0>(&points[0], &result[0], numPoints, maxDepth);
+                } else {
+                    copyPointCloudClamped<2>(&points[0], &result[0], numPoints, maxDepth);
+                }
+                referenceClamped(&points[0], &reference[0], numPoints, coord, maxDepth);
+
+                std::stringstream name;
+                name << "copyPointCloudClamped<" << coord << "> max " << maxDepth;
+                reportCheck(name.str(), size, countMismatches(&result[0], &reference[0], numPoints,
+                    4*sizeof(float)), numPoints);
+
+                if(&size == &testSizes[0] && maxDepth == 5.0) {
+                    double seconds = measure([&]() {
+                        if(coord == 0) {
+                            copyPointCloudClamped<0>(&points[0], &result[0], numPoints, maxDepth);
+                        } else {
+                            copyPointCloudClamped<2>(&points[0], &result[0], numPoints, maxDepth);
+                        }
+                    });
+                    reportTiming(name.str(), size, seconds, numPoints * 2 * 4 * sizeof(float));
+                }
+            }
+        }
+    }
+}
+
+// Computes the fourth point element of the reference for one pixel
+void referenceIntensity(PointCloudColorMode mode, ImageSet::ImageFormat format, const unsigned char* pixel,
+        unsigned char* dst) {
+    unsigned int r = 0, g = 0, b = 0;
+    float normalized = 0;
+    switch(format) {
+        case ImageSet::FORMAT_8_BIT_MONO:
+            r = g = b = pixel[0];
+            normalized = pixel[0] / 255.0F;
+            break;
+        case ImageSet::FORMAT_12_BIT_MONO: {
+            unsigned short value = *reinterpret_cast<const unsigned short*>(pixel);
+            r = g = b = value / 16;
+            normalized = value / 4095.0F;
+            break;
+        }
+        default:
+            r = pixel[0];
+            g = pixel[1];
+            b = pixel[2];
+            normalized = b / 255.0F;
+            break;
+    }
+
+    if(mode == RGB_SEPARATE) {
+        memcpy(dst, &normalized, sizeof(float));
+    } else if(mode == RGB_COMBINED) {
+        unsigned int combined = (r << 16) | (g << 8) | b;
+        memcpy(dst, &combined, sizeof(unsigned int));
+    } else if(format == ImageSet::FORMAT_8_BIT_RGB) {
+        dst[0] = (r + 2*g + b) / 4;
+    } else {
+        dst[0] = r;
+    }
+}
+
+void testCopyPointCloudIntensity() {
+    const PointCloudColorMode modes[] = {RGB_SEPARATE, RGB_COMBINED, INTENSITY};
+    const char* modeNames[] = {"RGB_SEPARATE", "RGB_COMBINED", "INTENSITY"};
+    const ImageSet::ImageFormat formats[] = {ImageSet::FORMAT_8_BIT_MONO, ImageSet::FORMAT_12_BIT_MONO,
+        ImageSet::FORMAT_8_BIT_RGB};
+    const char* formatNames[] = {"mono8", "mono12", "rgb8"};
+    const int bytesPerPixel[] = {1, 2, 3};
+
+    for(const TestSize& size: testSizes) {
+        int numPoints = size.width * size.height;
+        std::vector<unsigned char> result(numPoints * 4 * sizeof(float));
+        std::vector<unsigned char> reference(result.size());
+
+        for(int f = 0; f < 3; f++) {
+            TestImage image(size, bytesPerPixel[f]);
+            if(formats[f] == ImageSet::FORMAT_12_BIT_MONO) {
+                fill12Bit(image, size, 0.0);
+            }
+            ImageSet imageSet = createImageSet(size, formats[f], formats[f] == ImageSet::FORMAT_8_BIT_RGB
+                ? ImageSet::IMAGE_COLOR : ImageSet::IMAGE_LEFT, image);
+
+            for(int m = 0; m < 3; m++) {
+                std::fill(result.begin(), result.end(), 0x5A);
+                std::fill(reference.begin(), reference.end(), 0x5A);
+
+                auto run = [&]() {
+                    switch(modes[m]) {
+                        case RGB_SEPARATE: copyPointCloudIntensity<RGB_SEPARATE>(imageSet, &result[0]); break;
+                        case RGB_COMBINED: copyPointCloudIntensity<RGB_COMBINED>(imageSet, &result[0]); break;
+                        default: copyPointCloudIntensity<INTENSITY>(imageSet, &result[0]); break;
+                    }
+                };
+                run();
+
+                for(int y = 0; y < size.height; y++) {
+                    for(int x = 0; x < size.width; x++) {
+                        referenceIntensity(modes[m], formats[f], image.row(y) + x*bytesPerPixel[f],
+                            &reference[(static_cast<size_t>(y) * size.width + x) * 4 * sizeof(float)
+                                + 3*sizeof(float)]);
+                    }
+                }
+
+                std::string name = std::string("copyPointCloudIntensity<") + modeNames[m] + "> "
+                    + formatNames[f];
+                reportCheck(name, size, countMismatches(&result[0], &reference[0], numPoints,
+                    4*sizeof(float)), numPoints);
+
+                if(&size == &testSizes[0]) {
+                    double seconds = measure(run);
+                    reportTiming(name, size, seconds, numPoints * (bytesPerPixel[f] + sizeof(float)));
+                }
+            }
+        }
+    }
+}
+
+void testQMatrixToRosCoords() {
+    // Rows of the result: third, negated first and negated second row of
+    // the source, and the unchanged fourth row
+    const int sourceRows[] = {2, 0, 1, 3};
+    const float signs[] = {1.0f, -1.0f, -1.0f, 1.0f};
+
+    std::uniform_real_distribution<float> dist(-1000.0f, 1000.0f);
+    TestSize size = {4, 4, 0};
+    size_t mismatches = 0;
+    for(int i = 0; i < 1000; i++) {
+        float q[16], result[16], reference[16];
+        for(int j = 0; j < 16; j++) {
+            q[j] = (i % 10 == 0 && j % 3 == 0) ? 0.0f : dist(rng);
+        }
+        qMatrixToRosCoords(q, result);
+        for(int row = 0; row < 4; row++) {
+            for(int col = 0; col < 4; col++) {
+                float value = q[sourceRows[row]*4 + col];
+                reference[row*4 + col] = signs[row] < 0 ? -value : value;
+            }
+        }
+        mismatches += countMismatches(result, reference, 16, sizeof(float));
+    }
+    reportCheck("qMatrixToRosCoords", size, mismatches, 16000);
+
+    float q[16], result[16];
+    for(int j = 0; j < 16; j++) {
+        q[j] = dist(rng);
+    }
+    double seconds = measure([&]() {
+        // Batches of calls, as a single call is below the timer resolution
+        for(int i = 0; i < 1000; i++) {
+            qMatrixToRosCoords(q, result);
+            q[i & 15] = result[(i + 1) & 15];
+        }
+    }) / 1000;
+    reportTiming("qMatrixToRosCoords", size, seconds, 2 * sizeof(q));
+}
+
+/******************************** Images ***********************************/
+
+void testDisparityConverter() {
+    const int subpixelFactors[] = {16, 8};
+    for(const TestSize& size: testSizes) {
+        for(int subpixelFactor: subpixelFactors) {
+            TestImage image(size, 2);
+            fill12Bit(image, size, 0.1);
+
+            // Invalid border rows and columns for the valid window
+            for(int y = 0; y < size.height; y++) {
+                unsigned short* row = reinterpret_cast<unsigned short*>(image.row(y));
+                for(int x = 0; x < size.width; x++) {
+                    if(y < size.height / 8 || x >= size.width - size.width / 8) {
+                        row[x] = INVALID_DISPARITY;
+                    }
+                }
+            }
+
+            int numPixels = size.width * size.height;
+            std::vector<float> result(numPixels), reference(numPixels);
+            DisparityConverter converter;
+            converter.convert(reinterpret_cast<unsigned short*>(&image.data[0]), size.width, size.height,
+                image.rowStride, subpixelFactor, &result[0]);
+
+            float scale = 1.0f / subpixelFactor;
+            int minX = size.width, minY = size.height, maxX = -1, maxY = -1;
+            for(int y = 0; y < size.height; y++) {
+                const unsigned short* row = reinterpret_cast<const unsigned short*>(image.row(y));
+                for(int x = 0; x < size.width; x++) {
+                    bool valid = row[x] != INVALID_DISPARITY;
+                    reference[y*size.width + x] = valid ? row[x] * scale : -1.0f;
+                    if(valid) {
+                        minX = std::min(minX, x);
+                        maxX = std::max(maxX, x);
+                        minY = std::min(minY, y);
+                        maxY = std::max(maxY, y);
+                    }
+                }
+            }
+
+            std::stringstream name;
+            name << "DisparityConverter::convert subpix " << subpixelFactor;
+            size_t mismatches = countMismatches(&result[0], &reference[0], numPixels, sizeof(float));
+
+            int x = 0, y = 0, width = 0, height = 0;
+            converter.getValidWindow(x, y, width, height);
+            if(maxX < 0 ? (width != 0 || height != 0) : (x != minX || y != minY || width != maxX - minX + 1
+                    || height != maxY - minY + 1)) {
+                mismatches++;
+            }
+            reportCheck(name.str(), size, mismatches, numPixels + 1);
+
+            if(&size == &testSizes[0] && subpixelFactor == 16) {
+                double seconds = measure([&]() {
+                    converter.convert(reinterpret_cast<unsigned short*>(&image.data[0]), size.width,
+                        size.height, image.rowStride, subpixelFactor, &result[0]);
+                });
+                reportTiming(name.str(), size, seconds, numPixels * (sizeof(unsigned short) + sizeof(float)));
+            }
+        }
+    }
+}
+
+void testToneMapper() {
+    const ToneMapper::Mode modes[] = {ToneMapper::LINEAR, ToneMapper::GAMMA};
+    const char* names[] = {"ToneMapper::map linear", "ToneMapper::map gamma"};
+    const double gamma = 2.2;
+
+    for(const TestSize& size: testSizes) {
+        TestImage image(size, 2);
+        fill12Bit(image, size, 0.0);
+        int dstStride = size.width + size.padding;
+        std::vector<unsigned char> result(dstStride * size.height), reference(result.size());
+
+        for(int m = 0; m < 2; m++) {
+            ToneMapper mapper(modes[m], gamma);
+            std::fill(result.begin(), result.end(), 0x5A);
+            std::fill(reference.begin(), reference.end(), 0x5A);
+            mapper.map(reinterpret_cast<unsigned short*>(&image.data[0]), size.width, size.height,
+                image.rowStride, &result[0], dstStride);
+
+            for(int y = 0; y < size.height; y++) {
+                const unsigned short* row = reinterpret_cast<const unsigned short*>(image.row(y));
+                for(int x = 0; x < size.width; x++) {
+                    unsigned char& dst = reference[y*dstStride + x];
+                    if(modes[m] == ToneMapper::LINEAR) {
+                        dst = row[x] >> 4;
+                    } else {
+                        dst = static_cast<unsigned char>(std::pow(row[x] / 4095.0, 1.0 / gamma) * 255.0 + 0.5);
+                    }
+                }
+            }
+
+            // The padding of the destination must remain untouched as well
+            reportCheck(names[m], size, countMismatches(&result[0], &reference[0], result.size(), 1),
+                result.size());
+
+            if(&size == &testSizes[0]) {
+                double seconds = measure([&]() {
+                    mapper.map(reinterpret_cast<unsigned short*>(&image.data[0]), size.width, size.height,
+                        image.rowStride, &result[0], dstStride);
+                });
+                reportTiming(names[m], size, seconds, size.width * size.height * 3);
+            }
+        }
+    }
+}
+
+void testColorCoder() {
+    // Same configuration as for the color coded disparity map
+    const int dispMax = 127;
+    for(const TestSize& size: testSizes) {
+        TestImage image(size, 2);
+        fill12Bit(image, size, 0.1);
+
+        ColorCoder coder(ColorCoder::COLOR_RAINBOW_BGR, 0, dispMax*16, true, true);
+        cv::Mat_<unsigned short> input(size.height, size.width,
+            reinterpret_cast<unsigned short*>(&image.data[0]), image.rowStride);
+        cv::Mat_<cv::Vec3b> result(size.height, size.width), reference(size.height, size.width);
+
+        coder.codeImage(input, result);
+        for(int y = 0; y < size.height; y++) {
+            for(int x = 0; x < size.width; x++) {
+                reference(y, x) = coder.getColor(static_cast<float>(input(y, x)));
+            }
+        }
+
+        size_t mismatches = 0;
+        for(int y = 0; y < size.height; y++) {
+            mismatches += countMismatches(result.ptr(y), reference.ptr(y), size.width, sizeof(cv::Vec3b));
+        }
+        reportCheck("ColorCoder::codeImage rainbow", size, mismatches, size.width * size.height);
+
+        if(&size == &testSizes[0]) {
+            double seconds = measure([&]() {
+                coder.codeImage(input, result);
+            });
+            reportTiming("ColorCoder::codeImage rainbow", size, seconds, size.width * size.height * 5);
+        }
+    }
+}
+
+/***************************** Derived outputs *****************************/
+
+void testDisparityFilterMedian() {
+    // The median is applied from the third frame on; later frames verify
+    // that the history is updated as well
+    const int numFrames = 5;
+    for(const TestSize& size: testSizes) {
+        DisparityFilter filter(0, 0.0, 0, 0.0, true);
+        std::vector<unsigned short> history[2];
+        size_t mismatches = 0, total = 0;
+
+        for(int frame = 0; frame < numFrames; frame++) {
+            TestImage image(size, 2);
+            fill12Bit(image, size, 0.2);
+            std::vector<unsigned char> reference = image.data;
+            std::vector<unsigned short> input(size.width * size.height);
+
+            for(int y = 0; y < size.height; y++) {
+                const unsigned short* row = reinterpret_cast<const unsigned short*>(image.row(y));
+                unsigned short* refRow = reinterpret_cast<unsigned short*>(
+                    &reference[static_cast<size_t>(y) * image.rowStride]);
+                for(int x = 0; x < size.width; x++) {
+                    unsigned short a = row[x];
+                    input[y*size.width + x] = a;
+                    if(frame >= 2) {
+                        unsigned short b = history[(frame - 1) % 2][y*size.width + x];
+                        unsigned short c = history[frame % 2][y*size.width + x];
+                        refRow[x] = std::max(std::min(a, b), std::min(std::max(a, b), c));
+                    }
+                }
+            }
+            history[frame % 2].swap(input);
+
+            filter.process(reinterpret_cast<unsigned short*>(&image.data[0]), size.width, size.height,
+                image.rowStride, 16);
+
+            // The row padding must remain untouched as well
+            mismatches += countMismatches(&image.data[0], &reference[0], image.data.size(), 1);
+            total += image.data.size();
+        }
+        reportCheck("DisparityFilter::process temporal median", size, mismatches, total);
+
+        if(&size == &testSizes[0]) {
+            TestImage image(size, 2);
+            fill12Bit(image, size, 0.2);
+            double seconds = measure([&]() {
+                filter.process(reinterpret_cast<unsigned short*>(&image.data[0]), size.width, size.height,
+                    image.rowStride, 16);
+            });
+            reportTiming("DisparityFilter::process temporal median", size, seconds,
+                size.width * size.height * 5 * sizeof(unsigned short));
+        }
+    }
+}
+
+// Scalar version of NormalEstimator::compute with a point and normal stride of 4
+void referenceNormals(const float* points, int width, int height, int radius, float maxDepthChange,
+        float* normals) {
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    const float inf = std::numeric_limits<float>::infinity();
+    const float maxRatio = maxDepthChange * 2 * radius;
+    const float maxRatioSq = maxRatio * maxRatio;
+
+    for(int y = 0; y < height; y++) {
+        for(int x = 0; x < width; x++) {
+            float* n = &normals[4 * (static_cast<size_t>(y) * width + x)];
+            n[0] = n[1] = n[2] = nan;
+            if(x < radius || x >= width - radius || y < radius || y >= height - radius) {
+                continue;
+            }
+
+            const float* p = &points[4 * (static_cast<size_t>(y) * width + x)];
+            const float* left = p - 4*radius;
+            const float* right = p + 4*radius;
+            const float* up = p - 4*radius*width;
+            const float* down = p + 4*radius*width;
+
+            const float* neighborhood[] = {p, left, right, up, down};
+            bool valid = true;
+            for(const float* q: neighborhood) {
+                valid = valid && std::fabs(q[0] + q[1] + q[2]) < inf;
+            }
+            if(!valid) {
+                continue;
+            }
+
+            float limit = maxRatioSq * (p[0]*p[0] + p[1]*p[1] + p[2]*p[2]);
+            float hx = right[0] - left[0], hy = right[1] - left[1], hz = right[2] - left[2];
+            float vx = down[0] - up[0], vy = down[1] - up[1], vz = down[2] - up[2];
+            if(hx*hx + hy*hy + hz*hz > limit || vx*vx + vy*vy + vz*vz > limit) {
+                continue;
+            }
+
+            float nx = hy*vz - hz*vy;
+            float ny = hz*vx - hx*vz;
+            float nz = hx*vy - hy*vx;
+            float lengthSq = nx*nx + ny*ny + nz*nz;
+            if(!(lengthSq > 0.0f)) {
+                continue;
+            }
+
+            float scale = 1.0f / std::sqrt(lengthSq);
+            if(nx*p[0] + ny*p[1] + nz*p[2] > 0.0f) {
+                scale = -scale;
+            }
+            n[0] = nx * scale;
+            n[1] = ny * scale;
+            n[2] = nz * scale;
+        }
+    }
+}
+
+void testNormalEstimator() {
+    const int radii[] = {1, 2};
+    const float maxDepthChange = 0.05f;
+    for(const TestSize& size: testSizes) {
+        // Noisy staircase of planes, with invalid points and depth
+        // discontinuities at the steps
+        int numPoints = size.width * size.height;
+        std::vector<float> points(4 * numPoints);
+        std::uniform_real_distribution<float> noise(-0.002f, 0.002f);
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        for(int y = 0; y < size.height; y++) {
+            for(int x = 0; x < size.width; x++) {
+                float* p = &points[4 * (static_cast<size_t>(y) * size.width + x)];
+                float z = 2.0f + 0.002f*x + 0.001f*y + ((x/37 + y/23) % 2) + noise(rng);
+                p[0] = (x - size.width / 2) * z / 500.0f;
+                p[1] = (y - size.height / 2) * z / 500.0f;
+                p[2] = z;
+                p[3] = 1.5f;
+                double r = uniform(rng);
+                if(r < 0.03) {
+                    p[r < 0.015 ? 0 : 2] = std::numeric_limits<float>::quiet_NaN();
+                } else if(r < 0.04) {
+                    p[1] = std::numeric_limits<float>::infinity();
+                }
+            }
+        }
+
+        std::vector<float> result(4 * numPoints), reference(4 * numPoints);
+        for(int radius: radii) {
+            NormalEstimator estimator(radius, maxDepthChange);
+            // The fourth float of each normal must remain untouched
+            std::fill(result.begin(), result.end(), 1.5f);
+            std::fill(reference.begin(), reference.end(), 1.5f);
+            estimator.compute(&points[0], 4, size.width, size.height, &result[0], 4);
+            referenceNormals(&points[0], size.width, size.height, radius, maxDepthChange, &reference[0]);
+
+            std::stringstream name;
+            name << "NormalEstimator::compute radius " << radius;
+            reportCheck(name.str(), size, countMismatches(&result[0], &reference[0], numPoints,
+                4*sizeof(float)), numPoints);
+
+            if(&size == &testSizes[0] && radius == 2) {
+                double seconds = measure([&]() {
+                    estimator.compute(&points[0], 4, size.width, size.height, &result[0], 4);
+                });
+                reportTiming(name.str(), size, seconds, numPoints * 2 * 4 * sizeof(float));
+            }
+        }
+    }
+}
+
+struct LaserScanResult {
+    std::vector<float> ranges;
+    float angleMin;
+    float angleMax;
+    float angleIncrement;
+};
+
+// Scalar version of LaserScanGenerator::compute, including the mapping of
+// columns to angle bins
+LaserScanResult referenceLaserScan(const unsigned short* dispMap, int width, int height, int rowStride,
+        const float* q, int subpixelFactor, float firstRow, float lastRow, float minHeight,
+        float maxHeight, float maxRange) {
+    int startRow = std::max(0, static_cast<int>(firstRow * height));
+    int endRow = std::min(height, static_cast<int>(std::ceil(lastRow * height)));
+    if(endRow <= startRow) {
+        endRow = std::min(height, startRow + 1);
+    }
+
+    LaserScanResult result;
+    int row = (startRow + endRow) / 2;
+    std::vector<float> angles(width);
+    for(int x = 0; x < width; x++) {
+        float px = q[0]*x + q[1]*row + q[2] + q[3];
+        float pz = q[8]*x + q[9]*row + q[10] + q[11];
+        float pw = q[12]*x + q[13]*row + q[14] + q[15];
+        angles[x] = std::atan2(-px/pw, pz/pw);
+    }
+    result.angleMin = *std::min_element(angles.begin(), angles.end());
+    result.angleMax = *std::max_element(angles.begin(), angles.end());
+    result.angleIncrement = 0.0f;
+    for(int x = 1; x < width; x++) {
+        result.angleIncrement = std::max(result.angleIncrement, std::fabs(angles[x] - angles[x-1]));
+    }
+    int numBins = 1;
+    if(result.angleIncrement > 0) {
+        numBins = static_cast<int>(std::round((result.angleMax - result.angleMin) / result.angleIncrement)) + 1;
+        result.angleMax = result.angleMin + (numBins - 1) * result.angleIncrement;
+    }
+
+    const float inf = std::numeric_limits<float>::infinity();
+    const float dispScale = 1.0f / subpixelFactor;
+    std::vector<float> columnRanges(width, inf);
+    for(int y = startRow; y < endRow; y++) {
+        const unsigned short* dispRow = reinterpret_cast<const unsigned short*>(
+            reinterpret_cast<const unsigned char*>(dispMap) + y*rowStride);
+        const float qx = q[1]*y + q[3];
+        const float qy = q[5]*y + q[7];
+        const float qz = q[9]*y + q[11];
+        const float qw = q[13]*y + q[15];
+        for(int x = 0; x < width; x++) {
+            if(dispRow[x] == 0 || dispRow[x] >= INVALID_DISPARITY) {
+                continue;
+            }
+            float d = dispRow[x] * dispScale;
+            float invW = 1.0f / (qw + q[12]*x + q[14]*d);
+            float px = (qx + q[0]*x + q[2]*d) * invW;
+            float py = (qy + q[4]*x + q[6]*d) * invW;
+            float pz = (qz + q[8]*x + q[10]*d) * invW;
+            if(pz > 0.0f && -py >= minHeight && -py <= maxHeight) {
+                columnRanges[x] = std::min(columnRanges[x], px*px + pz*pz);
+            }
+        }
+    }
+
+    result.ranges.assign(numBins, inf);
+    for(int x = 0; x < width; x++) {
+        int bin = result.angleIncrement > 0 ?
+            static_cast<int>(std::round((angles[x] - result.angleMin) / result.angleIncrement)) : 0;
+        bin = std::min(std::max(bin, 0), numBins - 1);
+        if(columnRanges[x] <= maxRange * maxRange && columnRanges[x] < result.ranges[bin]) {
+            result.ranges[bin] = columnRanges[x];
+        }
+    }
+    for(float& range: result.ranges) {
+        range = std::sqrt(range);
+    }
+    return result;
+}
+
+void testLaserScanGenerator() {
+    // Bands as relative first and last row; the last one is a single row
+    const float bands[][2] = {{0.0f, 1.0f}, {0.3f, 0.7f}, {0.5f, 0.5f}};
+    const float minHeight = -0.2f, maxHeight = 0.3f, maxRange = 5.0f;
+    const int subpixelFactor = 16;
+
+    for(const TestSize& size: testSizes) {
+        TestImage image(size, 2);
+        fill12Bit(image, size, 0.1);
+        const unsigned short* dispMap = reinterpret_cast<const unsigned short*>(&image.data[0]);
+
+        // Camera coordinates with a focal length of 500 and 0.1 m baseline
+        float q[16] = {1, 0, 0, -0.5f*size.width, 0, 1, 0, -0.5f*size.height, 0, 0, 0, 500, 0, 0, 10, 0};
+
+        for(const float* band: bands) {
+            LaserScanGenerator generator(band[0], band[1], minHeight, maxHeight, maxRange);
+            generator.compute(dispMap, size.width, size.height, image.rowStride, q, subpixelFactor);
+            LaserScanResult reference = referenceLaserScan(dispMap, size.width, size.height, image.rowStride,
+                q, subpixelFactor, band[0], band[1], minHeight, maxHeight, maxRange);
+
+            const std::vector<float>& ranges = generator.getRanges();
+            size_t mismatches = 0;
+            if(ranges.size() != reference.ranges.size()) {
+                mismatches = reference.ranges.size();
+            } else {
+                mismatches = countMismatches(&ranges[0], &reference.ranges[0], ranges.size(), sizeof(float));
+            }
+            float angles[3] = {generator.getAngleMin(), generator.getAngleMax(), generator.getAngleIncrement()};
+            float referenceAngles[3] = {reference.angleMin, reference.angleMax, reference.angleIncrement};
+            mismatches += countMismatches(angles, referenceAngles, 3, sizeof(float));
+
+            std::stringstream name;
+            name << "LaserScanGenerator::compute rows " << band[0] << "-" << band[1];
+            reportCheck(name.str(), size, mismatches, reference.ranges.size() + 3);
+
+            if(&size == &testSizes[0] && band[0] == 0.0f) {
+                double seconds = measure([&]() {
+                    generator.compute(dispMap, size.width, size.height, image.rowStride, q, subpixelFactor);
+                });
+                reportTiming(name.str(), size, seconds, size.width * size.height * sizeof(unsigned short));
+            }
+        }
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if(argc > 1) {
+        minSeconds = std::max(std::atof(argv[1]), 0.001);
+    }
+
+    std::cout << "Checking kernels against scalar references; timings for "
+        << formatSize(testSizes[0]) << std::endl;
+
+    try {
+        testCopyPointCloudClamped();
+        testCopyPointCloudIntensity();
+        testQMatrixToRosCoords();
+        testDisparityConverter();
+        testToneMapper();
+        testColorCoder();
+        testDisparityFilterMedian();
+        testNormalEstimator();
+        testLaserScanGenerator();
+    } catch(const std::exception& ex) {
+        std::cerr << "Exception occurred: " << ex.what() << std::endl;
+        return 1;
+    }
+
+    if(numFailures > 0) {
+        std::cout << numFailures << " check(s) failed" << std::endl;
+        return 1;
+    }
+    std::cout << "All checks passed" << std::endl;
+    return 0;
+}
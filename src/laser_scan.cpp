@@ -0,0 +1,172 @@
+/*******************************************************************************
+ * Copyright (c) 2022 Nerian Vision GmbH
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *******************************************************************************/
+
+#include "laser_scan.h"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace nerian_stereo {
+
+LaserScanGenerator::LaserScanGenerator(double firstRow, double lastRow, double minHeight,
+        double maxHeight, double maxRange)
+    : firstRow(firstRow), lastRow(lastRow), minHeight(minHeight), maxHeight(maxHeight),
+    maxRange(maxRange), cachedWidth(0), angleMin(0), angleMax(0), angleIncrement(0) {
+    memset(cachedQ, 0, sizeof(cachedQ));
+}
+
+void LaserScanGenerator::updateColumnBins(int width, int row, const float* q) {
+    if(width == cachedWidth && memcmp(q, cachedQ, sizeof(cachedQ)) == 0) {
+        return;
+    }
+    memcpy(cachedQ, q, sizeof(cachedQ));
+    cachedWidth = width;
+
+    // Viewing angle of each column for an arbitrary disparity. The laser scan
+    // angle increases to the left, i.e. towards negative camera x.
+    std::vector<float> angles(width);
+    for(int x = 0; x < width; x++) {
+        float px = q[0]*x + q[1]*row + q[2] + q[3];
+        float pz = q[8]*x + q[9]*row + q[10] + q[11];
+        float pw = q[12]*x + q[13]*row + q[14] + q[15];
+        angles[x] = std::atan2(-px/pw, pz/pw);
+    }
+
+    angleMin = *std::min_element(angles.begin(), angles.end());
+    angleMax = *std::max_element(angles.begin(), angles.end());
+
+    // Columns are spaced widest at the image center. Using that spacing as
+    // increment ensures that no bin between two columns remains empty.
+    angleIncrement = 0.0f;
+    for(int x = 1; x < width; x++) {
+        angleIncrement = std::max(angleIncrement, std::fabs(angles[x] - angles[x-1]));
+    }
+
+    int numBins = 1;
+    if(angleIncrement > 0) {
+        numBins = static_cast<int>(std::round((angleMax - angleMin) / angleIncrement)) + 1;
+        angleMax = angleMin + (numBins - 1) * angleIncrement;
+    }
+
+    columnBins.resize(width);
+    for(int x = 0; x < width; x++) {
+        columnBins[x] = angleIncrement > 0 ?
+            static_cast<int>(std::round((angles[x] - angleMin) / angleIncrement)) : 0;
+        columnBins[x] = std::min(std::max(columnBins[x], 0), numBins - 1);
+    }
+    ranges.resize(numBins);
+}
+
+void LaserScanGenerator::compute(const unsigned short* dispMap, int width, int height,
+        int rowStride, const float* q, int subpixelFactor) {
+    int startRow = std::max(0, static_cast<int>(firstRow * height));
+    int endRow = std::min(height, static_cast<int>(std::ceil(lastRow * height)));
+    if(endRow <= startRow) {
+        endRow = std::min(height, startRow + 1);
+    }
+
+    updateColumnBins(width, (startRow + endRow) / 2, q);
+
+    // Find the nearest squared range per column
+    const float inf = std::numeric_limits<float>::infinity();
+    columnRanges.assign(width, inf);
+    float* colRanges = &columnRanges[0];
+    const float dispScale = 1.0f / subpixelFactor;
+    const float minH = minHeight, maxH = maxHeight;
+
+    for(int y = startRow; y < endRow; y++) {
+        const unsigned short* dispRow = reinterpret_cast<const unsigned short*>(
+            reinterpret_cast<const unsigned char*>(dispMap) + y*rowStride);
+        const float qx = q[1]*y + q[3];
+        const float qy = q[5]*y + q[7];
+        const float qz = q[9]*y + q[11];
+        const float qw = q[13]*y + q[15];
+
+        int x = 0;
+#ifdef __SSE2__
+        const __m128 vq0 = _mm_set1_ps(q[0]), vq2 = _mm_set1_ps(q[2]);
+        const __m128 vq4 = _mm_set1_ps(q[4]), vq6 = _mm_set1_ps(q[6]);
+        const __m128 vq8 = _mm_set1_ps(q[8]), vq10 = _mm_set1_ps(q[10]);
+        const __m128 vq12 = _mm_set1_ps(q[12]), vq14 = _mm_set1_ps(q[14]);
+        const __m128 vqx = _mm_set1_ps(qx), vqy = _mm_set1_ps(qy);
+        const __m128 vqz = _mm_set1_ps(qz), vqw = _mm_set1_ps(qw);
+        const __m128 vDispScale = _mm_set1_ps(dispScale);
+        const __m128 vMinH = _mm_set1_ps(minH), vMaxH = _mm_set1_ps(maxH);
+        const __m128 vInf = _mm_set1_ps(inf), vZero = _mm_setzero_ps(), vOne = _mm_set1_ps(1.0f);
+        const __m128i vInvalidDisp = _mm_set1_epi32(0xFFF);
+        __m128 fx = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+
+        for(; x + 4 <= width; x += 4) {
+            __m128i intDisp = _mm_unpacklo_epi16(
+                _mm_loadl_epi64(reinterpret_cast<const __m128i*>(dispRow + x)), _mm_setzero_si128());
+            __m128 d = _mm_mul_ps(_mm_cvtepi32_ps(intDisp), vDispScale);
+
+            __m128 invW = _mm_div_ps(vOne, _mm_add_ps(_mm_add_ps(vqw, _mm_mul_ps(vq12, fx)), _mm_mul_ps(vq14, d)));
+            __m128 px = _mm_mul_ps(_mm_add_ps(_mm_add_ps(vqx, _mm_mul_ps(vq0, fx)), _mm_mul_ps(vq2, d)), invW);
+            __m128 py = _mm_mul_ps(_mm_add_ps(_mm_add_ps(vqy, _mm_mul_ps(vq4, fx)), _mm_mul_ps(vq6, d)), invW);
+            __m128 pz = _mm_mul_ps(_mm_add_ps(_mm_add_ps(vqz, _mm_mul_ps(vq8, fx)), _mm_mul_ps(vq10, d)), invW);
+
+            // Camera y points down
+            __m128 height = _mm_sub_ps(vZero, py);
+            __m128 valid = _mm_castsi128_ps(_mm_and_si128(_mm_cmpgt_epi32(intDisp, _mm_setzero_si128()),
+                _mm_cmplt_epi32(intDisp, vInvalidDisp)));
+            valid = _mm_and_ps(valid, _mm_cmpgt_ps(pz, vZero));
+            valid = _mm_and_ps(valid, _mm_cmpge_ps(height, vMinH));
+            valid = _mm_and_ps(valid, _mm_cmple_ps(height, vMaxH));
+
+            __m128 range = _mm_add_ps(_mm_mul_ps(px, px), _mm_mul_ps(pz, pz));
+            range = _mm_or_ps(_mm_and_ps(valid, range), _mm_andnot_ps(valid, vInf));
+            _mm_storeu_ps(colRanges + x, _mm_min_ps(_mm_loadu_ps(colRanges + x), range));
+
+            fx = _mm_add_ps(fx, _mm_set1_ps(4.0f));
+        }
+#endif
+
+        for(; x < width; x++) {
+            unsigned short intDisp = dispRow[x];
+            if(intDisp == 0 || intDisp >= 0xFFF) {
+                continue;
+            }
+            float d = intDisp * dispScale;
+            float invW = 1.0f / (qw + q[12]*x + q[14]*d);
+            float px = (qx + q[0]*x + q[2]*d) * invW;
+            float py = (qy + q[4]*x + q[6]*d) * invW;
+            float pz = (qz + q[8]*x + q[10]*d) * invW;
+            if(pz > 0.0f && -py >= minH && -py <= maxH) {
+                colRanges[x] = std::min(colRanges[x], px*px + pz*pz);
+            }
+        }
+    }
+
+    // Merge columns into angle bins
+    std::fill(ranges.begin(), ranges.end(), inf);
+    const float maxRangeSq = maxRange * maxRange;
+    for(int x = 0; x < width; x++) {
+        float& bin = ranges[columnBins[x]];
+        if(columnRanges[x] <= maxRangeSq && columnRanges[x] < bin) {
+            bin = columnRanges[x];
+        }
+    }
+    for(size_t i = 0; i < ranges.size(); i++) {
+        ranges[i] = std::sqrt(ranges[i]);
+    }
+}
+
+} // namespace
@@ -0,0 +1,92 @@
+/*******************************************************************************
+ * Copyright (c) 2022 Nerian Vision GmbH
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *******************************************************************************/
+
+#ifndef __NERIAN_STEREO_LASER_SCAN_H__
+#define __NERIAN_STEREO_LASER_SCAN_H__
+
+#include <vector>
+
+namespace nerian_stereo {
+
+/**
+ * \brief Generates a virtual laser scan from a band of disparity map rows.
+ *
+ * For each image column, the nearest valid point within the band is
+ * selected. Points are reconstructed with the Q matrix directly from the
+ * disparity map, without creating a point cloud. Only the rows of the band
+ * are read. Optionally, only points within a height slice relative to the
+ * camera are considered.
+ *
+ * Ranges are measured in the horizontal plane of the camera (x/z in camera
+ * coordinates). Each column is assigned to the scan bin closest to its
+ * viewing angle, such that the bins have a constant angle increment.
+ * Bins without a valid point are set to infinity.
+ */
+class LaserScanGenerator {
+public:
+    /**
+     * \brief Creates a new generator
+     *
+     * \param firstRow First row of the band, relative to the image height (0 to 1)
+     * \param lastRow Last row of the band, relative to the image height (0 to 1)
+     * \param minHeight Minimum height of points above the camera in meters
+     * \param maxHeight Maximum height of points above the camera in meters
+     * \param maxRange Maximum range of the scan in meters
+     */
+    LaserScanGenerator(double firstRow, double lastRow, double minHeight, double maxHeight,
+        double maxRange);
+
+    /**
+     * \brief Computes the scan from a 12-bit disparity map
+     *
+     * \param dispMap Disparity map with the given subpixel factor; 0xFFF marks invalid pixels
+     * \param width Width of the disparity map
+     * \param height Height of the disparity map
+     * \param rowStride Row stride of the disparity map in bytes
+     * \param q Q matrix in camera coordinates
+     * \param subpixelFactor Subpixel factor of the disparity map
+     */
+    void compute(const unsigned short* dispMap, int width, int height, int rowStride,
+        const float* q, int subpixelFactor);
+
+    const std::vector<float>& getRanges() const { return ranges; }
+    float getAngleMin() const { return angleMin; }
+    float getAngleMax() const { return angleMax; }
+    float getAngleIncrement() const { return angleIncrement; }
+    float getRangeMax() const { return maxRange; }
+
+private:
+    float firstRow;
+    float lastRow;
+    float minHeight;
+    float maxHeight;
+    float maxRange;
+
+    // Column-to-bin mapping, which only changes with the Q matrix
+    float cachedQ[16];
+    int cachedWidth;
+    std::vector<int> columnBins;
+    float angleMin;
+    float angleMax;
+    float angleIncrement;
+
+    std::vector<float> columnRanges;
+    std::vector<float> ranges;
+
+    void updateColumnBins(int width, int row, const float* q);
+};
+
+} // namespace
+
+#endif
@@ -24,8 +24,8 @@ public:
      * \brief The main loop of this node
      */
     int run() {
-        prepareAsyncTransfer();
         try {
+            applyProcessingScheduling();
             while(ros::ok()) {
                 // Dispatch any queued ROS callbacks
                 ros::spinOnce();
@@ -55,14 +55,7 @@ int main(int argc, char** argv) {
     try {
         ros::init(argc, argv, "nerian_stereo");
         nerian_stereo::StereoNode node;
-        node.init();
-        node.initDataChannelService();
-        try {
-            node.initDynamicReconfigure();
-        } catch(...) {
-            ROS_ERROR("Handshake with parameter server failed; no dynamic parameters - please verify firmware version. Image transport is unaffected.");
-        }
-        node.publishTransform(); // initial transform
+        node.startup();
         return node.run();
     } catch(const std::exception& ex) {
         ROS_FATAL("Exception occured: %s", ex.what());
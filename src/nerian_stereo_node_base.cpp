@@ -17,11 +17,20 @@
 namespace nerian_stereo {
 
 void StereoNodeBase::dynamicReconfigureCallback(nerian_stereo::NerianStereoConfig &config, uint32_t level) {
+    std::lock_guard<std::mutex> lock(configMutex);
     if (initialConfigReceived) {
         ROS_INFO("Received a new configuration via dynamic_reconfigure");
         // Unfortunately, we have to check for each potential change (no configuration deltas provided).
         // This is done in the autogenerated external code.
-        autogen_dynamicReconfigureCallback(config, level);
+        ParameterBatch batch;
+        autogen_dynamicReconfigureCallback(config, level, batch);
+        // The device is updated in the background, such that frame processing never blocks
+        if(!batch.empty()) {
+            if(!parameterWorker->isConnected()) {
+                ROS_WARN("No connection to the device parameter service; changes are applied once it is established");
+            }
+            parameterWorker->submit(batch);
+        }
     } else {
         initialConfigReceived = true;
     }
@@ -42,17 +51,42 @@ void StereoNodeBase::updateDynamicReconfigureFromDevice(param::ParameterSet& cfg
  * \brief Initialize and publish configuration with a dynamic_reconfigure server
  */
 void StereoNodeBase::initDynamicReconfigure() {
-    // Connect to parameter server on device
+    // Parameter changes are queued until the device connection is established
+    parameterWorker.reset(new ParameterWorker());
+
+    param::ParameterSet cachedParams;
+    if(parameterCacheFile != "" && ParameterCache::load(parameterCacheFile, cachedParams)) {
+        // Start with the last known parameters and perform the handshake in the background
+        ROS_INFO("Initializing parameters from cache %s", parameterCacheFile.c_str());
+        try {
+            publishDeviceParameters(cachedParams);
+            startParameterHandshake(cachedParams);
+            return;
+        } catch(const std::exception& ex) {
+            // The cache is stale or was written for a different firmware
+            ROS_WARN("Ignoring unusable parameter cache %s: %s", parameterCacheFile.c_str(), ex.what());
+            std::remove(parameterCacheFile.c_str());
+        }
+    }
+
+    param::ParameterSet ssParams = connectDeviceParameters();
+    publishDeviceParameters(ssParams);
+}
+
+param::ParameterSet StereoNodeBase::connectDeviceParameters() {
+    // Connect to parameter server on device. A previous connection stays
+    // attached to the worker until the new one is established.
     ROS_INFO("Connecting to %s for parameter service", remoteHost.c_str());
+    boost::scoped_ptr<DeviceParameters> newParameters;
     try {
-        deviceParameters.reset(new DeviceParameters(remoteHost.c_str()));
+        newParameters.reset(new DeviceParameters(remoteHost.c_str()));
     } catch(visiontransfer::ParameterException& e) {
         ROS_ERROR("ParameterException while connecting to parameter service: %s", e.what());
         throw;
     }
     param::ParameterSet ssParams;
     try {
-        ssParams = deviceParameters->getParameterSet();
+        ssParams = newParameters->getParameterSet();
     } catch(visiontransfer::TransferException& e) {
         ROS_ERROR("TransferException while obtaining parameter set: %s", e.what());
         throw;
@@ -60,16 +94,96 @@ void StereoNodeBase::initDynamicReconfigure() {
         ROS_ERROR("ParameterException while obtaining parameter set: %s", e.what());
         throw;
     }
+    parameterWorker->connect(newParameters.get());
+    deviceParameters.swap(newParameters);
+
+    if(parameterCacheFile != "" && !ParameterCache::save(parameterCacheFile, ssParams)) {
+        ROS_WARN("Unable to write parameter cache: %s", parameterCacheFile.c_str());
+    }
+    return ssParams;
+}
+
+void StereoNodeBase::publishDeviceParameters(param::ParameterSet& params) {
     // First make sure that the parameter server gets all *current* values
-    updateParameterServerFromDevice(ssParams);
+    updateParameterServerFromDevice(params);
     // Initialize (and publish) initial configuration from compile-time generated header
     dynReconfServer.reset(new dynamic_reconfigure::Server<nerian_stereo::NerianStereoConfig>());
     // Obtain and publish the default, min, and max values from the device to dyn_reconf
-    updateDynamicReconfigureFromDevice(ssParams);
+    updateDynamicReconfigureFromDevice(params);
     // Callback for future changes requested from the ROS side
     dynReconfServer->setCallback(boost::bind(&StereoNodeBase::dynamicReconfigureCallback, this, _1, _2));
 }
 
+bool StereoNodeBase::refreshDeviceParameters(param::ParameterSet previousParams) {
+    try {
+        param::ParameterSet ssParams = connectDeviceParameters();
+        if(!ParameterCache::matches(previousParams, ssParams)) {
+            ROS_INFO("Device parameters have changed; updating");
+            updateParameterServerFromDevice(ssParams);
+            updateDynamicReconfigureFromDevice(ssParams);
+
+            // The server takes its own lock, which is held while it calls
+            // dynamicReconfigureCallback; configMutex must not be held here
+            nerian_stereo::NerianStereoConfig config;
+            {
+                std::lock_guard<std::mutex> lock(configMutex);
+                autogen_updateConfigFromDevice(ssParams, lastKnownConfig);
+                config = lastKnownConfig;
+            }
+            dynReconfServer->updateConfig(config);
+        }
+    } catch(...) {
+        ROS_WARN("Handshake with parameter server failed; retrying. Image transport is unaffected.");
+        return false;
+    }
+    return true;
+}
+
+void StereoNodeBase::startParameterHandshake(const param::ParameterSet& previousParams) {
+    handshakeParams = previousParams;
+    parameterRetryPending = false;
+    parameterHandshake = std::async(std::launch::async,
+        &StereoNodeBase::refreshDeviceParameters, this, previousParams);
+}
+
+void StereoNodeBase::pollParameterHandshake() {
+    ros::WallTime now = ros::WallTime::now();
+    if(parameterHandshake.valid() && parameterHandshake.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+        if(parameterHandshake.get()) {
+            parameterRetryDelay = 0.1;
+        } else {
+            // Same backoff as for the image stream
+            parameterRetryPending = true;
+            nextParameterAttempt = now + ros::WallDuration(parameterRetryDelay);
+            parameterRetryDelay = std::min(2.0*parameterRetryDelay, reconnectMaxDelay);
+        }
+    }
+
+    if(parameterRetryPending && !linkLost && now >= nextParameterAttempt) {
+        startParameterHandshake(handshakeParams);
+    }
+}
+
+void StereoNodeBase::startup() {
+    init();
+
+    // Connect the image stream first, such that the device can already
+    // start transmitting while the other handshakes are in progress
+    prepareAsyncTransfer();
+
+    // The data channel and parameter handshakes are independent of each other
+    std::future<void> dataChannelInit = std::async(std::launch::async,
+        &StereoNodeBase::initDataChannelService, this);
+    try {
+        initDynamicReconfigure();
+    } catch(...) {
+        ROS_ERROR("Handshake with parameter server failed; no dynamic parameters - please verify firmware version. Image transport is unaffected.");
+    }
+    dataChannelInit.get();
+
+    publishTransform(); // initial transform
+}
+
 /**
  * \brief Performs general initializations
  */
@@ -135,6 +249,290 @@ void StereoNodeBase::init() {
         calibFile = "";
     }
 
+    if (!privateNh.getParam("calibration_cache_file", calibCacheFile)) {
+        calibCacheFile = "";
+    }
+
+    if (!privateNh.getParam("parameter_cache_file", parameterCacheFile)) {
+        parameterCacheFile = "";
+    }
+
+    if (!privateNh.getParam("reconnect_timeout", reconnectTimeout)) {
+        reconnectTimeout = 0.0;
+    }
+
+    if (!privateNh.getParam("reconnect_max_delay", reconnectMaxDelay)) {
+        reconnectMaxDelay = 5.0;
+    }
+
+    if (!privateNh.getParam("receive_batch_size", receiveOptions.batchSize)) {
+        receiveOptions.batchSize = 32;
+    }
+
+    if (!privateNh.getParam("receive_buffer_size", receiveOptions.socketBufferSize)) {
+        receiveOptions.socketBufferSize = 16*1048576;
+    }
+
+    if (!privateNh.getParam("receive_busy_poll", receiveOptions.busyPollMicrosec)) {
+        receiveOptions.busyPollMicrosec = 0;
+    }
+
+    if (!privateNh.getParam("receive_thread_cpu", receiveOptions.receiveThreadCpu)) {
+        receiveOptions.receiveThreadCpu = -1;
+    }
+
+    if (!privateNh.getParam("shm_name", shmName)) {
+        shmName = "";
+    }
+
+    if (!privateNh.getParam("shm_slots", shmSlots)) {
+        shmSlots = 4;
+    }
+
+    if (!privateNh.getParam("shm_point_cloud", shmPointCloud)) {
+        shmPointCloud = true;
+    }
+
+    if (!privateNh.getParam("normal_radius", normalRadius)) {
+        normalRadius = 2;
+    }
+
+    if (!privateNh.getParam("normal_max_depth_change", normalMaxDepthChange)) {
+        normalMaxDepthChange = 0.05;
+    }
+
+    if (!privateNh.getParam("grid_resolution", gridResolution)) {
+        gridResolution = 0.05;
+    }
+
+    if (!privateNh.getParam("grid_length", gridLength)) {
+        gridLength = 10.0;
+    }
+
+    if (!privateNh.getParam("grid_width", gridWidth)) {
+        gridWidth = 10.0;
+    }
+
+    if (!privateNh.getParam("grid_camera_height", gridCameraHeight)) {
+        gridCameraHeight = 0.0;
+    }
+
+    if (!privateNh.getParam("grid_min_height", gridMinHeight)) {
+        gridMinHeight = -0.5;
+    }
+
+    if (!privateNh.getParam("grid_max_height", gridMaxHeight)) {
+        gridMaxHeight = 2.0;
+    }
+
+    if (!privateNh.getParam("grid_obstacle_height", gridObstacleHeight)) {
+        gridObstacleHeight = 0.2;
+    }
+
+    if (!privateNh.getParam("grid_min_points", gridMinPoints)) {
+        gridMinPoints = 3;
+    }
+
+    if (!privateNh.getParam("gravity_frame", gravityFrame)) {
+        gravityFrame = "nerian_stereo_gravity";
+    }
+
+    if (!privateNh.getParam("scan_bands", scanBands)) {
+        scanBands = "scan:0.45:0.55";
+    }
+
+    if (!privateNh.getParam("scan_frame", scanFrame)) {
+        scanFrame = "nerian_stereo_scan";
+    }
+
+    if (!privateNh.getParam("scan_min_height", scanMinHeight)) {
+        scanMinHeight = -100.0;
+    }
+
+    if (!privateNh.getParam("scan_max_height", scanMaxHeight)) {
+        scanMaxHeight = 100.0;
+    }
+
+    if (!privateNh.getParam("scan_range_max", scanRangeMax)) {
+        scanRangeMax = 20.0;
+    }
+
+    if (!privateNh.getParam("disparity_speckle_size", disparitySpeckleSize)) {
+        disparitySpeckleSize = 0;
+    }
+
+    if (!privateNh.getParam("disparity_speckle_range", disparitySpeckleRange)) {
+        disparitySpeckleRange = 1.0;
+    }
+
+    if (!privateNh.getParam("disparity_hole_size", disparityHoleSize)) {
+        disparityHoleSize = 0;
+    }
+
+    if (!privateNh.getParam("disparity_hole_range", disparityHoleRange)) {
+        disparityHoleRange = 1.0;
+    }
+
+    if (!privateNh.getParam("disparity_temporal_median", disparityTemporalMedian)) {
+        disparityTemporalMedian = false;
+    }
+
+    if (!privateNh.getParam("change_gating", changeGating)) {
+        changeGating = false;
+    }
+
+    if (!privateNh.getParam("change_image_threshold", changeImageThreshold)) {
+        changeImageThreshold = 3.0;
+    }
+
+    if (!privateNh.getParam("change_disparity_threshold", changeDisparityThreshold)) {
+        changeDisparityThreshold = 0.5;
+    }
+
+    if (!privateNh.getParam("change_heartbeat_rate", changeHeartbeatRate)) {
+        changeHeartbeatRate = 1.0;
+    }
+
+    if (!privateNh.getParam("relay_port", relayPort)) {
+        relayPort = 0;
+    }
+
+    if (!privateNh.getParam("relay_port_count", relayPortCount)) {
+        relayPortCount = 1;
+    }
+
+    if (!privateNh.getParam("relay_address", relayAddress)) {
+        relayAddress = "0.0.0.0";
+    }
+
+    if (!privateNh.getParam("relay_use_tcp", relayUseTcp)) {
+        relayUseTcp = false;
+    }
+
+    if (!privateNh.getParam("host_matching", hostMatching)) {
+        hostMatching = "off";
+    }
+
+    if (!privateNh.getParam("host_matching_disparities", hostMatchingDisparities)) {
+        hostMatchingDisparities = 128;
+    }
+
+    if (!privateNh.getParam("host_matching_block_size", hostMatchingBlockSize)) {
+        hostMatchingBlockSize = 5;
+    }
+
+    if (!privateNh.getParam("host_matching_uniqueness", hostMatchingUniqueness)) {
+        hostMatchingUniqueness = 10;
+    }
+
+    if (!privateNh.getParam("low_latency_cloud", lowLatencyCloud)) {
+        lowLatencyCloud = false;
+    }
+
+    if (!privateNh.getParam("image_pyramid_levels", imagePyramidLevels)) {
+        imagePyramidLevels = 0;
+    }
+
+    if (!privateNh.getParam("image_pyramid_mono8", imagePyramidMono8)) {
+        imagePyramidMono8 = false;
+    }
+
+    if (!privateNh.getParam("tone_mapping", toneMapping)) {
+        toneMapping = "off";
+    }
+
+    if (!privateNh.getParam("tone_mapping_gamma", toneMappingGamma)) {
+        toneMappingGamma = 2.2;
+    }
+
+    if (!privateNh.getParam("receive_thread_policy", receiveThreadPolicy)) {
+        receiveThreadPolicy = "";
+    }
+
+    if (!privateNh.getParam("receive_thread_priority", receiveThreadPriority)) {
+        receiveThreadPriority = 0;
+    }
+
+    if (!privateNh.getParam("processing_thread_policy", processingThreadPolicy)) {
+        processingThreadPolicy = "";
+    }
+
+    if (!privateNh.getParam("processing_thread_priority", processingThreadPriority)) {
+        processingThreadPriority = 0;
+    }
+
+    if (!privateNh.getParam("processing_thread_cpus", processingThreadCpus)) {
+        processingThreadCpus = "";
+    }
+
+    if (!privateNh.getParam("lock_memory", lockMemory)) {
+        lockMemory = false;
+    }
+
+    if (!privateNh.getParam("huge_pages", hugePages)) {
+        hugePages = false;
+    }
+
+    if (!privateNh.getParam("fused_map_rate", fusedMapRate)) {
+        fusedMapRate = 0.0;
+    }
+
+    if (!privateNh.getParam("fused_map_resolution", fusedMapResolution)) {
+        fusedMapResolution = 0.05;
+    }
+
+    if (!privateNh.getParam("fused_map_radius", fusedMapRadius)) {
+        fusedMapRadius = 10.0;
+    }
+
+    if (!privateNh.getParam("fused_map_max_voxels", fusedMapMaxVoxels)) {
+        fusedMapMaxVoxels = 500000;
+    }
+
+    if (!privateNh.getParam("fused_map_min_observations", fusedMapMinObservations)) {
+        fusedMapMinObservations = 3;
+    }
+
+    if (!privateNh.getParam("fused_map_max_age", fusedMapMaxAge)) {
+        fusedMapMaxAge = 2.0;
+    }
+
+    if (!privateNh.getParam("fused_map_step", fusedMapStep)) {
+        fusedMapStep = 2;
+    }
+
+    if (!privateNh.getParam("fused_map_frame", fusedMapFrame)) {
+        fusedMapFrame = "";
+    }
+
+    if (!privateNh.getParam("obstacle_clusters", obstacleClusters)) {
+        obstacleClusters = false;
+    }
+
+    if (!privateNh.getParam("obstacle_ground_band", obstacleGroundBand)) {
+        obstacleGroundBand = 0.1;
+    }
+
+    if (!privateNh.getParam("obstacle_max_height", obstacleMaxHeight)) {
+        obstacleMaxHeight = 2.0;
+    }
+
+    if (!privateNh.getParam("obstacle_max_range", obstacleMaxRange)) {
+        obstacleMaxRange = 10.0;
+    }
+
+    if (!privateNh.getParam("obstacle_disparity_tolerance", obstacleDisparityTolerance)) {
+        obstacleDisparityTolerance = 1.0;
+    }
+
+    if (!privateNh.getParam("obstacle_min_pixels", obstacleMinPixels)) {
+        obstacleMinPixels = 50;
+    }
+
+    if (!privateNh.getParam("obstacle_step", obstacleStep)) {
+        obstacleStep = 2;
+    }
+
     if (!privateNh.getParam("delay_execution", execDelay)) {
         execDelay = 0;
     }
@@ -147,6 +545,63 @@ void StereoNodeBase::init() {
         useQFromCalibFile = false;
     }
 
+    if (!privateNh.getParam("clock_sync", clockSyncEnabled)) {
+        clockSyncEnabled = false;
+    }
+
+    if (!privateNh.getParam("clock_sync_window", clockSyncWindow)) {
+        clockSyncWindow = 30.0;
+    }
+
+    if (!privateNh.getParam("clock_sync_latency", clockSyncLatency)) {
+        clockSyncLatency = 0.0;
+    }
+
+    if(disparitySpeckleSize > 0 || disparityHoleSize > 0 || disparityTemporalMedian) {
+        disparityFilter.reset(new DisparityFilter(disparitySpeckleSize, disparitySpeckleRange,
+            disparityHoleSize, disparityHoleRange, disparityTemporalMedian));
+    }
+
+    if(changeGating) {
+        changeDetector.reset(new ChangeDetector(changeImageThreshold, changeDisparityThreshold));
+    }
+
+    if(lowLatencyCloud) {
+        if(disparityFilter != nullptr) {
+            // Filters require the complete disparity map
+            ROS_WARN("Low-latency point cloud is not available with disparity filters");
+        } else {
+            cloudStreamer.reset(new PointCloudStreamer(maxDepth, rosCoordinateSystem ? 0 : 2));
+        }
+    }
+
+    if(hostMatching == "bm" || hostMatching == "sgbm") {
+        hostMatcher.reset(new HostMatcher(hostMatching == "bm" ? HostMatcher::BLOCK_MATCHING
+            : HostMatcher::SEMI_GLOBAL_MATCHING, hostMatchingDisparities, hostMatchingBlockSize,
+            hostMatchingUniqueness));
+    } else if(hostMatching != "off") {
+        ROS_WARN("Unknown host matching algorithm '%s'; host matching is disabled", hostMatching.c_str());
+    }
+
+    if(toneMapping == "linear" || toneMapping == "gamma" || toneMapping == "auto") {
+        toneMapper.reset(new ToneMapper(toneMapping == "linear" ? ToneMapper::LINEAR
+            : (toneMapping == "gamma" ? ToneMapper::GAMMA : ToneMapper::AUTO_RANGE), toneMappingGamma));
+    } else if(toneMapping != "off") {
+        ROS_WARN("Unknown tone mapping '%s'; tone mapping is disabled", toneMapping.c_str());
+    }
+
+    initRealtime();
+
+    if(relayPort > 0) {
+        try {
+            relayServer.reset(new RelayServer(relayAddress, relayPort, std::max(relayPortCount, 1), relayUseTcp));
+            ROS_INFO("Relaying image data via %s on %s:%d-%d", relayUseTcp ? "TCP" : "UDP",
+                relayAddress.c_str(), relayPort, relayPort + std::max(relayPortCount, 1) - 1);
+        } catch(const std::exception& ex) {
+            ROS_ERROR("Unable to start relay server: %s", ex.what());
+        }
+    }
+
     // Apply an initial delay if configured
     ros::Duration(execDelay).sleep();
 
@@ -161,11 +616,57 @@ void StereoNodeBase::init() {
         "/nerian_stereo/color_image", 5)));
 
     loadCameraCalibration();
+    initCameraInfo();
 
     cameraInfoPublisher.reset(new ros::Publisher(getNH().advertise<nerian_stereo::StereoCameraInfo>(
         "/nerian_stereo/stereo_camera_info", 1)));
+    leftCameraInfoPublisher.reset(new ros::Publisher(getNH().advertise<sensor_msgs::CameraInfo>(
+        "/nerian_stereo/left_camera_info", 5)));
+    rightCameraInfoPublisher.reset(new ros::Publisher(getNH().advertise<sensor_msgs::CameraInfo>(
+        "/nerian_stereo/right_camera_info", 5)));
     cloudPublisher.reset(new ros::Publisher(getNH().advertise<sensor_msgs::PointCloud2>(
         "/nerian_stereo/point_cloud", 5)));
+    normalsPublisher.reset(new ros::Publisher(getNH().advertise<sensor_msgs::PointCloud2>(
+        "/nerian_stereo/point_cloud_normals", 5)));
+    occupancyGridPublisher.reset(new ros::Publisher(getNH().advertise<nav_msgs::OccupancyGrid>(
+        "/nerian_stereo/occupancy_grid", 5)));
+    elevationGridPublisher.reset(new ros::Publisher(getNH().advertise<nerian_stereo::ElevationGrid>(
+        "/nerian_stereo/elevation_grid", 5)));
+    disparityImagePublisher.reset(new ros::Publisher(getNH().advertise<stereo_msgs::DisparityImage>(
+        "/nerian_stereo/disparity_image", 5)));
+    initLaserScans();
+    initImagePyramid();
+
+    if(fusedMapRate > 0) {
+        voxelMap.reset(new VoxelMap(fusedMapResolution, fusedMapRadius, fusedMapMaxVoxels,
+            fusedMapMinObservations, fusedMapMaxAge));
+        fusedMapPublisher.reset(new ros::Publisher(getNH().advertise<sensor_msgs::PointCloud2>(
+            "/nerian_stereo/fused_map", 1)));
+        if(fusedMapFrame != "") {
+            tfBuffer.reset(new tf2_ros::Buffer);
+            tfListener.reset(new tf2_ros::TransformListener(*tfBuffer));
+        }
+    }
+
+    if(obstacleClusters) {
+        // The ground plane is the same as for the elevation grid
+        obstacleClusterer.reset(new ObstacleClusterer(gridCameraHeight, obstacleGroundBand,
+            obstacleMaxHeight, obstacleMaxRange, obstacleDisparityTolerance, obstacleMinPixels, obstacleStep));
+        obstacleBoxesPublisher.reset(new ros::Publisher(getNH().advertise<nerian_stereo::ObstacleBoxArray>(
+            "/nerian_stereo/obstacle_boxes", 5)));
+    }
+
+    if(clockSyncEnabled) {
+        clockSync.reset(new ClockSync(clockSyncWindow));
+        clockSyncPublisher.reset(new ros::Publisher(getNH().advertise<nerian_stereo::ClockSyncStatus>(
+            "/nerian_stereo/clock_sync", 5)));
+    }
+
+    if(shmName != "") {
+        shmWriter.reset(new ShmRingWriter(shmName, shmSlots));
+        shmFramePublisher.reset(new ros::Publisher(getNH().advertise<nerian_stereo::SharedMemoryFrame>(
+            "/nerian_stereo/shm_frames", 5)));
+    }
 
     transformBroadcaster.reset(new tf2_ros::TransformBroadcaster());
     if(publishInternalFrame){
@@ -190,21 +691,308 @@ void StereoNodeBase::prepareAsyncTransfer() {
     ROS_INFO("Connecting to %s:%s for data transfer", remoteHost.c_str(), remotePort.c_str());
     asyncTransfer.reset(new AsyncTransfer(remoteHost.c_str(), remotePort.c_str(),
         useTcp ? ImageProtocol::PROTOCOL_TCP : ImageProtocol::PROTOCOL_UDP));
+    asyncTransfer->setReceiveOptions(receiveOptions);
+    initPartialReception();
+    lastReceptionStats = ImageTransfer::ReceptionStatistics();
+
+    linkLost = false;
+    awaitingReconnectFrame = false;
+    reconnectDelay = 0.1;
+    lastImageSetTime = ros::WallTime::now();
+    haveSequenceNumber = false;
+    skippedFrames = 0;
+    lostSegments = 0;
+    resendRequests = 0;
+}
+
+void StereoNodeBase::initPartialReception() {
+    if(cloudStreamer != nullptr) {
+        asyncTransfer->setPartialReceiveCallback(&StereoNodeBase::partialReceiveCallback,
+            cloudStreamer.get());
+    }
+}
+
+void StereoNodeBase::partialReceiveCallback(const ImageSet& imageSet, int validRows, bool complete,
+        void* userData) {
+    static_cast<PointCloudStreamer*>(userData)->processRows(imageSet, validRows, complete);
+}
+
+bool StereoNodeBase::receiveImageSet(ImageSet& imageSet) {
+    if(linkLost && !pollReconnect()) {
+        return false;
+    }
+
+    bool received = false;
+    try {
+        received = asyncTransfer->collectReceivedImageSet(imageSet, 0.005);
+    } catch(const std::exception& ex) {
+        ROS_WARN("Image stream interrupted: %s", ex.what());
+        handleLinkLoss();
+        return false;
+    }
+
+    ros::WallTime now = ros::WallTime::now();
+    if(!received) {
+        if(useTcp && !asyncTransfer->isConnected()) {
+            ROS_WARN("Connection to %s:%s lost", remoteHost.c_str(), remotePort.c_str());
+            handleLinkLoss();
+        } else if(reconnectTimeout > 0 && (now - lastImageSetTime).toSec() > reconnectTimeout) {
+            if(awaitingReconnectFrame) {
+                ROS_DEBUG("Still no image data after reconnecting");
+            } else {
+                ROS_WARN("No image data received for %.1f s", (now - lastImageSetTime).toSec());
+            }
+            handleLinkLoss();
+        }
+        return false;
+    }
+
+    // Packet loss and resends that occurred since the previous frame
+    ImageTransfer::ReceptionStatistics stats = asyncTransfer->getReceptionStatistics();
+    if(!haveSequenceNumber) {
+        reportReceiveTuning(stats);
+    }
+    int frameLostSegments = stats.lostSegments - lastReceptionStats.lostSegments;
+    int frameResendRequests = stats.resendRequests - lastReceptionStats.resendRequests;
+    if(frameLostSegments > 0 || frameResendRequests > 0) {
+        ROS_DEBUG("Frame %u: %d segment(s) lost, %d resend request(s)", imageSet.getSequenceNumber(),
+            frameLostSegments, frameResendRequests);
+    }
+    lostSegments += frameLostSegments;
+    resendRequests += frameResendRequests;
+    lastReceptionStats = stats;
+
+    // Sequence numbers start again from zero after a device restart
+    unsigned int seq = imageSet.getSequenceNumber();
+    if(haveSequenceNumber && seq < lastSequenceNumber) {
+        ROS_WARN("Image sequence number restarted; the device was probably rebooted");
+        reconnectServices();
+    } else if(haveSequenceNumber && seq > lastSequenceNumber + 1) {
+        skippedFrames += seq - lastSequenceNumber - 1;
+    }
+    haveSequenceNumber = true;
+    lastSequenceNumber = seq;
+    lastImageSetTime = now;
+    reconnectDelay = 0.1;
+
+    if(awaitingReconnectFrame) {
+        awaitingReconnectFrame = false;
+        reconnectServices();
+    }
+    return true;
+}
+
+void StereoNodeBase::initRealtime() {
+    if(lockMemory) {
+        if(isNodelet()) {
+            ROS_WARN("lock_memory locks the memory of the entire nodelet manager process, "
+                "including all other nodelets");
+        }
+        std::string error;
+        if(lockProcessMemory(error)) {
+            ROS_INFO("Locked all process memory");
+        } else {
+            ROS_WARN("Unable to lock process memory: %s; raise RLIMIT_MEMLOCK or grant CAP_IPC_LOCK",
+                error.c_str());
+        }
+    }
+
+    if(hugePages) {
+        hugePageAdvisor.reset(new HugePageAdvisor);
+        reportedHugePageFailures = 0;
+    }
+
+    // The receive thread is configured by libvisiontransfer
+    ThreadScheduling receiveScheduling(receiveThreadPolicy, receiveThreadPriority, "");
+    if(!receiveScheduling.getConfigError().empty()) {
+        ROS_WARN("Invalid receive thread scheduling: %s", receiveScheduling.getConfigError().c_str());
+    }
+    receiveOptions.receiveThreadPolicy = receiveScheduling.getPolicy();
+    receiveOptions.receiveThreadPriority = receiveScheduling.getPriority();
+
+    if(processingThreadPolicy != "" || processingThreadCpus != "") {
+        processingScheduling.reset(new ThreadScheduling(processingThreadPolicy, processingThreadPriority,
+            processingThreadCpus));
+        if(!processingScheduling->getConfigError().empty()) {
+            ROS_WARN("Invalid processing thread scheduling: %s", processingScheduling->getConfigError().c_str());
+        }
+    }
+}
+
+void StereoNodeBase::applyProcessingScheduling() {
+    if(processingScheduling == nullptr || processingSchedulingApplied) {
+        return;
+    }
+    processingSchedulingApplied = true;
+
+    std::string error;
+    if(!processingScheduling->applyToCurrentThread(error)) {
+        ROS_WARN("Unable to configure the processing thread: %s", error.c_str());
+    }
+    ROS_INFO("Processing thread: %s", ThreadScheduling::describeCurrentThread().c_str());
+}
+
+void StereoNodeBase::reportReceiveTuning(const ImageTransfer::ReceptionStatistics& stats) {
+    if(receiveOptions.receiveThreadPolicy >= 0) {
+        ROS_INFO("Receive thread: %s priority %d", ThreadScheduling::getPolicyName(stats.receiveThreadPolicy).c_str(),
+            stats.receiveThreadPriority);
+        if(stats.receiveThreadPolicy != receiveOptions.receiveThreadPolicy
+                || stats.receiveThreadPriority != receiveOptions.receiveThreadPriority) {
+            ROS_WARN("Unable to set %s priority %d for the receive thread; grant CAP_SYS_NICE or raise RLIMIT_RTPRIO",
+                ThreadScheduling::getPolicyName(receiveOptions.receiveThreadPolicy).c_str(),
+                receiveOptions.receiveThreadPriority);
+        }
+    }
+
+    if(useTcp) {
+        return;
+    }
+
+    ROS_INFO("UDP reception: batch size %d, socket buffer %d bytes, busy poll %d us, receive thread CPU %d",
+        receiveOptions.batchSize, stats.socketBufferSize, stats.busyPollMicrosec, stats.receiveThreadCpu);
+
+    // The OS silently caps these settings for unprivileged processes
+    if(stats.socketBufferSize < receiveOptions.socketBufferSize) {
+        ROS_WARN("Socket receive buffer is limited to %d bytes (requested %d); raise net.core.rmem_max "
+            "or grant CAP_NET_ADMIN to avoid packet loss", stats.socketBufferSize, receiveOptions.socketBufferSize);
+    }
+    if(stats.busyPollMicrosec < receiveOptions.busyPollMicrosec) {
+        ROS_WARN("Busy polling could not be enabled; raise net.core.busy_read or grant CAP_NET_ADMIN");
+    }
+    if(receiveOptions.receiveThreadCpu >= 0 && stats.receiveThreadCpu != receiveOptions.receiveThreadCpu) {
+        ROS_WARN("Unable to pin the receive thread to CPU %d", receiveOptions.receiveThreadCpu);
+    }
+}
+
+void StereoNodeBase::handleLinkLoss() {
+    // Publishers, reconstruction and message buffers are kept; only the
+    // connections to the device are re-established
+    linkLost = true;
+    if(disparityFilter != nullptr) {
+        disparityFilter->reset();
+    }
+    if(changeDetector != nullptr) {
+        changeDetector->reset();
+    }
+}
+
+bool StereoNodeBase::pollReconnect() {
+    ros::WallTime now = ros::WallTime::now();
+
+    if(reconnectAttempt.valid()) {
+        if(reconnectAttempt.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            return false; // Still in progress
+        }
+        try {
+            asyncTransfer.reset(reconnectAttempt.get().release());
+            initPartialReception();
+            lastReceptionStats = ImageTransfer::ReceptionStatistics();
+        } catch(const std::exception& ex) {
+            ROS_WARN("Reconnecting to %s:%s failed: %s", remoteHost.c_str(), remotePort.c_str(), ex.what());
+            return false;
+        }
+
+        ROS_INFO("Reconnected to %s:%s for data transfer", remoteHost.c_str(), remotePort.c_str());
+        linkLost = false;
+        lastImageSetTime = now;
+        haveSequenceNumber = false;
+        // With UDP, a transfer can also be created without a device; the
+        // other services are only restored once data arrives
+        awaitingReconnectFrame = true;
+        return true;
+    }
+
+    if(now >= nextReconnectAttempt) {
+        // Connecting can block for a long time if the device is unreachable,
+        // hence this is done in the background
+        std::string host = remoteHost, port = remotePort;
+        ImageProtocol::ProtocolType protocol = useTcp ? ImageProtocol::PROTOCOL_TCP : ImageProtocol::PROTOCOL_UDP;
+        ImageTransfer::ReceiveOptions options = receiveOptions;
+        reconnectAttempt = std::async(std::launch::async, [host, port, protocol, options]() {
+            std::unique_ptr<AsyncTransfer> transfer(new AsyncTransfer(host.c_str(), port.c_str(), protocol));
+            transfer->setReceiveOptions(options);
+            return transfer;
+        });
+
+        // Exponential backoff for further attempts
+        nextReconnectAttempt = now + ros::WallDuration(reconnectDelay);
+        reconnectDelay = std::min(2.0*reconnectDelay, reconnectMaxDelay);
+    }
+    return false;
+}
+
+void StereoNodeBase::reconnectServices() {
+    try {
+        initDataChannelService();
+    } catch(const std::exception& ex) {
+        ROS_WARN("Reconnecting the data channel service failed: %s", ex.what());
+    }
+
+    // Parameter connection is only restored if it was established before
+    if(dynReconfServer != nullptr && !(parameterHandshake.valid()
+            && parameterHandshake.wait_for(std::chrono::seconds(0)) != std::future_status::ready)) {
+        parameterRetryDelay = 0.1;
+        startParameterHandshake(param::ParameterSet());
+    }
 }
 
 void StereoNodeBase::processOneImageSet() {
+    pollParameterHandshake();
+
     // Receive image data
     ImageSet imageSet;
-    if(asyncTransfer->collectReceivedImageSet(imageSet, 0.005)) {
+    if(receiveImageSet(imageSet)) {
+        if(hugePageAdvisor != nullptr) {
+            for(int i = 0; i < imageSet.getNumberOfImages(); i++) {
+                hugePageAdvisor->advise(imageSet.getPixelData(i),
+                    static_cast<size_t>(imageSet.getRowStride(i)) * imageSet.getHeight());
+            }
+        }
 
         // Get time stamp
-        ros::Time stamp;
-        if(rosTimestamps) {
-            stamp = ros::Time::now();
-        } else {
-            int secs = 0, microsecs = 0;
-            imageSet.getTimestamp(secs, microsecs);
-            stamp = ros::Time(secs, microsecs*1000);
+        ros::Time stamp = getImageSetStamp(imageSet);
+
+        // Relay the data as received from the device
+        if(relayServer != nullptr) {
+            relayImageSet(imageSet);
+        }
+
+        // Compute the disparity map on the host if the device does not
+        // transmit one
+        if(hostMatcher != nullptr && !imageSet.hasImageType(ImageSet::IMAGE_DISPARITY)) {
+            hostMatcher->compute(imageSet);
+        }
+
+        // Filter the disparity map in place, before any output uses it
+        if(disparityFilter != nullptr && imageSet.hasImageType(ImageSet::IMAGE_DISPARITY)
+                && imageSet.getPixelFormat(ImageSet::IMAGE_DISPARITY) == ImageSet::FORMAT_12_BIT_MONO) {
+            disparityFilter->process(reinterpret_cast<unsigned short*>(imageSet.getPixelData(ImageSet::IMAGE_DISPARITY)),
+                imageSet.getWidth(), imageSet.getHeight(), imageSet.getRowStride(ImageSet::IMAGE_DISPARITY),
+                imageSet.getSubpixelFactor());
+        }
+
+        // Skip frames of a static scene, unless the heartbeat is due
+        if(changeDetector != nullptr && !changeDetector->hasChanged(imageSet)) {
+            double sinceLastPublish = (stamp - lastPublishStamp).toSec();
+            bool heartbeatDue = changeHeartbeatRate > 0 && (sinceLastPublish < 0
+                || sinceLastPublish >= 1.0 / changeHeartbeatRate);
+            if(!heartbeatDue) {
+                // Only the outputs are skipped, not the statistics
+                unchangedFrames++;
+                logStatistics(stamp);
+                return;
+            }
+        }
+        lastPublishStamp = stamp;
+
+        // Determine the tone mapping range once for both images
+        if(toneMapper != nullptr) {
+            int index = imageSet.hasImageType(ImageSet::IMAGE_LEFT) ? imageSet.getIndexOf(ImageSet::IMAGE_LEFT)
+                : imageSet.getIndexOf(ImageSet::IMAGE_RIGHT);
+            if(index >= 0 && imageSet.getPixelFormat(index) == ImageSet::FORMAT_12_BIT_MONO) {
+                toneMapper->updateRange(reinterpret_cast<const unsigned short*>(imageSet.getPixelData(index)),
+                    imageSet.getWidth(), imageSet.getHeight(), imageSet.getRowStride(index));
+            }
         }
 
         bool hasLeft = false, hasRight = false, hasColor = false, hasDisparity = false;
@@ -212,32 +1000,73 @@ void StereoNodeBase::processOneImageSet() {
         // Publish image data messages for all images included in the set
         if (imageSet.hasImageType(ImageSet::IMAGE_LEFT)) {
             publishImageMsg(imageSet, imageSet.getIndexOf(ImageSet::IMAGE_LEFT), stamp, false, leftImagePublisher.get());
+            publishPyramidMsgs(imageSet, imageSet.getIndexOf(ImageSet::IMAGE_LEFT), stamp, leftPyramidPublishers);
+            publishCameraInfoMsg(camInfoMsg->left_info, stamp, leftCameraInfoPublisher.get());
             hasLeft = true;
         }
         if (imageSet.hasImageType(ImageSet::IMAGE_DISPARITY)) {
             publishImageMsg(imageSet, imageSet.getIndexOf(ImageSet::IMAGE_DISPARITY), stamp, true, disparityPublisher.get());
+            if(disparityImagePublisher->getNumSubscribers() > 0) {
+                publishDisparityImageMsg(imageSet, stamp);
+            }
             hasDisparity = true;
         }
         if (imageSet.hasImageType(ImageSet::IMAGE_RIGHT)) {
             publishImageMsg(imageSet, imageSet.getIndexOf(ImageSet::IMAGE_RIGHT), stamp, false, rightImagePublisher.get());
+            publishPyramidMsgs(imageSet, imageSet.getIndexOf(ImageSet::IMAGE_RIGHT), stamp, rightPyramidPublishers);
+            publishCameraInfoMsg(camInfoMsg->right_info, stamp, rightCameraInfoPublisher.get());
             hasRight = true;
         }
         if (imageSet.hasImageType(ImageSet::IMAGE_COLOR)) {
             publishImageMsg(imageSet, imageSet.getIndexOf(ImageSet::IMAGE_COLOR), stamp, false, thirdImagePublisher.get());
+            publishPyramidMsgs(imageSet, imageSet.getIndexOf(ImageSet::IMAGE_COLOR), stamp, colorPyramidPublishers);
             hasColor = true;
         }
 
         // Dump info about currently available topics (this can change when output channels are toggled)
         if ((frameNum==0) || (hasLeft!=hadLeft) || (hasRight!=hadRight) || (hasColor!=hadColor) || (hasDisparity!=hadDisparity)) {
             ROS_INFO("Topics currently being served, based on the device \"Output Channels\" settings:");
-            if (hasLeft) ROS_INFO( "  /nerian_stereo/left_image");
-            if (hasRight) ROS_INFO("  /nerian_stereo/right_image");
-            if (hasColor) ROS_INFO("  /nerian_stereo/color_image");
+            if (hasLeft) {
+                ROS_INFO("  /nerian_stereo/left_image");
+                for(const ros::Publisher& publisher: leftPyramidPublishers) {
+                    ROS_INFO("  %s", publisher.getTopic().c_str());
+                }
+                ROS_INFO("  /nerian_stereo/left_camera_info");
+            }
+            if (hasRight) {
+                ROS_INFO("  /nerian_stereo/right_image");
+                for(const ros::Publisher& publisher: rightPyramidPublishers) {
+                    ROS_INFO("  %s", publisher.getTopic().c_str());
+                }
+                ROS_INFO("  /nerian_stereo/right_camera_info");
+            }
+            if (hasColor) {
+                ROS_INFO("  /nerian_stereo/color_image");
+                for(const ros::Publisher& publisher: colorPyramidPublishers) {
+                    ROS_INFO("  %s", publisher.getTopic().c_str());
+                }
+            }
             if (hasDisparity) {
                 ROS_INFO("  /nerian_stereo/disparity_map");
+                ROS_INFO("  /nerian_stereo/disparity_image");
                 ROS_INFO("  /nerian_stereo/point_cloud");
+                ROS_INFO("  /nerian_stereo/point_cloud_normals");
+                ROS_INFO("  /nerian_stereo/occupancy_grid");
+                ROS_INFO("  /nerian_stereo/elevation_grid");
+                if(fusedMapPublisher != nullptr) {
+                    ROS_INFO("  /nerian_stereo/fused_map");
+                }
+                if(obstacleBoxesPublisher != nullptr) {
+                    ROS_INFO("  /nerian_stereo/obstacle_boxes");
+                }
+                for(const LaserScanOutput& scan: laserScans) {
+                    ROS_INFO("  %s", scan.topic.c_str());
+                }
             } else {
                 ROS_WARN("Disparity channel deactivated on device -> no disparity or point cloud data!");
+                if(hostMatcher != nullptr) {
+                    ROS_WARN("Host matching requires the left and right image channels");
+                }
             }
             hadLeft = hasLeft;
             hadRight = hasRight;
@@ -245,43 +1074,164 @@ void StereoNodeBase::processOneImageSet() {
             hadDisparity = hasDisparity;
         }
 
-        if(cloudPublisher->getNumSubscribers() > 0) {
+        if(hasDisparity && !laserScans.empty()) {
+            // Must happen before the Q matrix of the image set is transformed
+            // for the point cloud
+            publishLaserScans(imageSet, stamp);
+        }
+
+        if(hasDisparity && obstacleBoxesPublisher != nullptr && obstacleBoxesPublisher->getNumSubscribers() > 0) {
+            // Also requires the untransformed Q matrix
+            publishObstacleBoxes(imageSet, stamp);
+        }
+
+        bool cloudUpdated = false;
+        bool normalsRequested = normalsPublisher->getNumSubscribers() > 0;
+        bool gridRequested = occupancyGridPublisher->getNumSubscribers() > 0
+            || elevationGridPublisher->getNumSubscribers() > 0;
+        bool fusedMapRequested = fusedMapPublisher != nullptr && fusedMapPublisher->getNumSubscribers() > 0;
+        bool cloudRequested = cloudPublisher->getNumSubscribers() > 0 || normalsRequested || gridRequested
+            || fusedMapRequested || (shmWriter != nullptr && shmPointCloud);
+        if(cloudStreamer != nullptr) {
+            cloudStreamer->setActive(cloudRequested);
+        }
+        if(cloudRequested) {
             if(recon3d == nullptr) {
                 // First initialize
                 initPointCloud();
             }
 
-            publishPointCloudMsg(imageSet, stamp);
+            cloudUpdated = publishPointCloudMsg(imageSet, stamp);
+        }
+
+        if(cloudUpdated && normalsRequested) {
+            publishNormalsMsg(stamp);
+        }
+
+        if(cloudUpdated && gridRequested) {
+            publishGridMsgs(stamp);
+        }
+
+        if(cloudUpdated && fusedMapRequested) {
+            updateFusedMap(stamp);
+        }
+
+        if(shmWriter != nullptr) {
+            writeSharedMemory(imageSet, stamp, cloudUpdated && shmPointCloud);
         }
 
         if(cameraInfoPublisher != NULL && cameraInfoPublisher->getNumSubscribers() > 0) {
             publishCameraInfo(stamp, imageSet);
         }
 
+        // Buffers are advised while processing, so failures are only known
+        // after the first frame, or once further outputs are requested
+        if(hugePageAdvisor != nullptr && hugePageAdvisor->getNumFailures() > reportedHugePageFailures) {
+            reportedHugePageFailures = hugePageAdvisor->getNumFailures();
+            ROS_WARN("Transparent huge pages could not be requested for %d buffer(s); they need "
+                "kernel support and a build with MADV_HUGEPAGE", reportedHugePageFailures);
+        }
+
         // Display some simple statistics
         frameNum++;
-        if(stamp.sec != lastLogTime.sec) {
-            if(lastLogTime != ros::Time()) {
-                double dt = (stamp - lastLogTime).toSec();
-                double fps = (frameNum - lastLogFrames) / dt;
-                ROS_INFO("%.1f fps", fps);
-            }
-            lastLogFrames = frameNum;
-            lastLogTime = stamp;
+        logStatistics(stamp);
+    }
+}
+
+void StereoNodeBase::logStatistics(ros::Time stamp) {
+    if(stamp.sec == lastLogTime.sec) {
+        return;
+    }
+
+    if(lastLogTime != ros::Time()) {
+        double dt = (stamp - lastLogTime).toSec();
+        double fps = (frameNum - lastLogFrames) / dt;
+        if(skippedFrames > 0) {
+            ROS_INFO("%.1f fps (%d frames skipped)", fps, skippedFrames);
+            skippedFrames = 0;
+        } else {
+            ROS_INFO("%.1f fps", fps);
+        }
+        if(unchangedFrames > 0) {
+            ROS_INFO("%d unchanged frame(s) not published", unchangedFrames);
+            unchangedFrames = 0;
+        }
+        if(relayServer != nullptr && relayServer->getNumDroppedFrames() > relayDroppedFrames) {
+            ROS_INFO("%d frame(s) dropped for slow relay clients",
+                relayServer->getNumDroppedFrames() - relayDroppedFrames);
+            relayDroppedFrames = relayServer->getNumDroppedFrames();
         }
+        if(lostSegments > 0 || resendRequests > 0) {
+            ROS_WARN("%d packet segment(s) lost, %d resend request(s)", lostSegments, resendRequests);
+            lostSegments = 0;
+            resendRequests = 0;
+        }
+    }
+    if(clockSync != nullptr) {
+        publishClockSyncStatus(stamp);
     }
+    lastLogFrames = frameNum;
+    lastLogTime = stamp;
+}
+
+ros::Time StereoNodeBase::getImageSetStamp(const ImageSet& imageSet) {
+    int secs = 0, microsecs = 0;
+    imageSet.getTimestamp(secs, microsecs);
+
+    if(clockSync != nullptr) {
+        // Feed the receive time into the estimator and stamp with the
+        // corrected device capture time
+        ros::Time now = ros::Time::now();
+        clockSync->addSample(secs + microsecs*1e-6, now.toSec());
+        return deviceToHostTime(secs, microsecs, now);
+    } else if(rosTimestamps) {
+        return ros::Time::now();
+    } else {
+        return ros::Time(secs, microsecs*1000);
+    }
+}
+
+ros::Time StereoNodeBase::deviceToHostTime(int secs, int microsecs, ros::Time fallback) {
+    if(clockSync == nullptr || !clockSync->isValid()) {
+        return fallback;
+    }
+    double hostTime = clockSync->toHostTime(secs + microsecs*1e-6) - clockSyncLatency;
+    return ros::Time().fromSec(hostTime);
+}
+
+void StereoNodeBase::publishClockSyncStatus(ros::Time stamp) {
+    nerian_stereo::ClockSyncStatusPtr msg(new nerian_stereo::ClockSyncStatus);
+    msg->header.stamp = stamp;
+    if(publishInternalFrame) msg->header.frame_id = internalFrame;
+    else msg->header.frame_id = frame;
+    msg->offset = clockSync->getOffset();
+    msg->drift_ppm = clockSync->getDriftPpm();
+    msg->mean_delay = clockSync->getMeanDelay();
+    msg->jitter = clockSync->getJitter();
+    msg->num_samples = clockSync->getNumSamples();
+    msg->num_resets = clockSync->getNumResets();
+    clockSyncPublisher->publish(msg);
 }
 
 void StereoNodeBase::loadCameraCalibration() {
-    if(calibFile == "" ) {
+    if(calibFile == "" && calibCacheFile == "") {
         ROS_WARN("No camera calibration file configured. Cannot publish detailed camera information!");
     } else {
         bool success = false;
-        try {
-            if (calibStorage.open(calibFile, cv::FileStorage::READ)) {
-                success = true;
+        if(calibCacheFile != "" && calibration.loadSnapshot(calibCacheFile, calibFile)) {
+            // Snapshot is up to date; no need to parse the calibration file
+            ROS_INFO("Using cached camera calibration from %s", calibCacheFile.c_str());
+            success = true;
+        } else if(calibFile != "") {
+            try {
+                success = calibration.loadFile(calibFile);
+            } catch(const std::exception& ex) {
+                ROS_WARN("%s", ex.what());
+            }
+
+            if(success && calibCacheFile != "" && !calibration.saveSnapshot(calibCacheFile, calibFile)) {
+                ROS_WARN("Unable to write calibration snapshot: %s", calibCacheFile.c_str());
             }
-        } catch(...) {
         }
 
         if(!success) {
@@ -289,6 +1239,15 @@ void StereoNodeBase::loadCameraCalibration() {
                 "Cannot publish detailed camera information!", calibFile.c_str());
         }
     }
+
+    if(calibration.isValid()) {
+        for(int i=0; i<16; i++) {
+            calibQ[i] = static_cast<float>(calibration.getData().Q[i]);
+        }
+    } else if(useQFromCalibFile) {
+        ROS_WARN("No valid calibration available; using Q matrix from the device instead");
+        useQFromCalibFile = false;
+    }
 }
 
 void StereoNodeBase::publishImageMsg(const ImageSet& imageSet, int imageIndex, ros::Time stamp, bool allowColorCode,
@@ -305,6 +1264,11 @@ void StereoNodeBase::publishImageMsg(const ImageSet& imageSet, int imageIndex, r
     cvImg.header.seq = imageSet.getSequenceNumber(); // Actually ROS will overwrite this
 
     bool format12Bit = (imageSet.getPixelFormat(imageIndex) == ImageSet::FORMAT_12_BIT_MONO);
+    if(format12Bit && !allowColorCode && toneMapper != nullptr) {
+        publishToneMappedMsg(imageSet, imageIndex, stamp, publisher);
+        return;
+    }
+
     string encoding = "";
     bool ok = true;
 
@@ -366,47 +1330,234 @@ void StereoNodeBase::publishImageMsg(const ImageSet& imageSet, int imageIndex, r
     }
 }
 
-void StereoNodeBase::qMatrixToRosCoords(const float* src, float* dst) {
-    dst[0] = src[8];   dst[1] = src[9];
-    dst[2] = src[10];  dst[3] = src[11];
+void StereoNodeBase::publishToneMappedMsg(const ImageSet& imageSet, int imageIndex, ros::Time stamp,
+        ros::Publisher* publisher) {
+    // Reuse a message that is no longer referenced by any subscriber
+    sensor_msgs::ImagePtr msg = takeFromPool(toneMappedPool);
+
+    if(publishInternalFrame) msg->header.frame_id = internalFrame;
+    else msg->header.frame_id = frame;
+    msg->header.stamp = stamp;
+    msg->header.seq = imageSet.getSequenceNumber(); // Actually ROS will overwrite this
+
+    msg->width = imageSet.getWidth();
+    msg->height = imageSet.getHeight();
+    msg->encoding = "mono8";
+    msg->is_bigendian = false;
+    msg->step = msg->width;
+    msg->data.resize(msg->step * msg->height);
+    toneMapper->map(reinterpret_cast<const unsigned short*>(imageSet.getPixelData(imageIndex)),
+        msg->width, msg->height, imageSet.getRowStride(imageIndex), &msg->data[0], msg->step);
+
+    publisher->publish(msg);
+}
+
+void StereoNodeBase::publishDisparityImageMsg(const ImageSet& imageSet, ros::Time stamp) {
+    int index = imageSet.getIndexOf(ImageSet::IMAGE_DISPARITY);
+    if(imageSet.getPixelFormat(index) != ImageSet::FORMAT_12_BIT_MONO) {
+        return;
+    }
+
+    // Reuse a message that is no longer referenced by any subscriber
+    stereo_msgs::DisparityImagePtr msg = takeFromPool(disparityImagePool);
+
+    if(publishInternalFrame) msg->header.frame_id = internalFrame;
+    else msg->header.frame_id = frame;
+    msg->header.stamp = stamp;
+    msg->header.seq = imageSet.getSequenceNumber(); // Actually ROS will overwrite this
+
+    int width = imageSet.getWidth();
+    int height = imageSet.getHeight();
+    msg->image.header = msg->header;
+    msg->image.width = width;
+    msg->image.height = height;
+    msg->image.encoding = "32FC1";
+    msg->image.is_bigendian = false;
+    msg->image.step = width * sizeof(float);
+    msg->image.data.resize(msg->image.step * height);
+    disparityConverter.convert(reinterpret_cast<const unsigned short*>(imageSet.getPixelData(index)),
+        width, height, imageSet.getRowStride(index), imageSet.getSubpixelFactor(),
+        reinterpret_cast<float*>(&msg->image.data[0]));
+
+    // Focal length and baseline from the untransformed Q matrix
+    const float* q = useQFromCalibFile ? calibQ : imageSet.getQMatrix();
+    msg->f = q[11];
+    msg->T = q[14] != 0 ? 1.0f / std::fabs(q[14]) : 0.0f;
+
+    int validX = 0, validY = 0, validWidth = 0, validHeight = 0;
+    disparityConverter.getValidWindow(validX, validY, validWidth, validHeight);
+    msg->valid_window.x_offset = validX;
+    msg->valid_window.y_offset = validY;
+    msg->valid_window.width = validWidth;
+    msg->valid_window.height = validHeight;
+    msg->valid_window.do_rectify = false;
+
+    int minDisparity = 0, maxDisparity = 0;
+    imageSet.getDisparityRange(minDisparity, maxDisparity);
+    msg->min_disparity = minDisparity;
+    msg->max_disparity = maxDisparity;
+    msg->delta_d = 1.0f / imageSet.getSubpixelFactor();
+
+    disparityImagePublisher->publish(msg);
+}
 
-    dst[4] = -src[0];  dst[5] = -src[1];
-    dst[6] = -src[2];  dst[7] = -src[3];
+void StereoNodeBase::initImagePyramid() {
+    // Levels beyond 1/16 are of little use at the available resolutions
+    int levels = std::min(imagePyramidLevels, 4);
+    for(int level = 1; level <= levels; level++) {
+        std::stringstream suffix;
+        suffix << "_level" << level;
+        leftPyramidPublishers.push_back(getNH().advertise<sensor_msgs::Image>(
+            "/nerian_stereo/left_image" + suffix.str(), 5));
+        rightPyramidPublishers.push_back(getNH().advertise<sensor_msgs::Image>(
+            "/nerian_stereo/right_image" + suffix.str(), 5));
+        colorPyramidPublishers.push_back(getNH().advertise<sensor_msgs::Image>(
+            "/nerian_stereo/color_image" + suffix.str(), 5));
+    }
+}
 
-    dst[8] = -src[4];  dst[9] = -src[5];
-    dst[10] = -src[6]; dst[11] = -src[7];
+void StereoNodeBase::publishPyramidMsgs(const ImageSet& imageSet, int imageIndex, ros::Time stamp,
+        std::vector<ros::Publisher>& publishers) {
+    // Lower levels are computed from the higher levels, so all levels down
+    // to the smallest subscribed one are needed
+    int levels = 0;
+    for(int i = 0; i < static_cast<int>(publishers.size()); i++) {
+        if(publishers[i].getNumSubscribers() > 0) {
+            levels = i + 1;
+        }
+    }
+    if(levels == 0) {
+        return; //No subscribers
+    }
 
-    dst[12] = src[12]; dst[13] = src[13];
-    dst[14] = src[14]; dst[15] = src[15];
+    int cvType = 0;
+    string encoding;
+    bool format12Bit = false;
+    switch(imageSet.getPixelFormat(imageIndex)) {
+        case ImageSet::FORMAT_8_BIT_RGB:
+            cvType = CV_8UC3;
+            encoding = "rgb8";
+            break;
+        case ImageSet::FORMAT_8_BIT_MONO:
+            cvType = CV_8UC1;
+            encoding = "mono8";
+            break;
+        case ImageSet::FORMAT_12_BIT_MONO:
+            cvType = CV_16UC1;
+            encoding = (imagePyramidMono8 || toneMapper != nullptr) ? "mono8" : "mono16";
+            format12Bit = true;
+            break;
+        default:
+            return;
+    }
+
+    std_msgs::Header header;
+    if(publishInternalFrame) header.frame_id = internalFrame;
+    else header.frame_id = frame;
+    header.stamp = stamp;
+    header.seq = imageSet.getSequenceNumber(); // Actually ROS will overwrite this
+
+    bool convert = format12Bit && (imagePyramidMono8 || toneMapper != nullptr);
+    cv::Mat src(imageSet.getHeight(), imageSet.getWidth(), cvType,
+        imageSet.getPixelData(imageIndex), imageSet.getRowStride(imageIndex));
+    sensor_msgs::ImagePtr prevMsg; // Keeps the data of src alive
+
+    for(int level = 1; level <= levels; level++) {
+        // Odd rows and columns are cropped, such that OpenCV can use its
+        // vectorized 2x2 area filter
+        int width = src.cols / 2;
+        int height = src.rows / 2;
+        if(width == 0 || height == 0) {
+            return;
+        }
+
+        ros::Publisher& publisher = publishers[level - 1];
+        sensor_msgs::ImagePtr msg;
+        if(publisher.getNumSubscribers() > 0) {
+            msg.reset(new sensor_msgs::Image);
+            msg->header = header;
+            msg->width = width;
+            msg->height = height;
+            msg->encoding = encoding;
+            msg->is_bigendian = false;
+            msg->step = width * (convert ? 1 : CV_ELEM_SIZE(cvType));
+            msg->data.resize(msg->step * height);
+        }
+
+        // Downscale directly into the message buffer, unless a conversion
+        // is required
+        cv::Mat scaled;
+        if(msg != nullptr && !convert) {
+            scaled = cv::Mat(height, width, cvType, &msg->data[0], msg->step);
+        } else {
+            scaled.create(height, width, cvType);
+        }
+        cv::resize(src(cv::Rect(0, 0, 2*width, 2*height)), scaled, scaled.size(), 0, 0, cv::INTER_AREA);
+
+        if(msg != nullptr) {
+            if(convert) {
+                // Only the downscaled image is converted, such that lower
+                // levels are still computed at full precision
+                if(toneMapper != nullptr) {
+                    toneMapper->map(scaled.ptr<unsigned short>(0), width, height, scaled.step,
+                        &msg->data[0], msg->step);
+                } else {
+                    cv::Mat dst(height, width, CV_8UC1, &msg->data[0], msg->step);
+                    scaled.convertTo(dst, CV_8U, 1.0/16);
+                }
+            }
+            publisher.publish(msg);
+        }
+
+        // The next level is computed from this level
+        src = scaled;
+        prevMsg = msg;
+    }
+}
+
+const float* StereoNodeBase::getEffectiveQMatrix(const ImageSet& imageSet) {
+    const float* q = useQFromCalibFile ? calibQ : imageSet.getQMatrix();
+
+    // The transformation is only repeated if the device sends a different Q-matrix
+    if(!qCacheValid || memcmp(q, qSource, sizeof(qSource)) != 0) {
+        memcpy(qSource, q, sizeof(qSource));
+        if(rosCoordinateSystem) {
+            qMatrixToRosCoords(qSource, qCached);
+        } else {
+            memcpy(qCached, qSource, sizeof(qCached));
+        }
+        qCacheValid = true;
+    }
+    return qCached;
 }
 
-void StereoNodeBase::publishPointCloudMsg(ImageSet& imageSet, ros::Time stamp) {
+bool StereoNodeBase::publishPointCloudMsg(ImageSet& imageSet, ros::Time stamp) {
     if ((!imageSet.hasImageType(ImageSet::IMAGE_DISPARITY))
         || (imageSet.getPixelFormat(ImageSet::IMAGE_DISPARITY) != ImageSet::FORMAT_12_BIT_MONO)) {
-        return; // This is not a disparity map
+        return false; // This is not a disparity map
     }
 
-    // Set static q matrix if desired
-    if(useQFromCalibFile) {
-        static std::vector<float> q;
-        calibStorage["Q"] >> q;
-        imageSet.setQMatrix(&q[0]);
-    }
+    // Use static or transformed Q-matrix if desired
+    float deviceQ[16];
+    memcpy(deviceQ, imageSet.getQMatrix(), sizeof(deviceQ));
+    imageSet.setQMatrix(getEffectiveQMatrix(imageSet));
 
-    // Transform Q-matrix if desired
-    float qRos[16];
-    if(rosCoordinateSystem) {
-        qMatrixToRosCoords(imageSet.getQMatrix(), qRos);
-        imageSet.setQMatrix(qRos);
+    // The points might already have been reconstructed during reception
+    bool streamed = false;
+    if(cloudStreamer != nullptr) {
+        streamed = cloudStreamer->takePointCloud(imageSet, pointCloudMsg->data);
+        cloudStreamer->setQMatrix(deviceQ, imageSet.getQMatrix());
     }
 
     // Get 3D points
     float* pointMap = nullptr;
-    try {
-        pointMap = recon3d->createPointMap(imageSet, 0);
-    } catch(std::exception& ex) {
-        cerr << "Error creating point cloud: " << ex.what() << endl;
-        return;
+    if(!streamed) {
+        try {
+            pointMap = recon3d->createPointMap(imageSet, 0);
+        } catch(std::exception& ex) {
+            cerr << "Error creating point cloud: " << ex.what() << endl;
+            return false;
+        }
     }
 
     // Create message object and set header
@@ -416,7 +1567,8 @@ void StereoNodeBase::publishPointCloudMsg(ImageSet& imageSet, ros::Time stamp) {
     pointCloudMsg->header.seq = imageSet.getSequenceNumber(); // Actually ROS will overwrite this
 
     // Copy 3D points
-    if(pointCloudMsg->data.size() != imageSet.getWidth()*imageSet.getHeight()*4*sizeof(float)) {
+    if(pointCloudMsg->data.size() != imageSet.getWidth()*imageSet.getHeight()*4*sizeof(float)
+            || static_cast<int>(pointCloudMsg->width) != imageSet.getWidth()) {
         // Allocate buffer
         pointCloudMsg->data.resize(imageSet.getWidth()*imageSet.getHeight()*4*sizeof(float));
 
@@ -428,8 +1580,13 @@ void StereoNodeBase::publishPointCloudMsg(ImageSet& imageSet, ros::Time stamp) {
         pointCloudMsg->row_step = imageSet.getWidth() * pointCloudMsg->point_step;
         pointCloudMsg->is_dense = false;
     }
+    if(hugePageAdvisor != nullptr) {
+        hugePageAdvisor->advise(&pointCloudMsg->data[0], pointCloudMsg->data.size());
+    }
 
-    if(maxDepth < 0) {
+    if(streamed) {
+        // The points have already been copied during reception
+    } else if(maxDepth < 0) {
         // Just copy everything
         memcpy(&pointCloudMsg->data[0], pointMap,
             imageSet.getWidth()*imageSet.getHeight()*4*sizeof(float));
@@ -437,136 +1594,481 @@ void StereoNodeBase::publishPointCloudMsg(ImageSet& imageSet, ros::Time stamp) {
         // Only copy points up to maximum depth
         if(rosCoordinateSystem) {
             copyPointCloudClamped<0>(pointMap, reinterpret_cast<float*>(&pointCloudMsg->data[0]),
-                imageSet.getWidth()*imageSet.getHeight());
+                imageSet.getWidth()*imageSet.getHeight(), maxDepth);
         } else {
             copyPointCloudClamped<2>(pointMap, reinterpret_cast<float*>(&pointCloudMsg->data[0]),
-                imageSet.getWidth()*imageSet.getHeight());
+                imageSet.getWidth()*imageSet.getHeight(), maxDepth);
         }
     }
 
     if (imageSet.hasImageType(ImageSet::IMAGE_LEFT) || imageSet.hasImageType(ImageSet::IMAGE_COLOR)) {
         // Copy intensity values as well (if we received any image data)
+        static bool warned = false;
+        if(pointCloudColorMode == RGB_SEPARATE && !warned && imageSet.hasImageType(ImageSet::IMAGE_COLOR)
+                && imageSet.getPixelFormat(ImageSet::IMAGE_COLOR) == ImageSet::FORMAT_8_BIT_RGB) {
+            warned = true;
+            ROS_WARN("RGBF32 is not supported for color images. Please use RGB8!");
+        }
+
         switch(pointCloudColorMode) {
             case INTENSITY:
-                copyPointCloudIntensity<INTENSITY>(imageSet);
+                copyPointCloudIntensity<INTENSITY>(imageSet, &pointCloudMsg->data[0]);
                 break;
             case RGB_COMBINED:
-                copyPointCloudIntensity<RGB_COMBINED>(imageSet);
+                copyPointCloudIntensity<RGB_COMBINED>(imageSet, &pointCloudMsg->data[0]);
                 break;
             case RGB_SEPARATE:
-                copyPointCloudIntensity<RGB_SEPARATE>(imageSet);
+                copyPointCloudIntensity<RGB_SEPARATE>(imageSet, &pointCloudMsg->data[0]);
                 break;
             case NONE:
                 break;
         }
     }
 
-    cloudPublisher->publish(pointCloudMsg);
+    if(cloudPublisher->getNumSubscribers() > 0) {
+        cloudPublisher->publish(pointCloudMsg);
+    }
+    return true;
 }
 
-template <StereoNodeBase::PointCloudColorMode colorMode> void StereoNodeBase::copyPointCloudIntensity(ImageSet& imageSet) {
-    auto imageIndex = imageSet.hasImageType(ImageSet::IMAGE_COLOR) ? ImageSet::IMAGE_COLOR : ImageSet::IMAGE_LEFT;
-    // Get pointers to the beginning and end of the point cloud
-    unsigned char* cloudStart = &pointCloudMsg->data[0];
-    unsigned char* cloudEnd = &pointCloudMsg->data[0]
-        + imageSet.getWidth()*imageSet.getHeight()*4*sizeof(float);
+void StereoNodeBase::writeSharedMemory(const ImageSet& imageSet, ros::Time stamp, bool withPointCloud) {
+    static const ImageSet::ImageType imageTypes[] = {ImageSet::IMAGE_LEFT, ImageSet::IMAGE_RIGHT,
+        ImageSet::IMAGE_COLOR, ImageSet::IMAGE_DISPARITY};
+    static const shm::EntryType entryTypes[] = {shm::ENTRY_LEFT, shm::ENTRY_RIGHT,
+        shm::ENTRY_COLOR, shm::ENTRY_DISPARITY};
 
-    if(imageSet.getPixelFormat(imageIndex) == ImageSet::FORMAT_8_BIT_MONO) {
-        // Get pointer to the current pixel and end of current row
-        unsigned char* imagePtr = imageSet.getPixelData(imageIndex);
-        unsigned char* rowEndPtr = imagePtr + imageSet.getWidth();
-        int rowIncrement = imageSet.getRowStride(imageIndex) - imageSet.getWidth();
+    shmBuffers.clear();
+    for(int i = 0; i < 4; i++) {
+        if(!imageSet.hasImageType(imageTypes[i])) {
+            continue;
+        }
+        int index = imageSet.getIndexOf(imageTypes[i]);
+
+        ShmBuffer buffer;
+        switch(imageSet.getPixelFormat(index)) {
+            case ImageSet::FORMAT_8_BIT_MONO: buffer.encoding = "mono8"; break;
+            case ImageSet::FORMAT_12_BIT_MONO: buffer.encoding = "mono16"; break;
+            case ImageSet::FORMAT_8_BIT_RGB: buffer.encoding = "rgb8"; break;
+            default: continue;
+        }
+        buffer.type = entryTypes[i];
+        buffer.width = imageSet.getWidth();
+        buffer.height = imageSet.getHeight();
+        buffer.step = imageSet.getRowStride(index);
+        buffer.data = imageSet.getPixelData(index);
+        buffer.size = static_cast<size_t>(buffer.step) * buffer.height;
+        shmBuffers.push_back(buffer);
+    }
 
-        for(unsigned char* cloudPtr = cloudStart + 3*sizeof(float);
-                cloudPtr < cloudEnd; cloudPtr+= 4*sizeof(float)) {
-            if(colorMode == RGB_SEPARATE) {// RGB as float
-                *reinterpret_cast<float*>(cloudPtr) = static_cast<float>(*imagePtr) / 255.0F;
-            } else if(colorMode == RGB_COMBINED) {// RGB as integer
-                const unsigned char intensity = *imagePtr;
-                *reinterpret_cast<unsigned int*>(cloudPtr) = (intensity << 16) | (intensity << 8) | intensity;
-            } else {
-                *cloudPtr = *imagePtr;
-            }
+    if(withPointCloud) {
+        ShmBuffer buffer;
+        switch(pointCloudColorMode) {
+            case INTENSITY: buffer.encoding = "xyz_intensity"; break;
+            case RGB_COMBINED: buffer.encoding = "xyz_rgb"; break;
+            case RGB_SEPARATE: buffer.encoding = "xyz_rgb_separate"; break;
+            case NONE: buffer.encoding = "xyz"; break;
+        }
+        buffer.type = shm::ENTRY_POINT_CLOUD;
+        buffer.width = pointCloudMsg->width;
+        buffer.height = pointCloudMsg->height;
+        buffer.step = pointCloudMsg->row_step;
+        buffer.data = &pointCloudMsg->data[0];
+        buffer.size = pointCloudMsg->data.size();
+        shmBuffers.push_back(buffer);
+    }
 
-            imagePtr++;
-            if(imagePtr == rowEndPtr) {
-                // Progress to next row
-                imagePtr += rowIncrement;
-                rowEndPtr = imagePtr + imageSet.getWidth();
-            }
+    uint64_t frameIndex = 0;
+    try {
+        frameIndex = shmWriter->write(imageSet.getSequenceNumber(), stamp.sec, stamp.nsec, shmBuffers);
+    } catch(const std::exception& ex) {
+        ROS_ERROR("Disabling shared memory output: %s", ex.what());
+        shmWriter.reset();
+        return;
+    }
+
+    // Consumers may also just poll the ring instead of subscribing
+    if(shmFramePublisher->getNumSubscribers() > 0) {
+        nerian_stereo::SharedMemoryFramePtr msg(new nerian_stereo::SharedMemoryFrame);
+        msg->header.stamp = stamp;
+        if(publishInternalFrame) msg->header.frame_id = internalFrame;
+        else msg->header.frame_id = frame;
+        msg->segment = shmWriter->getName();
+        msg->frame_index = frameIndex;
+        msg->num_slots = shmWriter->getNumSlots();
+        msg->sequence = imageSet.getSequenceNumber();
+        shmFramePublisher->publish(msg);
+    }
+}
+
+void StereoNodeBase::publishNormalsMsg(ros::Time stamp) {
+    if(normalEstimator == nullptr) {
+        initNormals();
+    }
+
+    normalsMsg->header = pointCloudMsg->header;
+    normalsMsg->header.stamp = stamp;
+
+    int width = pointCloudMsg->width;
+    int height = pointCloudMsg->height;
+    if(normalsMsg->width != pointCloudMsg->width || normalsMsg->height != pointCloudMsg->height) {
+        normalsMsg->data.resize(width * height * 8 * sizeof(float));
+        normalsMsg->width = width;
+        normalsMsg->height = height;
+        normalsMsg->point_step = 8*sizeof(float);
+        normalsMsg->row_step = width * normalsMsg->point_step;
+    }
+
+    // Copy the point coordinates of the already clamped cloud
+    const float* cloud = reinterpret_cast<const float*>(&pointCloudMsg->data[0]);
+    float* dst = reinterpret_cast<float*>(&normalsMsg->data[0]);
+    for(int i = 0; i < width*height; i++) {
+        dst[8*i] = cloud[4*i];
+        dst[8*i + 1] = cloud[4*i + 1];
+        dst[8*i + 2] = cloud[4*i + 2];
+    }
+
+    normalEstimator->compute(cloud, 4, width, height, dst + 4, 8);
+    normalsPublisher->publish(normalsMsg);
+}
+
+void StereoNodeBase::initNormals() {
+    normalEstimator.reset(new NormalEstimator(normalRadius, normalMaxDepthChange));
+
+    // Points and normals are stored in two 16 byte blocks
+    normalsMsg.reset(new sensor_msgs::PointCloud2);
+    normalsMsg->is_bigendian = false;
+    normalsMsg->is_dense = false;
+
+    const char* fieldNames[] = {"x", "y", "z", "normal_x", "normal_y", "normal_z"};
+    const int fieldOffsets[] = {0, 1, 2, 4, 5, 6};
+    for(int i = 0; i < 6; i++) {
+        sensor_msgs::PointField field;
+        field.name = fieldNames[i];
+        field.offset = fieldOffsets[i]*sizeof(float);
+        field.datatype = sensor_msgs::PointField::FLOAT32;
+        field.count = 1;
+        normalsMsg->fields.push_back(field);
+    }
+}
+
+void StereoNodeBase::publishGridMsgs(ros::Time stamp) {
+    if(elevationGrid == nullptr) {
+        elevationGrid.reset(new ElevationGridBuilder(gridResolution, gridLength, gridWidth,
+            gridCameraHeight, gridMinHeight, gridMaxHeight, gridObstacleHeight, gridMinPoints));
+    }
+
+    tf2::Matrix3x3 rot = getGravityRotation();
+    publishGravityFrame(rot, stamp);
+    float rotation[9];
+    getRotationArray(rot, rotation);
+    elevationGrid->setRotation(rotation);
+
+    // Bin the already clamped point cloud
+    elevationGrid->update(reinterpret_cast<const float*>(&pointCloudMsg->data[0]), 4,
+        pointCloudMsg->width * pointCloudMsg->height);
+
+    // The grid lies on the ground plane below the camera, centered laterally,
+    // in the gravity-aligned frame
+    nav_msgs::MapMetaData info;
+    info.map_load_time = stamp;
+    info.resolution = elevationGrid->getResolution();
+    info.width = elevationGrid->getCellsX();
+    info.height = elevationGrid->getCellsY();
+    info.origin.position.x = 0.0;
+    info.origin.position.y = -0.5 * info.height * info.resolution;
+    info.origin.position.z = -elevationGrid->getCameraHeight();
+    info.origin.orientation.x = 0.0;
+    info.origin.orientation.y = 0.0;
+    info.origin.orientation.z = 0.0;
+    info.origin.orientation.w = 1.0;
+
+    if(occupancyGridPublisher->getNumSubscribers() > 0) {
+        nav_msgs::OccupancyGridPtr msg(new nav_msgs::OccupancyGrid);
+        msg->header.stamp = stamp;
+        msg->header.frame_id = gravityFrame;
+        msg->info = info;
+        elevationGrid->getOccupancy(msg->data);
+        occupancyGridPublisher->publish(msg);
+    }
+
+    if(elevationGridPublisher->getNumSubscribers() > 0) {
+        nerian_stereo::ElevationGridPtr msg(new nerian_stereo::ElevationGrid);
+        msg->header.stamp = stamp;
+        msg->header.frame_id = gravityFrame;
+        msg->info = info;
+        msg->min_height = elevationGrid->getMinHeights();
+        msg->max_height = elevationGrid->getMaxHeights();
+        msg->point_count = elevationGrid->getCounts();
+        msg->obstacle.resize(msg->point_count.size());
+        for(size_t i = 0; i < msg->obstacle.size(); i++) {
+            msg->obstacle[i] = elevationGrid->isObstacle(i) ? 1 : 0;
         }
-    } else if(imageSet.getPixelFormat(imageIndex) == ImageSet::FORMAT_12_BIT_MONO) {
-        // Get pointer to the current pixel and end of current row
-        unsigned short* imagePtr = reinterpret_cast<unsigned short*>(imageSet.getPixelData(imageIndex));
-        unsigned short* rowEndPtr = imagePtr + imageSet.getWidth();
-        int rowIncrement = imageSet.getRowStride(imageIndex) - 2*imageSet.getWidth();
+        elevationGridPublisher->publish(msg);
+    }
+}
 
-        for(unsigned char* cloudPtr = cloudStart + 3*sizeof(float);
-                cloudPtr < cloudEnd; cloudPtr+= 4*sizeof(float)) {
+void StereoNodeBase::updateFusedMap(ros::Time stamp) {
+    // Frame pose from tf, or the gravity-aligned orientation around the
+    // sensor if no map frame is configured
+    tf2::Matrix3x3 rot;
+    float translation[3] = {0.0f, 0.0f, 0.0f};
+    std::string mapFrame;
+    if(tfBuffer != nullptr) {
+        try {
+            geometry_msgs::TransformStamped transform = tfBuffer->lookupTransform(fusedMapFrame,
+                pointCloudMsg->header.frame_id, stamp);
+            const geometry_msgs::Quaternion& q = transform.transform.rotation;
+            rot.setRotation(tf2::Quaternion(q.x, q.y, q.z, q.w));
+            translation[0] = transform.transform.translation.x;
+            translation[1] = transform.transform.translation.y;
+            translation[2] = transform.transform.translation.z;
+        } catch(const tf2::TransformException& ex) {
+            ROS_WARN_THROTTLE(5, "Frame not added to fused map: %s", ex.what());
+            return;
+        }
+        mapFrame = fusedMapFrame;
+    } else {
+        rot = getImuRotation();
+        mapFrame = frame;
+    }
 
-            if(colorMode == RGB_SEPARATE) {// RGB as float
-                *reinterpret_cast<float*>(cloudPtr) = static_cast<float>(*imagePtr) / 4095.0F;
-            } else if(colorMode == RGB_COMBINED) {// RGB as integer
-                const unsigned char intensity = *imagePtr/16;
-                *reinterpret_cast<unsigned int*>(cloudPtr) = (intensity << 16) | (intensity << 8) | intensity;
-            } else {
-                *cloudPtr = *imagePtr/16;
-            }
+    float rotation[9];
+    getRotationArray(rot, rotation);
+    voxelMap->integrate(reinterpret_cast<const float*>(&pointCloudMsg->data[0]), 4,
+        pointCloudMsg->width, pointCloudMsg->height, fusedMapStep, rotation, translation, stamp.toSec());
 
-            imagePtr++;
-            if(imagePtr == rowEndPtr) {
-                // Progress to next row
-                imagePtr += rowIncrement;
-                rowEndPtr = imagePtr + imageSet.getWidth();
-            }
+    double sinceLastMap = (stamp - lastFusedMapStamp).toSec();
+    if(sinceLastMap >= 0 && sinceLastMap < 1.0 / fusedMapRate) {
+        return;
+    }
+    lastFusedMapStamp = stamp;
+
+    if(voxelMap->getNumDropped() > 0) {
+        ROS_WARN_THROTTLE(10, "Fused map is full; %d voxels dropped (fused_map_max_voxels is %d)",
+            voxelMap->getNumDropped(), fusedMapMaxVoxels);
+    }
+
+    sensor_msgs::PointCloud2Ptr msg(new sensor_msgs::PointCloud2);
+    msg->header.stamp = stamp;
+    msg->header.frame_id = mapFrame;
+    int numVoxels = voxelMap->extract(msg->data);
+    msg->height = 1;
+    msg->width = numVoxels;
+    msg->is_bigendian = false;
+    msg->point_step = 4*sizeof(float);
+    msg->row_step = numVoxels * msg->point_step;
+    msg->is_dense = true;
+
+    static const char* const names[] = {"x", "y", "z", "observations"};
+    msg->fields.resize(4);
+    for(int i = 0; i < 4; i++) {
+        msg->fields[i].name = names[i];
+        msg->fields[i].offset = i * sizeof(float);
+        msg->fields[i].datatype = i < 3 ? sensor_msgs::PointField::FLOAT32 : sensor_msgs::PointField::UINT32;
+        msg->fields[i].count = 1;
+    }
+
+    fusedMapPublisher->publish(msg);
+}
+
+tf2::Matrix3x3 StereoNodeBase::getImuRotation() {
+    tf2::Matrix3x3 rot;
+    rot.setIdentity();
+    if(dataChannelService != nullptr && dataChannelService->imuAvailable()) {
+        // Same orientation as published for the internal frame transform
+        TimestampedQuaternion tsq = dataChannelService->imuGetRotationQuaternion();
+        tf2::Quaternion q(tsq.x(), rosCoordinateSystem?(-tsq.z()):tsq.y(),
+            rosCoordinateSystem?tsq.y():tsq.z(), tsq.w());
+        rot.setRotation(q);
+    }
+    if(!rosCoordinateSystem) {
+        rot = getCameraToRosRotation() * rot;
+    }
+    return rot;
+}
+
+tf2::Matrix3x3 StereoNodeBase::getGravityRotation() {
+    // Roll and pitch of the orientation in ROS axes, without the constant
+    // swap of the camera axes
+    tf2::Matrix3x3 axes;
+    axes.setIdentity();
+    if(!rosCoordinateSystem) {
+        axes = getCameraToRosRotation();
+    }
+    double roll, pitch, yaw;
+    (getImuRotation() * axes.transpose()).getRPY(roll, pitch, yaw);
+
+    // Keep roll and pitch only, such that the frame turns with the camera
+    tf2::Matrix3x3 rot;
+    rot.setRPY(roll, pitch, 0.0);
+    return rot * axes;
+}
+
+tf2::Matrix3x3 StereoNodeBase::getCameraToRosRotation() {
+    // Camera axes (x right, y down, z forward) to x forward, y left, z up
+    return tf2::Matrix3x3(0, 0, 1, -1, 0, 0, 0, -1, 0);
+}
+
+void StereoNodeBase::publishGravityFrame(const tf2::Matrix3x3& rot, ros::Time stamp) {
+    if(stamp == lastGravityFrameStamp) {
+        return;
+    }
+    lastGravityFrameStamp = stamp;
+
+    // Child of the point cloud frame, so it also follows the camera if
+    // the IMU is not available
+    publishRotatedFrame(gravityFrame, rot, stamp);
+}
+
+void StereoNodeBase::publishRotatedFrame(const std::string& childFrame,
+        const tf2::Matrix3x3& rot, ros::Time stamp) {
+    tf2::Quaternion q;
+    rot.transpose().getRotation(q);
+    geometry_msgs::TransformStamped transform;
+    transform.header.stamp = stamp;
+    transform.header.frame_id = publishInternalFrame ? internalFrame : frame;
+    transform.child_frame_id = childFrame;
+    transform.transform.translation.x = 0.0;
+    transform.transform.translation.y = 0.0;
+    transform.transform.translation.z = 0.0;
+    transform.transform.rotation.x = q.x();
+    transform.transform.rotation.y = q.y();
+    transform.transform.rotation.z = q.z();
+    transform.transform.rotation.w = q.w();
+    transformBroadcaster->sendTransform(transform);
+}
+
+void StereoNodeBase::getRotationArray(const tf2::Matrix3x3& rot, float* rotation) {
+    for(int i = 0; i < 3; i++) {
+        rotation[3*i] = rot[i].x();
+        rotation[3*i + 1] = rot[i].y();
+        rotation[3*i + 2] = rot[i].z();
+    }
+}
+
+void StereoNodeBase::initLaserScans() {
+    // Bands are given as whitespace or comma separated list of name:first_row:last_row
+    std::string spec = scanBands;
+    std::replace(spec.begin(), spec.end(), ',', ' ');
+    std::istringstream ss(spec);
+    std::string band;
+    while(ss >> band) {
+        std::replace(band.begin(), band.end(), ':', ' ');
+        std::istringstream bandStream(band);
+        std::string name;
+        double firstRow = 0, lastRow = 0;
+        if(!(bandStream >> name >> firstRow >> lastRow) || firstRow < 0 || lastRow > 1 || firstRow > lastRow) {
+            ROS_ERROR("Ignoring invalid laser scan band: %s", band.c_str());
+            continue;
         }
-    } else if(imageSet.getPixelFormat(imageIndex) == ImageSet::FORMAT_8_BIT_RGB) {
-        // Get pointer to the current pixel and end of current row
-        unsigned char* imagePtr = imageSet.getPixelData(imageIndex);
-        unsigned char* rowEndPtr = imagePtr + 3*imageSet.getWidth();
-        int rowIncrement = imageSet.getRowStride(imageIndex) - 3*imageSet.getWidth();
 
-        static bool warned = false;
-        if(colorMode == RGB_SEPARATE && !warned) {
-            warned = true;
-            ROS_WARN("RGBF32 is not supported for color images. Please use RGB8!");
+        LaserScanOutput scan;
+        scan.topic = "/nerian_stereo/" + name;
+        scan.publisher = getNH().advertise<sensor_msgs::LaserScan>(scan.topic, 5);
+        scan.generator.reset(new LaserScanGenerator(firstRow, lastRow, scanMinHeight,
+            scanMaxHeight, scanRangeMax));
+        laserScans.push_back(scan);
+    }
+}
+
+void StereoNodeBase::publishLaserScans(const ImageSet& imageSet, ros::Time stamp) {
+    if(imageSet.getPixelFormat(ImageSet::IMAGE_DISPARITY) != ImageSet::FORMAT_12_BIT_MONO) {
+        return;
+    }
+
+    // Scans are computed in camera coordinates, but the scan angles and the
+    // frame are in ROS axes. These match the point cloud frame only with
+    // ros_coordinate_system; otherwise a rotated child frame is published.
+    const float* q = useQFromCalibFile ? calibQ : imageSet.getQMatrix();
+    bool scanFramePublished = false;
+    const unsigned short* dispMap = reinterpret_cast<const unsigned short*>(
+        imageSet.getPixelData(ImageSet::IMAGE_DISPARITY));
+
+    for(LaserScanOutput& scan: laserScans) {
+        if(scan.publisher.getNumSubscribers() == 0) {
+            continue;
         }
 
-        for(unsigned char* cloudPtr = cloudStart + 3*sizeof(float);
-                cloudPtr < cloudEnd; cloudPtr+= 4*sizeof(float)) {
-            if(colorMode == RGB_SEPARATE) {// RGB as float
-                *reinterpret_cast<float*>(cloudPtr) = static_cast<float>(imagePtr[2]) / 255.0F;
-            } else if(colorMode == RGB_COMBINED) {// RGB as integer
-                *reinterpret_cast<unsigned int*>(cloudPtr) = (imagePtr[0] << 16) | (imagePtr[1] << 8) | imagePtr[2];
-            } else {
-                *cloudPtr = (imagePtr[0] + imagePtr[1]*2 + imagePtr[2])/4;
-            }
+        LaserScanGenerator& generator = *scan.generator;
+        generator.compute(dispMap, imageSet.getWidth(), imageSet.getHeight(),
+            imageSet.getRowStride(ImageSet::IMAGE_DISPARITY), q, imageSet.getSubpixelFactor());
 
-            imagePtr+=3;
-            if(imagePtr == rowEndPtr) {
-                // Progress to next row
-                imagePtr += rowIncrement;
-                rowEndPtr = imagePtr + imageSet.getWidth();
+        sensor_msgs::LaserScanPtr msg(new sensor_msgs::LaserScan);
+        msg->header.stamp = stamp;
+        if(!rosCoordinateSystem) {
+            if(!scanFramePublished) {
+                publishRotatedFrame(scanFrame, getCameraToRosRotation(), stamp);
+                scanFramePublished = true;
             }
-        }
-    } else {
-        throw std::runtime_error("Invalid pixel format!");
+            msg->header.frame_id = scanFrame;
+        } else if(publishInternalFrame) msg->header.frame_id = internalFrame;
+        else msg->header.frame_id = frame;
+        msg->angle_min = generator.getAngleMin();
+        msg->angle_max = generator.getAngleMax();
+        msg->angle_increment = generator.getAngleIncrement();
+        msg->time_increment = 0.0;
+        msg->scan_time = 0.0;
+        msg->range_min = 0.0;
+        msg->range_max = generator.getRangeMax();
+        msg->ranges = generator.getRanges();
+        scan.publisher.publish(msg);
     }
 }
 
-template <int coord> void StereoNodeBase::copyPointCloudClamped(float* src, float* dst, int size) {
-    // Only copy points that are below the minimum depth
-    float* endPtr = src + 4*size;
-    for(float *srcPtr = src, *dstPtr = dst; srcPtr < endPtr; srcPtr+=4, dstPtr+=4) {
-        if(srcPtr[coord] > maxDepth) {
-            dstPtr[0] = std::numeric_limits<float>::quiet_NaN();
-            dstPtr[1] = std::numeric_limits<float>::quiet_NaN();
-            dstPtr[2] = std::numeric_limits<float>::quiet_NaN();
-        } else {
-            dstPtr[0] = srcPtr[0];
-            dstPtr[1] = srcPtr[1];
-            dstPtr[2] = srcPtr[2];
+void StereoNodeBase::publishObstacleBoxes(const ImageSet& imageSet, ros::Time stamp) {
+    if(imageSet.getPixelFormat(ImageSet::IMAGE_DISPARITY) != ImageSet::FORMAT_12_BIT_MONO) {
+        return;
+    }
+
+    // Points are reconstructed in point cloud coordinates, from which the
+    // gravity rotation is defined
+    tf2::Matrix3x3 rot = getGravityRotation();
+    publishGravityFrame(rot, stamp);
+    float rotation[9];
+    getRotationArray(rot, rotation);
+    obstacleClusterer->setRotation(rotation);
+
+    obstacleClusterer->compute(reinterpret_cast<const unsigned short*>(
+        imageSet.getPixelData(ImageSet::IMAGE_DISPARITY)), imageSet.getWidth(), imageSet.getHeight(),
+        imageSet.getRowStride(ImageSet::IMAGE_DISPARITY), getEffectiveQMatrix(imageSet),
+        imageSet.getSubpixelFactor());
+
+    nerian_stereo::ObstacleBoxArrayPtr msg(new nerian_stereo::ObstacleBoxArray);
+    msg->header.stamp = stamp;
+    msg->header.frame_id = gravityFrame;
+
+    const std::vector<ObstacleClusterer::Cluster>& clusters = obstacleClusterer->getClusters();
+    msg->boxes.resize(clusters.size());
+    for(size_t i = 0; i < clusters.size(); i++) {
+        const ObstacleClusterer::Cluster& cluster = clusters[i];
+        nerian_stereo::ObstacleBox& box = msg->boxes[i];
+        for(int k = 0; k < 3; k++) {
+            box.centroid[k] = cluster.centroid[k];
+            box.min_corner[k] = cluster.minCorner[k];
+            box.max_corner[k] = cluster.maxCorner[k];
         }
+        box.pixel_count = cluster.numPixels;
+        box.image_x = cluster.imageX;
+        box.image_y = cluster.imageY;
+        box.image_width = cluster.imageWidth;
+        box.image_height = cluster.imageHeight;
+    }
+
+    obstacleBoxesPublisher->publish(msg);
+}
+
+void StereoNodeBase::relayImageSet(const ImageSet& imageSet) {
+    relayServer->relay(imageSet);
+
+    int clients = relayServer->getNumConnected();
+    if(clients != relayClients) {
+        ROS_INFO("%d relay client(s) connected", clients);
+        relayClients = clients;
+    }
+
+    std::string error = relayServer->getLastError();
+    if(error != "") {
+        ROS_WARN("%s", error.c_str());
     }
 }
 
@@ -640,60 +2142,67 @@ void StereoNodeBase::initPointCloud() {
     }
 }
 
-void StereoNodeBase::publishCameraInfo(ros::Time stamp, const ImageSet& imageSet) {
-    if(camInfoMsg == NULL) {
-        // Initialize the camera info structure
-        camInfoMsg.reset(new nerian_stereo::StereoCameraInfo);
-
-        if(publishInternalFrame) camInfoMsg->header.frame_id = internalFrame;
-        else camInfoMsg->header.frame_id = frame;
-        camInfoMsg->header.seq = imageSet.getSequenceNumber(); // Actually ROS will overwrite this
-
-        if(calibFile != "") {
-            std::vector<int> sizeVec;
-            calibStorage["size"] >> sizeVec;
-            if(sizeVec.size() != 2) {
-                std::runtime_error("Calibration file format error!");
-            }
+void StereoNodeBase::initCameraInfo() {
+    // Initialize the camera info structure once; per-frame messages are copies
+    camInfoMsg.reset(new nerian_stereo::StereoCameraInfo);
+
+    if(publishInternalFrame) camInfoMsg->header.frame_id = internalFrame;
+    else camInfoMsg->header.frame_id = frame;
+
+    if(calibration.isValid()) {
+        const CalibrationData& calib = calibration.getData();
+
+        camInfoMsg->left_info.header = camInfoMsg->header;
+        camInfoMsg->left_info.width = calib.width;
+        camInfoMsg->left_info.height = calib.height;
+        camInfoMsg->left_info.distortion_model = "plumb_bob";
+        camInfoMsg->left_info.D.assign(calib.D1, calib.D1 + calib.numD1);
+        std::copy(calib.M1, calib.M1 + 9, camInfoMsg->left_info.K.begin());
+        std::copy(calib.R1, calib.R1 + 9, camInfoMsg->left_info.R.begin());
+        std::copy(calib.P1, calib.P1 + 12, camInfoMsg->left_info.P.begin());
+        camInfoMsg->left_info.binning_x = 1;
+        camInfoMsg->left_info.binning_y = 1;
+        camInfoMsg->left_info.roi.do_rectify = false;
+        camInfoMsg->left_info.roi.height = 0;
+        camInfoMsg->left_info.roi.width = 0;
+        camInfoMsg->left_info.roi.x_offset = 0;
+        camInfoMsg->left_info.roi.y_offset = 0;
+
+        camInfoMsg->right_info.header = camInfoMsg->header;
+        camInfoMsg->right_info.width = calib.width;
+        camInfoMsg->right_info.height = calib.height;
+        camInfoMsg->right_info.distortion_model = "plumb_bob";
+        camInfoMsg->right_info.D.assign(calib.D2, calib.D2 + calib.numD2);
+        std::copy(calib.M2, calib.M2 + 9, camInfoMsg->right_info.K.begin());
+        std::copy(calib.R2, calib.R2 + 9, camInfoMsg->right_info.R.begin());
+        std::copy(calib.P2, calib.P2 + 12, camInfoMsg->right_info.P.begin());
+        camInfoMsg->right_info.binning_x = 1;
+        camInfoMsg->right_info.binning_y = 1;
+        camInfoMsg->right_info.roi.do_rectify = false;
+        camInfoMsg->right_info.roi.height = 0;
+        camInfoMsg->right_info.roi.width = 0;
+        camInfoMsg->right_info.roi.x_offset = 0;
+        camInfoMsg->right_info.roi.y_offset = 0;
+
+        std::copy(calib.Q, calib.Q + 16, camInfoMsg->Q.begin());
+        std::copy(calib.T, calib.T + 3, camInfoMsg->T_left_right.begin());
+        std::copy(calib.R, calib.R + 9, camInfoMsg->R_left_right.begin());
+    }
+}
 
-            camInfoMsg->left_info.header = camInfoMsg->header;
-            camInfoMsg->left_info.width = sizeVec[0];
-            camInfoMsg->left_info.height = sizeVec[1];
-            camInfoMsg->left_info.distortion_model = "plumb_bob";
-            calibStorage["D1"] >> camInfoMsg->left_info.D;
-            readCalibrationArray("M1", camInfoMsg->left_info.K);
-            readCalibrationArray("R1", camInfoMsg->left_info.R);
-            readCalibrationArray("P1", camInfoMsg->left_info.P);
-            camInfoMsg->left_info.binning_x = 1;
-            camInfoMsg->left_info.binning_y = 1;
-            camInfoMsg->left_info.roi.do_rectify = false;
-            camInfoMsg->left_info.roi.height = 0;
-            camInfoMsg->left_info.roi.width = 0;
-            camInfoMsg->left_info.roi.x_offset = 0;
-            camInfoMsg->left_info.roi.y_offset = 0;
-
-            camInfoMsg->right_info.header = camInfoMsg->header;
-            camInfoMsg->right_info.width = sizeVec[0];
-            camInfoMsg->right_info.height = sizeVec[1];
-            camInfoMsg->right_info.distortion_model = "plumb_bob";
-            calibStorage["D2"] >> camInfoMsg->right_info.D;
-            readCalibrationArray("M2", camInfoMsg->right_info.K);
-            readCalibrationArray("R2", camInfoMsg->right_info.R);
-            readCalibrationArray("P2", camInfoMsg->right_info.P);
-            camInfoMsg->right_info.binning_x = 1;
-            camInfoMsg->right_info.binning_y = 1;
-            camInfoMsg->right_info.roi.do_rectify = false;
-            camInfoMsg->right_info.roi.height = 0;
-            camInfoMsg->right_info.roi.width = 0;
-            camInfoMsg->right_info.roi.x_offset = 0;
-            camInfoMsg->right_info.roi.y_offset = 0;
-
-            readCalibrationArray("Q", camInfoMsg->Q);
-            readCalibrationArray("T", camInfoMsg->T_left_right);
-            readCalibrationArray("R", camInfoMsg->R_left_right);
-        }
+void StereoNodeBase::publishCameraInfoMsg(const sensor_msgs::CameraInfo& info, ros::Time stamp,
+        ros::Publisher* publisher) {
+    if(publisher->getNumSubscribers() <= 0 || info.width == 0) {
+        return; // No subscribers or no calibration available
     }
 
+    // Publish as shared pointer, such that nodelet subscribers receive it without copying
+    sensor_msgs::CameraInfoPtr msg(new sensor_msgs::CameraInfo(info));
+    msg->header.stamp = stamp;
+    publisher->publish(msg);
+}
+
+void StereoNodeBase::publishCameraInfo(ros::Time stamp, const ImageSet& imageSet) {
     double dt = (stamp - lastCamInfoPublish).toSec();
     if(dt > 1.0) {
         // Rather use the Q-matrix that we received over the network if it is valid
@@ -714,30 +2223,22 @@ void StereoNodeBase::publishCameraInfo(ros::Time stamp, const ImageSet& imageSet
     }
 }
 
-template<class T> void StereoNodeBase::readCalibrationArray(const char* key, T& dest) {
-    std::vector<double> doubleVec;
-    calibStorage[key] >> doubleVec;
-
-    if(doubleVec.size() != dest.size()) {
-        std::runtime_error("Calibration file format error!");
-    }
-
-    std::copy(doubleVec.begin(), doubleVec.end(), dest.begin());
-}
-
 void StereoNodeBase::processDataChannels() {
     if(!publishInternalFrame){
         return;
     }
     auto now = ros::Time::now();
-    if ((now - currentTransform.header.stamp).toSec() < 0.01) {
+    if ((now - lastTransformUpdate).toSec() < 0.01) {
         // Limit to 100 Hz transform update frequency
         return;
     }
+    lastTransformUpdate = now;
     if (dataChannelService->imuAvailable()) {
         // Obtain and publish the most recent orientation
         TimestampedQuaternion tsq = dataChannelService->imuGetRotationQuaternion();
-        currentTransform.header.stamp = now;
+        int secs = 0, microsecs = 0;
+        tsq.getTimestamp(secs, microsecs);
+        currentTransform.header.stamp = deviceToHostTime(secs, microsecs, now);
         if(rosCoordinateSystem) {
             currentTransform.transform.rotation.x = tsq.x();
             currentTransform.transform.rotation.y = -tsq.z();
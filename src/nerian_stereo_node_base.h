@@ -17,6 +17,12 @@
 
 #include <iostream>
 #include <iomanip>
+#include <sstream>
+#include <cstdio>
+#include <algorithm>
+#include <future>
+#include <memory>
+#include <mutex>
 #include <boost/smart_ptr.hpp>
 
 #include <visiontransfer/asynctransfer.h>
@@ -28,19 +34,49 @@
 #include <ros/ros.h>
 #include <sensor_msgs/PointCloud2.h>
 #include <sensor_msgs/Image.h>
+#include <sensor_msgs/CameraInfo.h>
+#include <sensor_msgs/LaserScan.h>
 #include <dynamic_reconfigure/server.h>
 #include <tf2/LinearMath/Quaternion.h>
 #include <tf2/LinearMath/Matrix3x3.h>
 #include <tf2_ros/transform_broadcaster.h>
+#include <tf2_ros/transform_listener.h>
 #include <geometry_msgs/TransformStamped.h>
+#include <nav_msgs/OccupancyGrid.h>
+#include <stereo_msgs/DisparityImage.h>
 
 #include <cv_bridge/cv_bridge.h>
 #include <opencv2/opencv.hpp>
 
 #include <colorcoder.h>
 
+#include "clock_sync.h"
+#include "calibration.h"
+#include "parameter_worker.h"
+#include "parameter_cache.h"
+#include "normal_estimation.h"
+#include "elevation_grid.h"
+#include "laser_scan.h"
+#include "disparity_filter.h"
+#include "change_detector.h"
+#include "relay_server.h"
+#include "host_matcher.h"
+#include "point_cloud_streamer.h"
+#include "disparity_converter.h"
+#include "tone_mapper.h"
+#include "realtime.h"
+#include "voxel_map.h"
+#include "point_cloud_kernels.h"
+#include "obstacle_clusters.h"
+#include "object_pool.h"
+#include "nerian_stereo/shm_ring.h"
+
 #include <nerian_stereo/NerianStereoConfig.h>
 #include <nerian_stereo/StereoCameraInfo.h>
+#include <nerian_stereo/SharedMemoryFrame.h>
+#include <nerian_stereo/ElevationGrid.h>
+#include <nerian_stereo/ObstacleBoxArray.h>
+#include <nerian_stereo/ClockSyncStatus.h>
 #include <visiontransfer/deviceparameters.h>
 #include <visiontransfer/parameterset.h>
 #include <visiontransfer/exceptions.h>
@@ -72,12 +108,20 @@ namespace nerian_stereo {
 
 class StereoNodeBase {
 public:
-    StereoNodeBase(): initialConfigReceived(false), frameNum(0) {
+    StereoNodeBase(): initialConfigReceived(false), frameNum(0), qCacheValid(false),
+        unchangedFrames(0), relayClients(0), relayDroppedFrames(0), processingSchedulingApplied(false),
+        parameterRetryPending(false), parameterRetryDelay(0.1) {
     }
 
     ~StereoNodeBase() {
     }
 
+    /**
+     * \brief Performs the complete startup sequence. The image stream is connected
+     * first; the data channel and parameter handshakes are then run concurrently.
+     */
+    void startup();
+
     /**
      * \brief Performs general initializations
      */
@@ -103,6 +147,12 @@ public:
      */
     void processOneImageSet();
 
+    /**
+     * \brief Applies the processing thread scheduling to the calling thread,
+     * which must be the thread that calls processOneImageSet()
+     */
+    void applyProcessingScheduling();
+
     /*
      * \brief Queries the the supplemental data channels (IMU ...) for new data and updates ROS accordingly
      */
@@ -114,15 +164,10 @@ public:
     void publishTransform();
 
 private:
-    enum PointCloudColorMode {
-        RGB_SEPARATE,
-        RGB_COMBINED,
-        INTENSITY,
-        NONE
-    };
-
     virtual ros::NodeHandle& getNH() = 0;
     virtual ros::NodeHandle& getPrivateNH() = 0;
+    // Nodelets share their process with the nodelet manager
+    virtual bool isNodelet() const { return false; }
 
     //
     boost::scoped_ptr<ros::Publisher> cloudPublisher;
@@ -131,6 +176,16 @@ private:
     boost::scoped_ptr<ros::Publisher> rightImagePublisher;
     boost::scoped_ptr<ros::Publisher> thirdImagePublisher;
     boost::scoped_ptr<ros::Publisher> cameraInfoPublisher;
+    boost::scoped_ptr<ros::Publisher> leftCameraInfoPublisher;
+    boost::scoped_ptr<ros::Publisher> rightCameraInfoPublisher;
+    boost::scoped_ptr<ros::Publisher> clockSyncPublisher;
+    boost::scoped_ptr<ros::Publisher> shmFramePublisher;
+    boost::scoped_ptr<ros::Publisher> normalsPublisher;
+    boost::scoped_ptr<ros::Publisher> occupancyGridPublisher;
+    boost::scoped_ptr<ros::Publisher> elevationGridPublisher;
+    boost::scoped_ptr<ros::Publisher> disparityImagePublisher;
+    boost::scoped_ptr<ros::Publisher> fusedMapPublisher;
+    boost::scoped_ptr<ros::Publisher> obstacleBoxesPublisher;
 
     boost::scoped_ptr<tf2_ros::TransformBroadcaster> transformBroadcaster;
 
@@ -138,9 +193,12 @@ private:
     boost::scoped_ptr<dynamic_reconfigure::Server<nerian_stereo::NerianStereoConfig>> dynReconfServer;
     nerian_stereo::NerianStereoConfig lastKnownConfig;
     bool initialConfigReceived;
+    std::mutex configMutex;
     
     // Connection to parameter server on device
     boost::scoped_ptr<DeviceParameters> deviceParameters;
+    // Background writer for parameter changes (must be destroyed before deviceParameters)
+    boost::scoped_ptr<ParameterWorker> parameterWorker;
 
     // Parameters
     bool useTcp;
@@ -154,10 +212,78 @@ private:
     bool publishInternalFrame; // publish private frame and publish pointcloud to private frame
     std::string remoteHost;
     std::string calibFile;
+    std::string calibCacheFile;
+    std::string parameterCacheFile;
     double execDelay;
     double maxDepth;
     bool useQFromCalibFile;
     PointCloudColorMode pointCloudColorMode;
+    bool clockSyncEnabled;
+    double clockSyncWindow;
+    double clockSyncLatency;
+    std::string shmName;
+    int shmSlots;
+    bool shmPointCloud;
+    int normalRadius;
+    double normalMaxDepthChange;
+    double gridResolution;
+    double gridLength;
+    double gridWidth;
+    double gridCameraHeight;
+    double gridMinHeight;
+    double gridMaxHeight;
+    double gridObstacleHeight;
+    int gridMinPoints;
+    std::string gravityFrame;
+    std::string scanBands;
+    std::string scanFrame;
+    double scanMinHeight;
+    double scanMaxHeight;
+    double scanRangeMax;
+    int disparitySpeckleSize;
+    double disparitySpeckleRange;
+    int disparityHoleSize;
+    double disparityHoleRange;
+    bool disparityTemporalMedian;
+    bool changeGating;
+    double changeImageThreshold;
+    double changeDisparityThreshold;
+    double changeHeartbeatRate;
+    int relayPort;
+    int relayPortCount;
+    std::string relayAddress;
+    bool relayUseTcp;
+    std::string hostMatching;
+    int hostMatchingDisparities;
+    int hostMatchingBlockSize;
+    int hostMatchingUniqueness;
+    bool lowLatencyCloud;
+    int imagePyramidLevels;
+    bool imagePyramidMono8;
+    std::string toneMapping;
+    double toneMappingGamma;
+    std::string receiveThreadPolicy;
+    int receiveThreadPriority;
+    std::string processingThreadPolicy;
+    int processingThreadPriority;
+    std::string processingThreadCpus;
+    bool lockMemory;
+    bool hugePages;
+    double fusedMapRate;
+    double fusedMapResolution;
+    double fusedMapRadius;
+    int fusedMapMaxVoxels;
+    int fusedMapMinObservations;
+    double fusedMapMaxAge;
+    int fusedMapStep;
+    std::string fusedMapFrame;
+    bool obstacleClusters;
+    double obstacleGroundBand;
+    double obstacleMaxHeight;
+    double obstacleMaxRange;
+    double obstacleDisparityTolerance;
+    int obstacleMinPixels;
+    int obstacleStep;
 
     // Other members
     int frameNum;
@@ -165,27 +291,204 @@ private:
     boost::scoped_ptr<ColorCoder> colCoder;
     cv::Mat_<cv::Vec3b> colDispMap;
     sensor_msgs::PointCloud2Ptr pointCloudMsg;
-    cv::FileStorage calibStorage;
+    StereoCalibration calibration;
     nerian_stereo::StereoCameraInfoPtr camInfoMsg;
     ros::Time lastCamInfoPublish;
 
+    // Q matrix from the calibration file, and cached transformed Q matrix
+    // (recomputed only if its source changes)
+    float calibQ[16];
+    float qSource[16];
+    float qCached[16];
+    bool qCacheValid;
+
     // Active channels in the previous ImageSet
     bool hadLeft, hadRight, hadColor, hadDisparity;
 
+    // Row-wise reconstruction during reception; called from the receive
+    // thread of asyncTransfer, hence it must be destroyed afterwards
+    boost::scoped_ptr<PointCloudStreamer> cloudStreamer;
+
     boost::scoped_ptr<AsyncTransfer> asyncTransfer;
     ros::Time lastLogTime;
     int lastLogFrames = 0;
 
+    // Link monitoring and reconnection
+    double reconnectTimeout;
+    double reconnectMaxDelay;
+    double reconnectDelay;
+    bool linkLost;
+    bool awaitingReconnectFrame;
+    ros::WallTime lastImageSetTime;
+    ros::WallTime nextReconnectAttempt;
+    std::future<std::unique_ptr<AsyncTransfer>> reconnectAttempt;
+    bool haveSequenceNumber;
+    unsigned int lastSequenceNumber;
+    int skippedFrames;
+
+    // UDP receive tuning and packet loss statistics
+    ImageTransfer::ReceiveOptions receiveOptions;
+    ImageTransfer::ReceptionStatistics lastReceptionStats;
+    int lostSegments;
+    int resendRequests;
+
     // DataChannelService connection, to obtain IMU data
     boost::scoped_ptr<DataChannelService> dataChannelService;
     // Our transform, updated with polled IMU data (if available)
     geometry_msgs::TransformStamped currentTransform;
+    ros::Time lastTransformUpdate;
+    // Stamp of the last published gravity-aligned frame
+    ros::Time lastGravityFrameStamp;
+
+    // Estimator for the device-to-host clock offset and drift
+    boost::scoped_ptr<ClockSync> clockSync;
+
+    // Shared memory output for same-host consumers
+    boost::scoped_ptr<ShmRingWriter> shmWriter;
+    std::vector<ShmBuffer> shmBuffers;
+
+    // Surface normals on the organized point cloud
+    boost::scoped_ptr<NormalEstimator> normalEstimator;
+    sensor_msgs::PointCloud2Ptr normalsMsg;
+
+    // Post-filters applied to received disparity maps
+    boost::scoped_ptr<DisparityFilter> disparityFilter;
+
+    // Detection of static scenes, for which frames are only published at
+    // the heartbeat rate
+    boost::scoped_ptr<ChangeDetector> changeDetector;
+    ros::Time lastPublishStamp;
+    int unchangedFrames;
+
+    // Re-serves the received image sets to downstream clients
+    boost::scoped_ptr<RelayServer> relayServer;
+    int relayClients;
+    int relayDroppedFrames;
+
+    // Floating point disparity maps; messages are reused once they are no
+    // longer referenced by any subscriber
+    DisparityConverter disparityConverter;
+    std::vector<stereo_msgs::DisparityImagePtr> disparityImagePool;
+
+    // Mapping of 12-bit images to mono8
+    boost::scoped_ptr<ToneMapper> toneMapper;
+    std::vector<sensor_msgs::ImagePtr> toneMappedPool;
+
+    // Scheduling of the thread that calls processOneImageSet()
+    boost::scoped_ptr<ThreadScheduling> processingScheduling;
+    bool processingSchedulingApplied;
+
+    // Transparent huge pages for image and point cloud buffers
+    boost::scoped_ptr<HugePageAdvisor> hugePageAdvisor;
+    int reportedHugePageFailures;
+
+    // Disparity computation on the host, if not performed by the device
+    boost::scoped_ptr<HostMatcher> hostMatcher;
+
+    // Gravity-aligned elevation and occupancy grid
+    boost::scoped_ptr<ElevationGridBuilder> elevationGrid;
+
+    // Multi-frame voxel map, with frame poses from tf if a map frame is set
+    boost::scoped_ptr<VoxelMap> voxelMap;
+    boost::scoped_ptr<tf2_ros::Buffer> tfBuffer;
+    boost::scoped_ptr<tf2_ros::TransformListener> tfListener;
+    ros::Time lastFusedMapStamp;
+
+    // Obstacle segmentation in the disparity map
+    boost::scoped_ptr<ObstacleClusterer> obstacleClusterer;
+
+    // Virtual laser scans from bands of disparity map rows
+    struct LaserScanOutput {
+        std::string topic;
+        ros::Publisher publisher;
+        boost::shared_ptr<LaserScanGenerator> generator;
+    };
+    std::vector<LaserScanOutput> laserScans;
+
+    // Downscaled image outputs; element i is scaled by 1/2^(i+1)
+    std::vector<ros::Publisher> leftPyramidPublishers;
+    std::vector<ros::Publisher> rightPyramidPublishers;
+    std::vector<ros::Publisher> colorPyramidPublishers;
+
+    // Background device handshake when starting from cached parameters or
+    // after a reconnect; failed handshakes are retried with backoff
+    std::future<bool> parameterHandshake;
+    param::ParameterSet handshakeParams;
+    bool parameterRetryPending;
+    double parameterRetryDelay;
+    ros::WallTime nextParameterAttempt;
 
     /**
      * \brief Loads a camera calibration file if configured
      */
     void loadCameraCalibration();
 
+    /**
+     * \brief Collects a received image set, while monitoring the link for timeouts,
+     * errors and device restarts
+     */
+    bool receiveImageSet(ImageSet& imageSet);
+
+    /**
+     * \brief Performs the startup configuration of memory locking and
+     * thread scheduling
+     */
+    void initRealtime();
+
+    /**
+     * \brief Logs the effective receive settings and warns if the OS did not grant them
+     */
+    void reportReceiveTuning(const ImageTransfer::ReceptionStatistics& stats);
+
+    /**
+     * \brief Marks the image stream as lost, such that reconnection attempts are started
+     */
+    void handleLinkLoss();
+
+    /**
+     * \brief Advances an ongoing reconnect without blocking; returns true once a new
+     * image stream connection is available
+     */
+    bool pollReconnect();
+
+    /**
+     * \brief Re-establishes the data channel and parameter connections after a reconnect
+     */
+    void reconnectServices();
+
+    /**
+     * \brief Starts the background parameter handshake; see refreshDeviceParameters()
+     */
+    void startParameterHandshake(const param::ParameterSet& previousParams);
+
+    /**
+     * \brief Schedules another attempt if the background parameter handshake
+     * has failed, and starts it once it is due
+     */
+    void pollParameterHandshake();
+
+    /**
+     * \brief Determines the ROS time stamp for a received image set
+     */
+    ros::Time getImageSetStamp(const ImageSet& imageSet);
+
+    /**
+     * \brief Converts a device timestamp to host time, using the clock synchronization
+     * estimate if available
+     */
+    ros::Time deviceToHostTime(int secs, int microsecs, ros::Time fallback);
+
+    /**
+     * \brief Publishes the current clock synchronization statistics
+     */
+    void publishClockSyncStatus(ros::Time stamp);
+
+    /**
+     * \brief Logs the frame rate and transfer statistics and publishes the
+     * clock synchronization status, once per second
+     */
+    void logStatistics(ros::Time stamp);
+
     /**
      * \brief Publishes the disparity map as 16-bit grayscale image or color coded
      * RGB image
@@ -194,27 +497,145 @@ private:
             ros::Publisher* publisher);
 
     /**
-     * \brief Transform Q matrix to match the ROS coordinate system:
-     * Swap y/z axis, then swap x/y axis, then invert y and z axis.
+     * \brief Publishes a 12-bit image as mono8 image through the tone mapper
+     */
+    void publishToneMappedMsg(const ImageSet& imageSet, int imageIndex, ros::Time stamp,
+            ros::Publisher* publisher);
+
+    /**
+     * \brief Publishes the disparity map as stereo_msgs/DisparityImage with
+     * floating point disparities
+     */
+    void publishDisparityImageMsg(const ImageSet& imageSet, ros::Time stamp);
+
+    /**
+     * \brief Creates the publishers for the downscaled image outputs
+     */
+    void initImagePyramid();
+
+    /**
+     * \brief Publishes downscaled versions of an image, down to the smallest
+     * pyramid level that has subscribers
+     */
+    void publishPyramidMsgs(const ImageSet& imageSet, int imageIndex, ros::Time stamp,
+            std::vector<ros::Publisher>& publishers);
+
+    /**
+     * \brief Returns the Q matrix to be used for the given image set, transformed to
+     * the ROS coordinate system if desired
      */
-    void qMatrixToRosCoords(const float* src, float* dst);
+    const float* getEffectiveQMatrix(const ImageSet& imageSet);
 
     /**
      * \brief Reconstructs the 3D locations form the disparity map and publishes them
-     * as point cloud.
+     * as point cloud if there are subscribers. Returns true if pointCloudMsg was updated.
+     */
+    bool publishPointCloudMsg(ImageSet& imageSet, ros::Time stamp);
+
+    /**
+     * \brief Writes the images and (optionally) the point cloud of an image set
+     * into the shared memory ring
+     */
+    void writeSharedMemory(const ImageSet& imageSet, ros::Time stamp, bool withPointCloud);
+
+    /**
+     * \brief Estimates the surface normals for the current point cloud and
+     * publishes them together with the point coordinates
+     */
+    void publishNormalsMsg(ros::Time stamp);
+
+    /**
+     * \brief Initializes the normal estimation and the fields of the normals
+     * message
+     */
+    void initNormals();
+
+    /**
+     * \brief Bins the current point cloud into the gravity-aligned elevation
+     * grid and publishes it as occupancy grid and/or elevation grid
+     */
+    void publishGridMsgs(ros::Time stamp);
+
+    /**
+     * \brief Adds the current point cloud to the fused voxel map, and
+     * publishes the map if due
+     */
+    void updateFusedMap(ros::Time stamp);
+
+    /**
+     * \brief Returns the rotation from point cloud coordinates into a frame
+     * with x pointing forward, y to the left and z up, using the full IMU
+     * orientation if available
+     */
+    tf2::Matrix3x3 getImuRotation();
+
+    /**
+     * \brief Returns the rotation from point cloud coordinates into the
+     * gravity-aligned frame, which only compensates roll and pitch and thus
+     * follows the heading of the camera
+     */
+    tf2::Matrix3x3 getGravityRotation();
+
+    /**
+     * \brief Returns the rotation from camera axes (x right, y down, z
+     * forward) into ROS axes (x forward, y left, z up)
+     */
+    static tf2::Matrix3x3 getCameraToRosRotation();
+
+    /**
+     * \brief Publishes the transform from the point cloud frame to the
+     * gravity-aligned frame, once per time stamp
+     */
+    void publishGravityFrame(const tf2::Matrix3x3& rot, ros::Time stamp);
+
+    /**
+     * \brief Publishes a child frame of the point cloud frame, such that
+     * rot transforms point cloud coordinates into the child frame
+     */
+    void publishRotatedFrame(const std::string& childFrame, const tf2::Matrix3x3& rot,
+        ros::Time stamp);
+
+    /**
+     * \brief Converts a rotation matrix to a row-major float array
+     */
+    static void getRotationArray(const tf2::Matrix3x3& rot, float* rotation);
+
+    /**
+     * \brief Creates a laser scan generator and publisher for each band
+     * configured in scanBands
+     */
+    void initLaserScans();
+
+    /**
+     * \brief Computes and publishes the laser scans that have subscribers
+     * directly from the disparity map
+     */
+    void publishLaserScans(const ImageSet& imageSet, ros::Time stamp);
+
+    /**
+     * \brief Segments obstacles in the disparity map and publishes their
+     * bounding boxes in the gravity-aligned frame
+     */
+    void publishObstacleBoxes(const ImageSet& imageSet, ros::Time stamp);
+
+    /**
+     * \brief Forwards the unmodified image set to the relay clients and
+     * reports changes of the relay state
      */
-    void publishPointCloudMsg(ImageSet& imageSet, ros::Time stamp);
+    void relayImageSet(const ImageSet& imageSet);
 
     /**
-     * \brief Copies the intensity or RGB data to the point cloud
+     * \brief Forwards partially received image sets to the point cloud
+     * streamer, if low-latency reconstruction is enabled
      */
-    template <PointCloudColorMode colorMode> void copyPointCloudIntensity(ImageSet& imageSet);
+    void initPartialReception();
 
     /**
-     * \brief Copies all points in a point cloud that have a depth smaller
-     * than maxDepth. Other points are set to NaN.
+     * \brief Partial reception callback of AsyncTransfer, with the point
+     * cloud streamer as user data
      */
-    template <int coord> void copyPointCloudClamped(float* src, float* dst, int size);
+    static void partialReceiveCallback(const ImageSet& imageSet, int validRows, bool complete,
+        void* userData);
 
     /**
      * \brief Performs all neccessary initializations for point cloud+
@@ -222,15 +643,41 @@ private:
      */
     void initPointCloud();
 
+    /**
+     * \brief Fills the cached camera info messages from the calibration file
+     */
+    void initCameraInfo();
+
     /**
      * \brief Publishes the camera info once per second
      */
     void publishCameraInfo(ros::Time stamp, const ImageSet& imageSet);
 
     /**
-     * \brief Reads a vector from the calibration file to a boost:array
+     * \brief Publishes a copy of the cached per-camera info with the stamp of the
+     * matching image
+     */
+    void publishCameraInfoMsg(const sensor_msgs::CameraInfo& info, ros::Time stamp,
+            ros::Publisher* publisher);
+
+    /**
+     * \brief Connects to the parameter service of the device and obtains all parameters
      */
-    template<class T> void readCalibrationArray(const char* key, T& dest);
+    param::ParameterSet connectDeviceParameters();
+
+    /**
+     * \brief Publishes the given parameters to the parameter server and starts the
+     * dynamic_reconfigure server
+     */
+    void publishDeviceParameters(param::ParameterSet& params);
+
+    /**
+     * \brief Performs the device handshake in the background (after starting from
+     * cached parameters or after a reconnect), and updates ROS if the device reports
+     * values that differ from the given previous parameters. Returns false if the
+     * handshake failed.
+     */
+    bool refreshDeviceParameters(param::ParameterSet previousParams);
 
     /*
      * \brief Callback that receives an updated configuration from ROS; internally uses autogen_dynamicReconfigureCallback
@@ -251,13 +698,18 @@ private:
     // The following three implementations are autogenerated by generate_nerian_config_cpp.py
     //  by parsing cfg/NerianStereo.cfg (which is also used by dynamic_reconfigure)
     /**
-     * \brief Auto-generated code to check for parameter changes and forward them to the device
+     * \brief Auto-generated code to collect all parameter changes into a batch for the device
      */
-    void autogen_dynamicReconfigureCallback(nerian_stereo::NerianStereoConfig &config, uint32_t level);
+    void autogen_dynamicReconfigureCallback(nerian_stereo::NerianStereoConfig &config, uint32_t level,
+        ParameterBatch& batch);
     /**
      * \brief Auto-generated code to set initial parameters according to those obtained from the device
      */
     void autogen_updateParameterServerFromDevice(param::ParameterSet& cfg);
+    /**
+     * \brief Auto-generated code to copy the current parameters from the device into a configuration
+     */
+    void autogen_updateConfigFromDevice(param::ParameterSet& cfg, nerian_stereo::NerianStereoConfig& config);
     /**
      * \brief Auto-generated code to override the dynamic_reconfigure limits and defaults for all parameters
      */
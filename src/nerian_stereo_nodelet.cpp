@@ -17,23 +17,30 @@
 
 namespace nerian_stereo {
 
-void StereoNodelet::stereoIteration(const ros::TimerEvent&) {
-    processOneImageSet();
-    processDataChannels();
+StereoNodelet::~StereoNodelet() {
+    stopProcessing = true;
+    if(processingThread.joinable()) {
+        processingThread.join();
+    }
 }
 
-void StereoNodelet::onInit() {
-    StereoNodeBase::init();
-    StereoNodeBase::initDataChannelService();
+void StereoNodelet::processingLoop() {
     try {
-        StereoNodeBase::initDynamicReconfigure();
-    } catch(...) {
-        ROS_ERROR("Handshake with parameter server failed; no dynamic parameters - please verify firmware version. Image transport is unaffected.");
+        applyProcessingScheduling();
+        while(!stopProcessing && ros::ok()) {
+            // Blocks briefly while waiting for an image set
+            processOneImageSet();
+            processDataChannels();
+            ros::WallDuration(0.0005).sleep();
+        }
+    } catch(const std::exception& ex) {
+        ROS_FATAL("Exception occured: %s", ex.what());
     }
-    StereoNodeBase::publishTransform(); // initial transform
-    prepareAsyncTransfer();
-    // 2kHz timer for lower latency (stereoIteration will then block)
-    timer = getNH().createTimer(ros::Duration(0.0005), &StereoNodelet::stereoIteration, this);
+}
+
+void StereoNodelet::onInit() {
+    StereoNodeBase::startup();
+    processingThread = std::thread(&StereoNodelet::processingLoop, this);
 }
 
 } // namespace
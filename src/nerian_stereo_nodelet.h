@@ -12,6 +12,8 @@
  * all copies or substantial portions of the Software.
  *******************************************************************************/
 
+#include <atomic>
+#include <thread>
 #include <nodelet/nodelet.h>
 #include "nerian_stereo_node_base.h"
 
@@ -19,19 +21,29 @@ namespace nerian_stereo {
 
 class StereoNodelet: public StereoNodeBase, public nodelet::Nodelet {
 public:
+    StereoNodelet(): stopProcessing(false) { }
+
+    ~StereoNodelet();
+
     /**
-     * \brief Callback for the ros::Timer that replaces a processing loop in Nodelets; wraps processOneImageSet()
+     * \brief Processing loop of the nodelet's own thread; wraps processOneImageSet()
      */
-    void stereoIteration(const ros::TimerEvent&);
+    void processingLoop();
     /**
-     * \brief Nodelet initialization: performs ROS parameter/dynamic_reconfigure init, connects to image service, starts main iteration Timer
+     * \brief Nodelet initialization: connects to image service, performs ROS parameter/dynamic_reconfigure init, starts the processing thread
      */
     virtual void onInit();
 private:
     // The nodelet does not initialize its own node handles
     inline ros::NodeHandle& getNH() override { return nodelet::Nodelet::getNodeHandle(); }
     inline ros::NodeHandle& getPrivateNH() override { return nodelet::Nodelet::getPrivateNodeHandle(); }
-    ros::Timer timer;
+    inline bool isNodelet() const override { return true; }
+
+    // Processing runs on a thread of its own rather than on the shared
+    // threads of the nodelet manager, such that the processing thread
+    // scheduling does not affect other nodelets
+    std::thread processingThread;
+    std::atomic<bool> stopProcessing;
 };
 
 } // namespace
@@ -0,0 +1,162 @@
+/*******************************************************************************
+ * Copyright (c) 2022 Nerian Vision GmbH
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *******************************************************************************/
+
+#include "normal_estimation.h"
+
+#include <cmath>
+#include <limits>
+#include <opencv2/opencv.hpp>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace nerian_stereo {
+
+class NormalRowBody: public cv::ParallelLoopBody {
+public:
+    NormalRowBody(const NormalEstimator& estimator, const float* points, int pointStride,
+        int width, int height, float* normals, int normalStride)
+        : estimator(estimator), points(points), pointStride(pointStride), width(width),
+        height(height), normals(normals), normalStride(normalStride) {
+    }
+
+    virtual void operator()(const cv::Range& range) const {
+        for(int y = range.start; y < range.end; y++) {
+            estimator.computeRow(points, pointStride, width, height, normals, normalStride, y);
+        }
+    }
+
+private:
+    const NormalEstimator& estimator;
+    const float* points;
+    int pointStride;
+    int width;
+    int height;
+    float* normals;
+    int normalStride;
+};
+
+namespace {
+
+inline bool isValidPoint(const float* p) {
+    // NaN or infinite coordinates propagate into the sum
+    return std::fabs(p[0] + p[1] + p[2]) < std::numeric_limits<float>::infinity();
+}
+
+inline float squaredNorm(const float* a, const float* b) {
+    float dx = a[0] - b[0], dy = a[1] - b[1], dz = a[2] - b[2];
+    return dx*dx + dy*dy + dz*dz;
+}
+
+inline void setInvalid(float* n) {
+    n[0] = n[1] = n[2] = std::numeric_limits<float>::quiet_NaN();
+}
+
+} // namespace
+
+NormalEstimator::NormalEstimator(int radius, float maxDepthChange)
+    : radius(radius < 1 ? 1 : radius), maxDepthChange(maxDepthChange) {
+}
+
+void NormalEstimator::compute(const float* points, int pointStride, int width, int height,
+        float* normals, int normalStride) const {
+    cv::parallel_for_(cv::Range(0, height), NormalRowBody(*this, points, pointStride,
+        width, height, normals, normalStride));
+}
+
+void NormalEstimator::computeRow(const float* points, int pointStride, int width, int height,
+        float* normals, int normalStride, int y) const {
+    float* outRow = normals + static_cast<size_t>(y) * width * normalStride;
+    if(y < radius || y >= height - radius) {
+        for(int x = 0; x < width; x++) {
+            setInvalid(outRow + x * normalStride);
+        }
+        return;
+    }
+
+    const size_t rowStride = static_cast<size_t>(width) * pointStride;
+    const float* row = points + y * rowStride;
+    const float* rowAbove = row - radius * rowStride;
+    const float* rowBelow = row + radius * rowStride;
+    const int xOffset = radius * pointStride;
+
+    // Neighbor distance threshold relative to the squared point distance
+    const float maxRatio = maxDepthChange * 2 * radius;
+    const float maxRatioSq = maxRatio * maxRatio;
+
+    for(int x = 0; x < width; x++) {
+        float* n = outRow + x * normalStride;
+        if(x < radius || x >= width - radius) {
+            setInvalid(n);
+            continue;
+        }
+
+        const float* p = row + x * pointStride;
+        const float* left = p - xOffset;
+        const float* right = p + xOffset;
+        const float* up = rowAbove + x * pointStride;
+        const float* down = rowBelow + x * pointStride;
+
+        if(!isValidPoint(p) || !isValidPoint(left) || !isValidPoint(right)
+                || !isValidPoint(up) || !isValidPoint(down)) {
+            setInvalid(n);
+            continue;
+        }
+
+        // Reject neighbors across depth discontinuities
+        float limit = maxRatioSq * (p[0]*p[0] + p[1]*p[1] + p[2]*p[2]);
+        if(squaredNorm(right, left) > limit || squaredNorm(down, up) > limit) {
+            setInvalid(n);
+            continue;
+        }
+
+#ifdef __SSE2__
+        // Cross product of the two tangent vectors
+        __m128 a = _mm_sub_ps(_mm_loadu_ps(right), _mm_loadu_ps(left));
+        __m128 b = _mm_sub_ps(_mm_loadu_ps(down), _mm_loadu_ps(up));
+        __m128 aYZX = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+        __m128 bYZX = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+        __m128 c = _mm_sub_ps(_mm_mul_ps(a, bYZX), _mm_mul_ps(aYZX, b));
+        c = _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+
+        float cross[4];
+        _mm_storeu_ps(cross, c);
+        float nx = cross[0], ny = cross[1], nz = cross[2];
+#else
+        float ax = right[0] - left[0], ay = right[1] - left[1], az = right[2] - left[2];
+        float bx = down[0] - up[0], by = down[1] - up[1], bz = down[2] - up[2];
+        float nx = ay*bz - az*by;
+        float ny = az*bx - ax*bz;
+        float nz = ax*by - ay*bx;
+#endif
+
+        float lengthSq = nx*nx + ny*ny + nz*nz;
+        if(!(lengthSq > 0.0f)) {
+            setInvalid(n);
+            continue;
+        }
+
+        // Normalize and orient towards the camera at the origin
+        float scale = 1.0f / std::sqrt(lengthSq);
+        if(nx*p[0] + ny*p[1] + nz*p[2] > 0.0f) {
+            scale = -scale;
+        }
+        n[0] = nx * scale;
+        n[1] = ny * scale;
+        n[2] = nz * scale;
+    }
+}
+
+} // namespace
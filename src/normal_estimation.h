@@ -0,0 +1,69 @@
+/*******************************************************************************
+ * Copyright (c) 2022 Nerian Vision GmbH
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *******************************************************************************/
+
+#ifndef __NERIAN_STEREO_NORMAL_ESTIMATION_H__
+#define __NERIAN_STEREO_NORMAL_ESTIMATION_H__
+
+namespace nerian_stereo {
+
+/**
+ * \brief Estimates surface normals on an organized point cloud.
+ *
+ * Instead of searching for nearest neighbors, the normal of each point is
+ * computed as the cross product of the horizontal and vertical central
+ * differences on the image grid. Neighbors are taken at the given pixel
+ * radius. No normal is computed if a neighbor is invalid or lies across a
+ * depth discontinuity, i.e. if the neighbor distance exceeds
+ * maxDepthChange times the distance of the point from the camera (per
+ * pixel of radius). Normals are oriented towards the camera.
+ *
+ * Rows are processed in parallel.
+ */
+class NormalEstimator {
+public:
+    /**
+     * \brief Creates a new estimator
+     *
+     * \param radius Distance of the neighbors in pixels
+     * \param maxDepthChange Maximum relative distance change between neighboring pixels
+     */
+    NormalEstimator(int radius = 2, float maxDepthChange = 0.05f);
+
+    /**
+     * \brief Computes the normals for a point map
+     *
+     * \param points Organized point map with x, y, z at the beginning of each point
+     * \param pointStride Distance between two points in floats (at least 4)
+     * \param width Width of the point map
+     * \param height Height of the point map
+     * \param normals Output for the normal x, y, z components. Set to NaN for
+     *        points without a normal.
+     * \param normalStride Distance between two output normals in floats
+     */
+    void compute(const float* points, int pointStride, int width, int height,
+        float* normals, int normalStride) const;
+
+private:
+    int radius;
+    float maxDepthChange;
+
+    void computeRow(const float* points, int pointStride, int width, int height,
+        float* normals, int normalStride, int y) const;
+
+    friend class NormalRowBody;
+};
+
+} // namespace
+
+#endif
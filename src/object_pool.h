@@ -0,0 +1,43 @@
+/*******************************************************************************
+ * Copyright (c) 2022 Nerian Vision GmbH
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *******************************************************************************/
+
+#ifndef __NERIAN_STEREO_OBJECT_POOL_H__
+#define __NERIAN_STEREO_OBJECT_POOL_H__
+
+#include <vector>
+
+namespace nerian_stereo {
+
+/**
+ * \brief Returns an object from the pool that is no longer referenced
+ * elsewhere, or adds a new one if all objects are still in use.
+ *
+ * Works with std::shared_ptr and boost::shared_ptr. Reused objects keep
+ * their previous contents and allocations.
+ */
+template <class Ptr>
+Ptr takeFromPool(std::vector<Ptr>& pool) {
+    for(const Ptr& candidate: pool) {
+        if(candidate.use_count() == 1) {
+            return candidate;
+        }
+    }
+    Ptr object(new typename Ptr::element_type);
+    pool.push_back(object);
+    return object;
+}
+
+} // namespace
+
+#endif
@@ -0,0 +1,248 @@
+/*******************************************************************************
+ * Copyright (c) 2022 Nerian Vision GmbH
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *******************************************************************************/
+
+#include "obstacle_clusters.h"
+
+#include <cmath>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <opencv2/opencv.hpp>
+
+namespace nerian_stereo {
+
+class ObstacleBandBody: public cv::ParallelLoopBody {
+public:
+    ObstacleBandBody(ObstacleClusterer& clusterer)
+        : clusterer(clusterer) {
+    }
+
+    virtual void operator()(const cv::Range& range) const {
+        for(int band = range.start; band < range.end; band++) {
+            clusterer.processBand(band);
+        }
+    }
+
+private:
+    ObstacleClusterer& clusterer;
+};
+
+namespace {
+
+// Sums of a cluster during collection
+struct ClusterSums {
+    double sum[3];
+    float minCorner[3];
+    float maxCorner[3];
+    int numPixels;
+    int minX, minY, maxX, maxY;
+};
+
+inline float horizontalDistanceSq(const ObstacleClusterer::Cluster& cluster) {
+    return cluster.centroid[0]*cluster.centroid[0] + cluster.centroid[1]*cluster.centroid[1];
+}
+
+} // namespace
+
+ObstacleClusterer::ObstacleClusterer(double cameraHeight, double groundBand, double maxHeight,
+        double maxRange, double disparityTolerance, int minPixels, int step)
+    : cameraHeight(cameraHeight), groundBand(groundBand), maxHeight(maxHeight), maxRange(maxRange),
+    disparityTolerance(disparityTolerance), minPixels(std::max(minPixels, 1)), step(std::max(step, 1)),
+    dispMap(nullptr), rowStride(0), gridWidth(0), gridHeight(0), dispTolerance(0), dispScale(1.0f) {
+    // Identity until the orientation is known
+    memset(rotation, 0, sizeof(rotation));
+    rotation[0] = rotation[4] = rotation[8] = 1.0f;
+    memset(transform, 0, sizeof(transform));
+}
+
+void ObstacleClusterer::setRotation(const float* rotation) {
+    memcpy(this->rotation, rotation, sizeof(this->rotation));
+}
+
+void ObstacleClusterer::compute(const unsigned short* dispMap, int width, int height, int rowStride,
+        const float* q, int subpixelFactor) {
+    this->dispMap = dispMap;
+    this->rowStride = rowStride;
+    gridWidth = (width + step - 1) / step;
+    gridHeight = (height + step - 1) / step;
+    dispTolerance = std::max(0, static_cast<int>(std::round(disparityTolerance * subpixelFactor)));
+    dispScale = 1.0f / subpixelFactor;
+
+    // Reconstruction and rotation into the gravity-aligned frame in one step
+    for(int i = 0; i < 3; i++) {
+        for(int j = 0; j < 4; j++) {
+            transform[4*i + j] = rotation[3*i]*q[j] + rotation[3*i + 1]*q[4 + j] + rotation[3*i + 2]*q[8 + j];
+        }
+    }
+    memcpy(&transform[12], &q[12], 4*sizeof(float));
+
+    size_t numCells = static_cast<size_t>(gridWidth) * gridHeight;
+    parent.resize(numCells);
+    cellDisparities.resize(numCells);
+    cellPoints.resize(3 * numCells);
+
+    // Bands are labeled independently and then joined at their borders
+    int numBands = (gridHeight + BAND_ROWS - 1) / BAND_ROWS;
+    cv::parallel_for_(cv::Range(0, numBands), ObstacleBandBody(*this));
+    for(int band = 1; band < numBands; band++) {
+        uniteRows(band * BAND_ROWS);
+    }
+
+    collectClusters();
+
+    // The last subsampled column or row may extend beyond the image
+    for(Cluster& cluster: clusters) {
+        cluster.imageWidth = std::min(cluster.imageWidth, width - cluster.imageX);
+        cluster.imageHeight = std::min(cluster.imageHeight, height - cluster.imageY);
+    }
+}
+
+void ObstacleClusterer::processBand(int band) {
+    int firstRow = band * BAND_ROWS;
+    int lastRow = std::min(gridHeight, firstRow + BAND_ROWS);
+    const float* t = transform;
+    const float minH = groundBand - cameraHeight, maxH = maxHeight - cameraHeight;
+    const float maxRangeSq = maxRange * maxRange;
+
+    for(int gy = firstRow; gy < lastRow; gy++) {
+        int y = gy * step;
+        const unsigned short* dispRow = reinterpret_cast<const unsigned short*>(
+            reinterpret_cast<const unsigned char*>(dispMap) + y*rowStride);
+        const float tx = t[1]*y + t[3];
+        const float ty = t[5]*y + t[7];
+        const float tz = t[9]*y + t[11];
+        const float tw = t[13]*y + t[15];
+
+        int rowStart = gy * gridWidth;
+        uint16_t* disparities = &cellDisparities[rowStart];
+        float* points = &cellPoints[3 * static_cast<size_t>(rowStart)];
+
+        for(int gx = 0; gx < gridWidth; gx++) {
+            int x = gx * step;
+            parent[rowStart + gx] = rowStart + gx;
+            disparities[gx] = 0;
+
+            unsigned short intDisp = dispRow[x];
+            if(intDisp == 0 || intDisp >= 0xFFF) {
+                continue;
+            }
+
+            float d = intDisp * dispScale;
+            float invW = 1.0f / (tw + t[12]*x + t[14]*d);
+            float px = (tx + t[0]*x + t[2]*d) * invW;
+            float py = (ty + t[4]*x + t[6]*d) * invW;
+            float pz = (tz + t[8]*x + t[10]*d) * invW;
+
+            // Remove the ground band, points above the height limit, and
+            // points behind the camera or out of range
+            if(!(pz >= minH && pz <= maxH && px > 0.0f && px*px + py*py <= maxRangeSq)) {
+                continue;
+            }
+
+            disparities[gx] = intDisp;
+            points[3*gx] = px;
+            points[3*gx + 1] = py;
+            points[3*gx + 2] = pz;
+        }
+
+        // Connect to the left neighbor
+        for(int gx = 1; gx < gridWidth; gx++) {
+            if(disparities[gx] != 0 && disparities[gx - 1] != 0
+                    && std::abs(disparities[gx] - disparities[gx - 1]) <= dispTolerance) {
+                unite(rowStart + gx, rowStart + gx - 1);
+            }
+        }
+
+        // Connect to the upper neighbor within the band
+        if(gy > firstRow) {
+            uniteRows(gy);
+        }
+    }
+}
+
+void ObstacleClusterer::uniteRows(int y) {
+    int rowStart = y * gridWidth;
+    const uint16_t* disparities = &cellDisparities[rowStart];
+    const uint16_t* above = disparities - gridWidth;
+    for(int x = 0; x < gridWidth; x++) {
+        if(disparities[x] != 0 && above[x] != 0 && std::abs(disparities[x] - above[x]) <= dispTolerance) {
+            unite(rowStart + x, rowStart - gridWidth + x);
+        }
+    }
+}
+
+void ObstacleClusterer::collectClusters() {
+    int numCells = gridWidth * gridHeight;
+    clusterIndices.assign(numCells, -1);
+    std::vector<ClusterSums> sums;
+
+    for(int i = 0; i < numCells; i++) {
+        if(cellDisparities[i] == 0) {
+            continue;
+        }
+
+        int root = findRoot(i);
+        const float* p = &cellPoints[3 * static_cast<size_t>(i)];
+        int x = i % gridWidth, y = i / gridWidth;
+        if(clusterIndices[root] < 0) {
+            clusterIndices[root] = static_cast<int>(sums.size());
+            ClusterSums s;
+            for(int k = 0; k < 3; k++) {
+                s.sum[k] = 0.0;
+                s.minCorner[k] = s.maxCorner[k] = p[k];
+            }
+            s.numPixels = 0;
+            s.minX = s.maxX = x;
+            s.minY = s.maxY = y;
+            sums.push_back(s);
+        }
+
+        ClusterSums& s = sums[clusterIndices[root]];
+        for(int k = 0; k < 3; k++) {
+            s.sum[k] += p[k];
+            s.minCorner[k] = std::min(s.minCorner[k], p[k]);
+            s.maxCorner[k] = std::max(s.maxCorner[k], p[k]);
+        }
+        s.numPixels++;
+        s.minX = std::min(s.minX, x);
+        s.maxX = std::max(s.maxX, x);
+        s.maxY = y; // Cells are visited in row-major order
+    }
+
+    clusters.clear();
+    for(const ClusterSums& s: sums) {
+        if(s.numPixels < minPixels) {
+            continue;
+        }
+
+        Cluster cluster;
+        for(int k = 0; k < 3; k++) {
+            cluster.centroid[k] = static_cast<float>(s.sum[k] / s.numPixels);
+            cluster.minCorner[k] = s.minCorner[k];
+            cluster.maxCorner[k] = s.maxCorner[k];
+        }
+        cluster.numPixels = s.numPixels;
+        cluster.imageX = s.minX * step;
+        cluster.imageY = s.minY * step;
+        cluster.imageWidth = (s.maxX - s.minX + 1) * step;
+        cluster.imageHeight = (s.maxY - s.minY + 1) * step;
+        clusters.push_back(cluster);
+    }
+
+    std::sort(clusters.begin(), clusters.end(), [](const Cluster& a, const Cluster& b) {
+        return horizontalDistanceSq(a) < horizontalDistanceSq(b);
+    });
+}
+
+} // namespace
@@ -0,0 +1,159 @@
+/*******************************************************************************
+ * Copyright (c) 2022 Nerian Vision GmbH
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *******************************************************************************/
+
+#ifndef __NERIAN_STEREO_OBSTACLE_CLUSTERS_H__
+#define __NERIAN_STEREO_OBSTACLE_CLUSTERS_H__
+
+#include <vector>
+#include <stdint.h>
+
+namespace nerian_stereo {
+
+/**
+ * \brief Segments obstacles directly in the disparity map.
+ *
+ * Each (subsampled) pixel is reconstructed with the Q matrix and rotated
+ * into a gravity-aligned frame with x pointing forward, y to the left and
+ * z up, with the origin at the camera. The frame must follow the heading
+ * of the camera, as only pixels in front of the camera are kept. Pixels within the ground band, i.e.
+ * less than groundBand meters above the ground plane, as well as pixels
+ * above maxHeight or beyond maxRange are removed.
+ *
+ * The remaining pixels are grouped into connected components of the image
+ * grid, where two neighboring pixels are connected if their disparities
+ * differ by at most disparityTolerance. Labeling is performed with
+ * union-find, in parallel for bands of rows that are merged afterwards.
+ * For each component with at least minPixels pixels, the axis-aligned
+ * bounding box and centroid of its points are determined.
+ */
+class ObstacleClusterer {
+public:
+    /**
+     * \brief A cluster of obstacle pixels
+     */
+    struct Cluster {
+        // Centroid and bounding box in the gravity-aligned frame in meters
+        float centroid[3];
+        float minCorner[3];
+        float maxCorner[3];
+
+        // Number of subsampled pixels
+        int numPixels;
+
+        // Bounding box in the disparity map
+        int imageX;
+        int imageY;
+        int imageWidth;
+        int imageHeight;
+    };
+
+    /**
+     * \brief Creates a new clusterer
+     *
+     * \param cameraHeight Height of the camera above the ground in meters
+     * \param groundBand Height above the ground below which pixels are removed
+     * \param maxHeight Height above the ground above which pixels are removed
+     * \param maxRange Maximum horizontal distance from the camera in meters
+     * \param disparityTolerance Maximum disparity difference of connected pixels
+     * \param minPixels Minimum number of subsampled pixels of a cluster
+     * \param step Subsampling step in pixels
+     */
+    ObstacleClusterer(double cameraHeight, double groundBand, double maxHeight, double maxRange,
+        double disparityTolerance, int minPixels, int step);
+
+    /**
+     * \brief Sets the rotation from the coordinates of the Q matrix into the
+     * gravity-aligned frame, as row-major 3x3 matrix
+     */
+    void setRotation(const float* rotation);
+
+    /**
+     * \brief Computes the clusters for a 12-bit disparity map
+     *
+     * \param dispMap Disparity map with the given subpixel factor; 0xFFF marks invalid pixels
+     * \param width Width of the disparity map
+     * \param height Height of the disparity map
+     * \param rowStride Row stride of the disparity map in bytes
+     * \param q Q matrix
+     * \param subpixelFactor Subpixel factor of the disparity map
+     */
+    void compute(const unsigned short* dispMap, int width, int height, int rowStride,
+        const float* q, int subpixelFactor);
+
+    /**
+     * \brief Clusters of the last disparity map, sorted by increasing
+     * horizontal distance from the camera
+     */
+    const std::vector<Cluster>& getClusters() const { return clusters; }
+
+private:
+    // Grid rows per parallel band
+    static const int BAND_ROWS = 16;
+
+    float cameraHeight;
+    float groundBand;
+    float maxHeight;
+    float maxRange;
+    float disparityTolerance;
+    int minPixels;
+    int step;
+    float rotation[9];
+
+    // State of the current disparity map
+    const unsigned short* dispMap;
+    int rowStride;
+    int gridWidth;
+    int gridHeight;
+    int dispTolerance;
+    float dispScale;
+    float transform[16];
+
+    // Union-find forest and per-cell data of the subsampled grid; cells
+    // that are not obstacles have a disparity of 0
+    std::vector<int> parent;
+    std::vector<uint16_t> cellDisparities;
+    std::vector<float> cellPoints;
+
+    std::vector<int> clusterIndices;
+    std::vector<Cluster> clusters;
+
+    void processBand(int band);
+    void uniteRows(int y);
+    void collectClusters();
+
+    int findRoot(int i) {
+        int* p = &parent[0];
+        while(p[i] != i) {
+            p[i] = p[p[i]];
+            i = p[i];
+        }
+        return i;
+    }
+
+    void unite(int a, int b) {
+        a = findRoot(a);
+        b = findRoot(b);
+        if(a < b) {
+            parent[b] = a;
+        } else if(b < a) {
+            parent[a] = b;
+        }
+    }
+
+    friend class ObstacleBandBody;
+};
+
+} // namespace
+
+#endif
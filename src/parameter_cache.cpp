@@ -0,0 +1,119 @@
+/*******************************************************************************
+ * Copyright (c) 2022 Nerian Vision GmbH
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *******************************************************************************/
+
+#include "parameter_cache.h"
+
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cstdio>
+
+using namespace visiontransfer;
+using namespace visiontransfer::param;
+
+namespace nerian_stereo {
+
+namespace {
+
+const char* CACHE_HEADER = "nerian_stereo_parameter_cache 1";
+
+bool isCachedType(const Parameter& param) {
+    ParameterValue::ParameterType type = param.getType();
+    return param.hasCurrent() && (type == ParameterValue::TYPE_INT
+        || type == ParameterValue::TYPE_DOUBLE || type == ParameterValue::TYPE_BOOL);
+}
+
+} // namespace
+
+bool ParameterCache::save(const std::string& fileName, const ParameterSet& params) {
+    // Write to a temporary file first, such that an interrupted write
+    // never leaves a truncated cache behind
+    std::string tmpFile = fileName + ".tmp";
+    {
+        std::ofstream out(tmpFile.c_str());
+        if(!out) {
+            return false;
+        }
+
+        out << CACHE_HEADER << std::endl << std::setprecision(17);
+        for(auto it = params.begin(); it != params.end(); ++it) {
+            const Parameter& param = it->second;
+            if(!isCachedType(param)) {
+                continue;
+            }
+            out << it->first << " " << static_cast<int>(param.getType()) << " "
+                << param.getCurrent<double>() << " " << (param.hasRange() ? 1 : 0) << " "
+                << param.getMin<double>() << " " << param.getMax<double>() << std::endl;
+        }
+        if(!out) {
+            return false;
+        }
+    }
+    return rename(tmpFile.c_str(), fileName.c_str()) == 0;
+}
+
+bool ParameterCache::load(const std::string& fileName, ParameterSet& params) {
+    std::ifstream in(fileName.c_str());
+    std::string line;
+    if(!in || !std::getline(in, line) || line != CACHE_HEADER) {
+        return false;
+    }
+
+    ParameterSet newParams;
+    try {
+        while(std::getline(in, line)) {
+            std::istringstream ss(line);
+            std::string uid;
+            int type = 0, hasRange = 0;
+            double current = 0, minVal = 0, maxVal = 0;
+            if(!(ss >> uid >> type >> current >> hasRange >> minVal >> maxVal)) {
+                return false;
+            }
+
+            Parameter param(uid);
+            param.setType(static_cast<ParameterValue::ParameterType>(type));
+            if(hasRange) {
+                param.setRange<double>(minVal, maxVal);
+            }
+            param.setCurrent<double>(current);
+            newParams[uid] = param;
+        }
+    } catch(const std::exception&) {
+        return false;
+    }
+
+    if(newParams.empty()) {
+        return false;
+    }
+    params = newParams;
+    return true;
+}
+
+bool ParameterCache::matches(const ParameterSet& cached, const ParameterSet& params) {
+    for(auto it = params.begin(); it != params.end(); ++it) {
+        if(!isCachedType(it->second)) {
+            continue;
+        }
+        auto cachedIt = cached.find(it->first);
+        if(cachedIt == cached.end()
+                || cachedIt->second.getCurrent<double>() != it->second.getCurrent<double>()
+                || cachedIt->second.getMin<double>() != it->second.getMin<double>()
+                || cachedIt->second.getMax<double>() != it->second.getMax<double>()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
@@ -0,0 +1,54 @@
+/*******************************************************************************
+ * Copyright (c) 2022 Nerian Vision GmbH
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *******************************************************************************/
+
+#ifndef __NERIAN_STEREO_PARAMETER_CACHE_H__
+#define __NERIAN_STEREO_PARAMETER_CACHE_H__
+
+#include <string>
+#include <visiontransfer/parameterset.h>
+
+namespace nerian_stereo {
+
+/**
+ * \brief Persists the last known device parameters between node restarts.
+ *
+ * Only scalar integer, floating point and boolean parameters are stored,
+ * together with their value ranges. This is all the information that is
+ * needed for initializing the parameter server and dynamic_reconfigure
+ * before the device handshake has completed.
+ */
+class ParameterCache {
+public:
+    /**
+     * \brief Writes the given parameters to a cache file
+     */
+    static bool save(const std::string& fileName, const visiontransfer::param::ParameterSet& params);
+
+    /**
+     * \brief Reads parameters from a cache file. Returns false if the file is
+     * missing or corrupt.
+     */
+    static bool load(const std::string& fileName, visiontransfer::param::ParameterSet& params);
+
+    /**
+     * \brief Returns true if all cached values match the values in the
+     * other parameter set
+     */
+    static bool matches(const visiontransfer::param::ParameterSet& cached,
+        const visiontransfer::param::ParameterSet& params);
+};
+
+} // namespace
+
+#endif
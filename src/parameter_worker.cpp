@@ -0,0 +1,126 @@
+/*******************************************************************************
+ * Copyright (c) 2022 Nerian Vision GmbH
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *******************************************************************************/
+
+#include "parameter_worker.h"
+
+#include <ros/ros.h>
+#include <visiontransfer/exceptions.h>
+
+using namespace visiontransfer;
+
+namespace nerian_stereo {
+
+void ParameterBatch::merge(const ParameterBatch& other) {
+    for(const std::string& name: other.order) {
+        if(writers.find(name) == writers.end()) {
+            order.push_back(name);
+        }
+        writers[name] = other.writers.at(name);
+    }
+}
+
+void ParameterBatch::apply(DeviceParameters& params) const {
+    bool reboot = false;
+    for(const std::string& name: order) {
+        if(name == "reboot") {
+            // Must come after all other changes
+            reboot = true;
+        } else {
+            writers.at(name)(params);
+        }
+    }
+    if(reboot) {
+        writers.at("reboot")(params);
+    }
+}
+
+ParameterWorker::ParameterWorker(std::chrono::milliseconds coalesceDelay)
+    : params(nullptr), coalesceDelay(coalesceDelay), terminate(false), busy(false) {
+    thread = std::thread(&ParameterWorker::run, this);
+}
+
+ParameterWorker::~ParameterWorker() {
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        terminate = true;
+    }
+    condition.notify_all();
+    thread.join();
+}
+
+void ParameterWorker::connect(DeviceParameters* newParams) {
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        // Make sure the previous connection is not in use anymore
+        condition.wait(lock, [this]{ return !busy; });
+        params = newParams;
+    }
+    condition.notify_all();
+}
+
+bool ParameterWorker::isConnected() {
+    std::unique_lock<std::mutex> lock(mutex);
+    return params != nullptr;
+}
+
+void ParameterWorker::submit(const ParameterBatch& batch) {
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        pending.merge(batch);
+        lastSubmit = std::chrono::steady_clock::now();
+    }
+    condition.notify_all();
+}
+
+void ParameterWorker::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while(true) {
+        condition.wait(lock, [this]{ return terminate || (!pending.empty() && params != nullptr); });
+
+        // Wait until no further changes arrive for the coalescing period
+        while(!terminate && std::chrono::steady_clock::now() < lastSubmit + coalesceDelay) {
+            condition.wait_until(lock, lastSubmit + coalesceDelay);
+        }
+
+        if(pending.empty() || params == nullptr) {
+            if(terminate) {
+                return; // Nothing left that could be written
+            }
+            continue; // Connection was removed in the meantime
+        }
+
+        ParameterBatch batch;
+        std::swap(batch, pending);
+        DeviceParameters* target = params;
+        busy = true;
+        lock.unlock();
+
+        try {
+            batch.apply(*target);
+            ROS_INFO("Applied %d parameter change(s) to the device", static_cast<int>(batch.size()));
+        } catch(const ParameterException& e) {
+            ROS_ERROR("ParameterException while applying parameter changes: %s", e.what());
+        } catch(const TransferException& e) {
+            ROS_ERROR("TransferException while applying parameter changes: %s", e.what());
+        } catch(const std::exception& e) {
+            ROS_ERROR("Error while applying parameter changes: %s", e.what());
+        }
+
+        lock.lock();
+        busy = false;
+        condition.notify_all();
+    }
+}
+
+} // namespace
@@ -0,0 +1,132 @@
+/*******************************************************************************
+ * Copyright (c) 2022 Nerian Vision GmbH
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *******************************************************************************/
+
+#ifndef __NERIAN_STEREO_PARAMETER_WORKER_H__
+#define __NERIAN_STEREO_PARAMETER_WORKER_H__
+
+#include <string>
+#include <vector>
+#include <map>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+#include <visiontransfer/deviceparameters.h>
+
+namespace nerian_stereo {
+
+/**
+ * \brief A set of pending device parameter changes.
+ *
+ * Setting the same parameter repeatedly only keeps the most recent value.
+ * Changes are applied in the order in which the parameters were first set,
+ * except for the reboot request, which is always applied last.
+ */
+class ParameterBatch {
+public:
+    /**
+     * \brief Adds or replaces a parameter change
+     */
+    template<typename T>
+    void set(const std::string& name, T value) {
+        if(writers.find(name) == writers.end()) {
+            order.push_back(name);
+        }
+        writers[name] = [name, value](visiontransfer::DeviceParameters& params) {
+            params.setParameter(name, value);
+        };
+    }
+
+    /**
+     * \brief Merges another batch into this one; newer values take precedence
+     */
+    void merge(const ParameterBatch& other);
+
+    /**
+     * \brief Writes all changes to the device
+     */
+    void apply(visiontransfer::DeviceParameters& params) const;
+
+    bool empty() const { return order.empty(); }
+    size_t size() const { return order.size(); }
+    void clear() { order.clear(); writers.clear(); }
+
+private:
+    std::vector<std::string> order;
+    std::map<std::string, std::function<void(visiontransfer::DeviceParameters&)>> writers;
+};
+
+/**
+ * \brief Background thread that forwards parameter changes to the device.
+ *
+ * Parameter writes are synchronous network round trips. Submitting them to
+ * this worker ensures that ROS callbacks, and thus frame processing, never
+ * block on parameter I/O. Changes that are submitted in quick succession
+ * (e.g. while dragging a slider in rqt_reconfigure) are coalesced into a
+ * single batch. Changes that are submitted before the device connection
+ * is available are kept until connect() is called.
+ */
+class ParameterWorker {
+public:
+    /**
+     * \brief Starts the worker thread
+     *
+     * \param coalesceDelay Time to wait for further changes before writing
+     */
+    ParameterWorker(std::chrono::milliseconds coalesceDelay = std::chrono::milliseconds(50));
+
+    /**
+     * \brief Applies all remaining changes and stops the worker thread
+     */
+    ~ParameterWorker();
+
+    /**
+     * \brief Sets the device parameter connection that changes are written to.
+     *
+     * Blocks until a write in progress on the previous connection has
+     * finished. The connection must stay valid until it is replaced or the
+     * worker is destroyed.
+     */
+    void connect(visiontransfer::DeviceParameters* params);
+
+    /**
+     * \brief Returns true if a device parameter connection is set
+     */
+    bool isConnected();
+
+    /**
+     * \brief Queues a batch of changes without blocking
+     */
+    void submit(const ParameterBatch& batch);
+
+private:
+    visiontransfer::DeviceParameters* params;
+    std::chrono::milliseconds coalesceDelay;
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    ParameterBatch pending;
+    std::chrono::steady_clock::time_point lastSubmit;
+    bool terminate;
+    bool busy;
+    std::thread thread;
+
+    void run();
+};
+
+} // namespace
+
+#endif
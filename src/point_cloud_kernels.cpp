@@ -0,0 +1,146 @@
+/*******************************************************************************
+ * Copyright (c) 2022 Nerian Vision GmbH
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *******************************************************************************/
+
+#include "point_cloud_kernels.h"
+
+#include <limits>
+#include <stdexcept>
+
+using namespace visiontransfer;
+
+namespace nerian_stereo {
+
+template <PointCloudColorMode colorMode> void copyPointCloudIntensity(const ImageSet& imageSet, unsigned char* cloud) {
+    auto imageIndex = imageSet.hasImageType(ImageSet::IMAGE_COLOR) ? ImageSet::IMAGE_COLOR : ImageSet::IMAGE_LEFT;
+    // Get pointers to the beginning and end of the point cloud
+    unsigned char* cloudStart = cloud;
+    unsigned char* cloudEnd = cloud + imageSet.getWidth()*imageSet.getHeight()*4*sizeof(float);
+
+    if(imageSet.getPixelFormat(imageIndex) == ImageSet::FORMAT_8_BIT_MONO) {
+        // Get pointer to the current pixel and end of current row
+        unsigned char* imagePtr = imageSet.getPixelData(imageIndex);
+        unsigned char* rowEndPtr = imagePtr + imageSet.getWidth();
+        int rowIncrement = imageSet.getRowStride(imageIndex) - imageSet.getWidth();
+
+        for(unsigned char* cloudPtr = cloudStart + 3*sizeof(float);
+                cloudPtr < cloudEnd; cloudPtr+= 4*sizeof(float)) {
+            if(colorMode == RGB_SEPARATE) {// RGB as float
+                *reinterpret_cast<float*>(cloudPtr) = static_cast<float>(*imagePtr) / 255.0F;
+            } else if(colorMode == RGB_COMBINED) {// RGB as integer
+                const unsigned char intensity = *imagePtr;
+                *reinterpret_cast<unsigned int*>(cloudPtr) = (intensity << 16) | (intensity << 8) | intensity;
+            } else {
+                *cloudPtr = *imagePtr;
+            }
+
+            imagePtr++;
+            if(imagePtr == rowEndPtr) {
+                // Progress to next row
+                imagePtr += rowIncrement;
+                rowEndPtr = imagePtr + imageSet.getWidth();
+            }
+        }
+    } else if(imageSet.getPixelFormat(imageIndex) == ImageSet::FORMAT_12_BIT_MONO) {
+        // Get pointer to the current pixel and end of current row
+        unsigned short* imagePtr = reinterpret_cast<unsigned short*>(imageSet.getPixelData(imageIndex));
+        unsigned short* rowEndPtr = imagePtr + imageSet.getWidth();
+        int rowIncrement = imageSet.getRowStride(imageIndex) - 2*imageSet.getWidth();
+
+        for(unsigned char* cloudPtr = cloudStart + 3*sizeof(float);
+                cloudPtr < cloudEnd; cloudPtr+= 4*sizeof(float)) {
+
+            if(colorMode == RGB_SEPARATE) {// RGB as float
+                *reinterpret_cast<float*>(cloudPtr) = static_cast<float>(*imagePtr) / 4095.0F;
+            } else if(colorMode == RGB_COMBINED) {// RGB as integer
+                const unsigned char intensity = *imagePtr/16;
+                *reinterpret_cast<unsigned int*>(cloudPtr) = (intensity << 16) | (intensity << 8) | intensity;
+            } else {
+                *cloudPtr = *imagePtr/16;
+            }
+
+            imagePtr++;
+            if(imagePtr == rowEndPtr) {
+                // Progress to next row; the increment is given in bytes
+                imagePtr = reinterpret_cast<unsigned short*>(reinterpret_cast<unsigned char*>(imagePtr)
+                    + rowIncrement);
+                rowEndPtr = imagePtr + imageSet.getWidth();
+            }
+        }
+    } else if(imageSet.getPixelFormat(imageIndex) == ImageSet::FORMAT_8_BIT_RGB) {
+        // Get pointer to the current pixel and end of current row
+        unsigned char* imagePtr = imageSet.getPixelData(imageIndex);
+        unsigned char* rowEndPtr = imagePtr + 3*imageSet.getWidth();
+        int rowIncrement = imageSet.getRowStride(imageIndex) - 3*imageSet.getWidth();
+
+        for(unsigned char* cloudPtr = cloudStart + 3*sizeof(float);
+                cloudPtr < cloudEnd; cloudPtr+= 4*sizeof(float)) {
+            if(colorMode == RGB_SEPARATE) {// RGB as float
+                *reinterpret_cast<float*>(cloudPtr) = static_cast<float>(imagePtr[2]) / 255.0F;
+            } else if(colorMode == RGB_COMBINED) {// RGB as integer
+                *reinterpret_cast<unsigned int*>(cloudPtr) = (imagePtr[0] << 16) | (imagePtr[1] << 8) | imagePtr[2];
+            } else {
+                *cloudPtr = (imagePtr[0] + imagePtr[1]*2 + imagePtr[2])/4;
+            }
+
+            imagePtr+=3;
+            if(imagePtr == rowEndPtr) {
+                // Progress to next row
+                imagePtr += rowIncrement;
+                rowEndPtr = imagePtr + 3*imageSet.getWidth();
+            }
+        }
+    } else {
+        throw std::runtime_error("Invalid pixel format!");
+    }
+}
+
+template void copyPointCloudIntensity<RGB_SEPARATE>(const ImageSet& imageSet, unsigned char* cloud);
+template void copyPointCloudIntensity<RGB_COMBINED>(const ImageSet& imageSet, unsigned char* cloud);
+template void copyPointCloudIntensity<INTENSITY>(const ImageSet& imageSet, unsigned char* cloud);
+
+template <int coord> void copyPointCloudClamped(const float* src, float* dst, int size, double maxDepth) {
+    // Only copy points that are below the minimum depth
+    const float* endPtr = src + 4*size;
+    const float* srcPtr = src;
+    for(float* dstPtr = dst; srcPtr < endPtr; srcPtr+=4, dstPtr+=4) {
+        if(srcPtr[coord] > maxDepth) {
+            dstPtr[0] = std::numeric_limits<float>::quiet_NaN();
+            dstPtr[1] = std::numeric_limits<float>::quiet_NaN();
+            dstPtr[2] = std::numeric_limits<float>::quiet_NaN();
+        } else {
+            dstPtr[0] = srcPtr[0];
+            dstPtr[1] = srcPtr[1];
+            dstPtr[2] = srcPtr[2];
+        }
+    }
+}
+
+template void copyPointCloudClamped<0>(const float* src, float* dst, int size, double maxDepth);
+template void copyPointCloudClamped<2>(const float* src, float* dst, int size, double maxDepth);
+
+void qMatrixToRosCoords(const float* src, float* dst) {
+    dst[0] = src[8];   dst[1] = src[9];
+    dst[2] = src[10];  dst[3] = src[11];
+
+    dst[4] = -src[0];  dst[5] = -src[1];
+    dst[6] = -src[2];  dst[7] = -src[3];
+
+    dst[8] = -src[4];  dst[9] = -src[5];
+    dst[10] = -src[6]; dst[11] = -src[7];
+
+    dst[12] = src[12]; dst[13] = src[13];
+    dst[14] = src[14]; dst[15] = src[15];
+}
+
+} // namespace
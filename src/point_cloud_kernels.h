@@ -0,0 +1,59 @@
+/*******************************************************************************
+ * Copyright (c) 2022 Nerian Vision GmbH
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *******************************************************************************/
+
+#ifndef __NERIAN_STEREO_POINT_CLOUD_KERNELS_H__
+#define __NERIAN_STEREO_POINT_CLOUD_KERNELS_H__
+
+#include <visiontransfer/imageset.h>
+
+namespace nerian_stereo {
+
+/**
+ * \brief Encoding of the image data in the fourth float of each point
+ */
+enum PointCloudColorMode {
+    RGB_SEPARATE,
+    RGB_COMBINED,
+    INTENSITY,
+    NONE
+};
+
+/**
+ * \brief Copies the intensity or RGB data of the color image, or the left
+ * image if there is none, to the fourth float of each point
+ *
+ * \param imageSet Image set with 8-bit mono, 12-bit mono or RGB image
+ * \param cloud Point data with four floats per point, for all pixels of
+ *        the image set
+ */
+template <PointCloudColorMode colorMode> void copyPointCloudIntensity(
+    const visiontransfer::ImageSet& imageSet, unsigned char* cloud);
+
+/**
+ * \brief Copies all points in a point cloud that have a depth smaller
+ * than maxDepth. Other points are set to NaN.
+ *
+ * \param coord Index of the depth coordinate (0 for x, 2 for z)
+ */
+template <int coord> void copyPointCloudClamped(const float* src, float* dst, int size, double maxDepth);
+
+/**
+ * \brief Transform Q matrix to match the ROS coordinate system:
+ * Swap y/z axis, then swap x/y axis, then invert y and z axis.
+ */
+void qMatrixToRosCoords(const float* src, float* dst);
+
+} // namespace
+
+#endif
@@ -0,0 +1,125 @@
+/*******************************************************************************
+ * Copyright (c) 2022 Nerian Vision GmbH
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *******************************************************************************/
+
+#include "point_cloud_streamer.h"
+#include "point_cloud_kernels.h"
+
+#include <cstring>
+#include <algorithm>
+
+using namespace visiontransfer;
+
+namespace nerian_stereo {
+
+PointCloudStreamer::PointCloudStreamer(double maxDepth, int depthCoordinate)
+    : maxDepth(maxDepth), depthCoordinate(depthCoordinate), active(false), haveQ(false), streaming(false),
+    sequence(0), width(0), height(0), rowsDone(0), haveReady(false), readySequence(0),
+    readyWidth(0), readyHeight(0) {
+}
+
+void PointCloudStreamer::setQMatrix(const float* deviceQ, const float* effectiveQ) {
+    std::unique_lock<std::mutex> lock(mutex);
+    memcpy(this->deviceQ, deviceQ, sizeof(this->deviceQ));
+    memcpy(this->effectiveQ, effectiveQ, sizeof(this->effectiveQ));
+    haveQ = true;
+}
+
+void PointCloudStreamer::setActive(bool active) {
+    std::unique_lock<std::mutex> lock(mutex);
+    this->active = active;
+}
+
+void PointCloudStreamer::processRows(const ImageSet& imageSet, int validRows, bool complete) {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    if(!streaming || imageSet.getSequenceNumber() != sequence || imageSet.getWidth() != width
+            || imageSet.getHeight() != height) {
+        // Start of a new image set
+        int dispIndex = imageSet.getIndexOf(ImageSet::IMAGE_DISPARITY);
+        streaming = active && haveQ && dispIndex >= 0
+            && imageSet.getPixelFormat(dispIndex) == ImageSet::FORMAT_12_BIT_MONO
+            && memcmp(imageSet.getQMatrix(), deviceQ, sizeof(deviceQ)) == 0;
+        sequence = imageSet.getSequenceNumber();
+        width = imageSet.getWidth();
+        height = imageSet.getHeight();
+        rowsDone = 0;
+        if(!streaming) {
+            return;
+        }
+        current.resize(static_cast<size_t>(width) * height * 4 * sizeof(float));
+    }
+
+    // Small bands are not worth the overhead
+    validRows = std::min(validRows, height);
+    if(validRows - rowsDone >= MIN_BAND_ROWS || (complete && validRows > rowsDone)) {
+        reconstructBand(imageSet, rowsDone, validRows);
+        rowsDone = validRows;
+    }
+
+    if(complete) {
+        // Image sets with missing rows are not used
+        if(rowsDone == height) {
+            ready.swap(current);
+            haveReady = true;
+            readySequence = sequence;
+            readyWidth = width;
+            readyHeight = height;
+        }
+        streaming = false;
+    }
+}
+
+void PointCloudStreamer::reconstructBand(const ImageSet& imageSet, int firstRow, int lastRow) {
+    int dispIndex = imageSet.getIndexOf(ImageSet::IMAGE_DISPARITY);
+    int rows = lastRow - firstRow;
+
+    // Reconstruct the band as a separate image, with the Q matrix adjusted
+    // for the row offset
+    float q[16];
+    memcpy(q, effectiveQ, sizeof(q));
+    for(int i = 0; i < 4; i++) {
+        q[i*4 + 3] += firstRow * q[i*4 + 1];
+    }
+
+    ImageSet band = imageSet;
+    band.setHeight(rows);
+    band.setPixelData(dispIndex, imageSet.getPixelData(dispIndex) + firstRow * imageSet.getRowStride(dispIndex));
+    band.setQMatrix(q);
+    float* points = recon3d.createPointMap(band, 0);
+
+    float* dst = reinterpret_cast<float*>(&current[0]) + static_cast<size_t>(firstRow) * width * 4;
+    int size = rows * width;
+    if(maxDepth < 0) {
+        memcpy(dst, points, size * 4 * sizeof(float));
+    } else if(depthCoordinate == 0) {
+        copyPointCloudClamped<0>(points, dst, size, maxDepth);
+    } else {
+        copyPointCloudClamped<2>(points, dst, size, maxDepth);
+    }
+}
+
+bool PointCloudStreamer::takePointCloud(const ImageSet& imageSet, std::vector<unsigned char>& data) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if(!haveReady || readySequence != imageSet.getSequenceNumber() || readyWidth != imageSet.getWidth()
+            || readyHeight != imageSet.getHeight()) {
+        return false;
+    }
+
+    // The previous buffer is reused for the next image set
+    data.swap(ready);
+    haveReady = false;
+    return true;
+}
+
+} // namespace
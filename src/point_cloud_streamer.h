@@ -0,0 +1,111 @@
+/*******************************************************************************
+ * Copyright (c) 2022 Nerian Vision GmbH
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *******************************************************************************/
+
+#ifndef __NERIAN_STEREO_POINT_CLOUD_STREAMER_H__
+#define __NERIAN_STEREO_POINT_CLOUD_STREAMER_H__
+
+#include <vector>
+#include <mutex>
+#include <visiontransfer/imageset.h>
+#include <visiontransfer/reconstruct3d.h>
+
+namespace nerian_stereo {
+
+/**
+ * \brief Reconstructs the point cloud row by row while an image set is
+ * still being received.
+ *
+ * processRows() is called from the receive thread with each partially
+ * received image set, and reconstructs the newly received disparity rows
+ * into the point data of a PointCloud2 message (x, y, z and an unused
+ * fourth float per point). Once the image set is complete, the processing
+ * thread fetches the finished point data with takePointCloud(), such that
+ * only the last rows are reconstructed after the transfer has finished.
+ *
+ * The Q matrix is provided by the processing thread. Image sets with a
+ * different Q matrix are not streamed, and have to be reconstructed as
+ * usual.
+ */
+class PointCloudStreamer {
+public:
+    /**
+     * \brief Creates a new streamer
+     *
+     * \param maxDepth Points beyond this depth are set to NaN, or a negative
+     *        value to keep all points
+     * \param depthCoordinate Index of the depth coordinate (0 for x, 2 for z)
+     */
+    PointCloudStreamer(double maxDepth, int depthCoordinate);
+
+    /**
+     * \brief Sets the Q matrix for reconstruction
+     *
+     * \param deviceQ Q matrix transmitted by the device
+     * \param effectiveQ Q matrix that is used for image sets with the given
+     *        device Q matrix
+     */
+    void setQMatrix(const float* deviceQ, const float* effectiveQ);
+
+    /**
+     * \brief Enables or disables streaming, starting with the next image set
+     */
+    void setActive(bool active);
+
+    /**
+     * \brief Reconstructs the rows that have been received since the last
+     * call for the same image set
+     */
+    void processRows(const visiontransfer::ImageSet& imageSet, int validRows, bool complete);
+
+    /**
+     * \brief Swaps the completely reconstructed point data of the given
+     * image set into \c data. Returns false if it is not available.
+     */
+    bool takePointCloud(const visiontransfer::ImageSet& imageSet, std::vector<unsigned char>& data);
+
+private:
+    // Minimum number of rows that are reconstructed at once
+    static const int MIN_BAND_ROWS = 16;
+
+    std::mutex mutex;
+    visiontransfer::Reconstruct3D recon3d;
+    float maxDepth;
+    int depthCoordinate;
+
+    bool active;
+    bool haveQ;
+    float deviceQ[16];
+    float effectiveQ[16];
+
+    // Image set that is currently being reconstructed
+    bool streaming;
+    unsigned int sequence;
+    int width;
+    int height;
+    int rowsDone;
+    std::vector<unsigned char> current;
+
+    // Last completely reconstructed image set
+    bool haveReady;
+    unsigned int readySequence;
+    int readyWidth;
+    int readyHeight;
+    std::vector<unsigned char> ready;
+
+    void reconstructBand(const visiontransfer::ImageSet& imageSet, int firstRow, int lastRow);
+};
+
+} // namespace
+
+#endif
@@ -0,0 +1,213 @@
+/*******************************************************************************
+ * Copyright (c) 2022 Nerian Vision GmbH
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *******************************************************************************/
+
+#include "realtime.h"
+
+#include <sstream>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+namespace nerian_stereo {
+
+namespace {
+
+const size_t HUGE_PAGE_SIZE = 2*1024*1024;
+
+bool parseCpuList(const std::string& list, std::vector<int>& cpus) {
+    std::stringstream ss(list);
+    std::string item;
+    while(std::getline(ss, item, ',')) {
+        if(item.empty()) {
+            continue;
+        }
+        char* end = nullptr;
+        long first = std::strtol(item.c_str(), &end, 10);
+        long last = first;
+        if(*end == '-') {
+            last = std::strtol(end + 1, &end, 10);
+        }
+        if(*end != '\0' || first < 0 || last < first || last >= CPU_SETSIZE) {
+            return false;
+        }
+        for(long cpu = first; cpu <= last; cpu++) {
+            cpus.push_back(static_cast<int>(cpu));
+        }
+    }
+    return !cpus.empty();
+}
+
+} // namespace
+
+ThreadScheduling::ThreadScheduling(const std::string& policy, int priority, const std::string& cpus)
+    : policy(-1), priority(0) {
+    if(policy == "fifo") {
+        this->policy = SCHED_FIFO;
+    } else if(policy == "rr") {
+        this->policy = SCHED_RR;
+    } else if(policy == "other") {
+        this->policy = SCHED_OTHER;
+    } else if(policy != "") {
+        configError = "unknown scheduling policy '" + policy + "'";
+    }
+
+    if(this->policy == SCHED_FIFO || this->policy == SCHED_RR) {
+        int minPriority = sched_get_priority_min(this->policy);
+        int maxPriority = sched_get_priority_max(this->policy);
+        if(priority < minPriority || priority > maxPriority) {
+            std::stringstream ss;
+            ss << "priority " << priority << " is outside of " << minPriority << "-" << maxPriority;
+            configError = ss.str();
+            this->policy = -1;
+        } else {
+            this->priority = priority;
+        }
+    }
+
+    if(cpus != "" && !parseCpuList(cpus, this->cpus)) {
+        configError = "invalid CPU list '" + cpus + "'";
+        this->cpus.clear();
+    }
+}
+
+bool ThreadScheduling::applyToCurrentThread(std::string& error) const {
+    std::stringstream errors;
+
+    if(policy >= 0) {
+        sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = priority;
+        int result = pthread_setschedparam(pthread_self(), policy, &param);
+        if(result != 0) {
+            errors << "setting " << getPolicyName(policy) << " failed: " << strerror(result) << "; ";
+        }
+    }
+
+    if(!cpus.empty()) {
+        cpu_set_t cpuSet;
+        CPU_ZERO(&cpuSet);
+        for(int cpu: cpus) {
+            CPU_SET(cpu, &cpuSet);
+        }
+        int result = pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet);
+        if(result != 0) {
+            errors << "setting CPU affinity failed: " << strerror(result) << "; ";
+        }
+    }
+
+    error = errors.str();
+    if(error.size() >= 2) {
+        error.resize(error.size() - 2);
+    }
+    return error.empty();
+}
+
+std::string ThreadScheduling::describeCurrentThread() {
+    std::stringstream ss;
+
+    int currentPolicy = 0;
+    sched_param param;
+    if(pthread_getschedparam(pthread_self(), &currentPolicy, &param) == 0) {
+        ss << getPolicyName(currentPolicy) << " priority " << param.sched_priority;
+    } else {
+        ss << "unknown scheduling";
+    }
+
+    cpu_set_t cpuSet;
+    if(pthread_getaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet) == 0) {
+        // Print as a list of ranges
+        ss << ", CPUs ";
+        bool first = true;
+        for(int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if(!CPU_ISSET(cpu, &cpuSet)) {
+                continue;
+            }
+            int last = cpu;
+            while(last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, &cpuSet)) {
+                last++;
+            }
+            ss << (first ? "" : ",") << cpu;
+            if(last > cpu) {
+                ss << "-" << last;
+            }
+            first = false;
+            cpu = last;
+        }
+    }
+
+    return ss.str();
+}
+
+std::string ThreadScheduling::getPolicyName(int policy) {
+    switch(policy) {
+        case SCHED_FIFO: return "SCHED_FIFO";
+        case SCHED_RR: return "SCHED_RR";
+        case SCHED_OTHER: return "SCHED_OTHER";
+#ifdef SCHED_BATCH
+        case SCHED_BATCH: return "SCHED_BATCH";
+#endif
+#ifdef SCHED_IDLE
+        case SCHED_IDLE: return "SCHED_IDLE";
+#endif
+        default: return "unknown policy";
+    }
+}
+
+bool lockProcessMemory(std::string& error) {
+    if(mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        error = strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+HugePageAdvisor::HugePageAdvisor(): nextSlot(0), failures(0) {
+}
+
+void HugePageAdvisor::advise(const void* data, size_t size) {
+    uintptr_t start = reinterpret_cast<uintptr_t>(data);
+    for(const std::pair<uintptr_t, size_t>& buffer: advised) {
+        if(buffer.first == start && buffer.second == size) {
+            return;
+        }
+    }
+
+    // Remember the buffer even if it is too small, to avoid checking it again
+    if(static_cast<int>(advised.size()) < MAX_BUFFERS) {
+        advised.push_back(std::make_pair(start, size));
+    } else {
+        advised[nextSlot] = std::make_pair(start, size);
+        nextSlot = (nextSlot + 1) % MAX_BUFFERS;
+    }
+
+    // Only whole huge pages within the buffer can be backed by huge pages
+    uintptr_t alignedStart = (start + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+    uintptr_t alignedEnd = (start + size) & ~(HUGE_PAGE_SIZE - 1);
+    if(alignedEnd <= alignedStart) {
+        return;
+    }
+
+#ifdef MADV_HUGEPAGE
+    if(madvise(reinterpret_cast<void*>(alignedStart), alignedEnd - alignedStart, MADV_HUGEPAGE) != 0) {
+        failures++;
+    }
+#else
+    failures++;
+#endif
+}
+
+} // namespace
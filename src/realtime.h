@@ -0,0 +1,120 @@
+/*******************************************************************************
+ * Copyright (c) 2022 Nerian Vision GmbH
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *******************************************************************************/
+
+#ifndef __NERIAN_STEREO_REALTIME_H__
+#define __NERIAN_STEREO_REALTIME_H__
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
+
+namespace nerian_stereo {
+
+/**
+ * \brief Scheduling policy, priority and CPU affinity for a thread.
+ *
+ * Settings are applied to the calling thread, which allows configuring
+ * threads that have already been started. Elevated policies usually
+ * require CAP_SYS_NICE or a suitable RLIMIT_RTPRIO.
+ */
+class ThreadScheduling {
+public:
+    /**
+     * \brief Creates a new configuration
+     *
+     * \param policy "fifo", "rr", "other", or an empty string for keeping the
+     *        inherited policy
+     * \param priority Static priority for the "fifo" and "rr" policies
+     * \param cpus List of CPUs such as "0-3,6", or an empty string for
+     *        keeping the inherited affinity
+     */
+    ThreadScheduling(const std::string& policy, int priority, const std::string& cpus);
+
+    /**
+     * \brief Returns an error message if the configuration is invalid, or
+     * an empty string otherwise
+     */
+    const std::string& getConfigError() const { return configError; }
+
+    /**
+     * \brief Returns the POSIX scheduling policy, or -1 if it is kept
+     */
+    int getPolicy() const { return policy; }
+
+    int getPriority() const { return priority; }
+
+    /**
+     * \brief Applies the configuration to the calling thread. Returns false
+     * and sets \c error if any setting could not be applied.
+     */
+    bool applyToCurrentThread(std::string& error) const;
+
+    /**
+     * \brief Describes the effective scheduling of the calling thread
+     */
+    static std::string describeCurrentThread();
+
+    /**
+     * \brief Returns the name of a POSIX scheduling policy
+     */
+    static std::string getPolicyName(int policy);
+
+private:
+    int policy;
+    int priority;
+    std::vector<int> cpus;
+    std::string configError;
+};
+
+/**
+ * \brief Locks all current and future pages of the process in memory.
+ * Returns false and sets \c error on failure.
+ */
+bool lockProcessMemory(std::string& error);
+
+/**
+ * \brief Requests transparent huge pages for large buffers.
+ *
+ * Buffers are identified by address and size, such that recurring buffers
+ * are only advised once. Pages that have already been faulted in are
+ * collapsed into huge pages in the background by the kernel.
+ */
+class HugePageAdvisor {
+public:
+    HugePageAdvisor();
+
+    /**
+     * \brief Advises the huge page aligned part of the given buffer
+     */
+    void advise(const void* data, size_t size);
+
+    /**
+     * \brief Returns the number of buffers for which the advice failed,
+     * which are all buffers if the build lacks MADV_HUGEPAGE
+     */
+    int getNumFailures() const { return failures; }
+
+private:
+    // Number of remembered buffers
+    static const int MAX_BUFFERS = 32;
+
+    std::vector<std::pair<uintptr_t, size_t> > advised;
+    int nextSlot;
+    int failures;
+};
+
+} // namespace
+
+#endif
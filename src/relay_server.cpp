@@ -0,0 +1,228 @@
+/*******************************************************************************
+ * Copyright (c) 2022 Nerian Vision GmbH
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *******************************************************************************/
+
+#include "relay_server.h"
+#include "object_pool.h"
+
+#include <cstring>
+#include <chrono>
+
+using namespace visiontransfer;
+
+namespace nerian_stereo {
+
+/**
+ * \brief A single server port with its own transmission thread
+ */
+class RelayServer::Endpoint {
+public:
+    Endpoint(const std::string& address, const std::string& port, bool tcp)
+        : address(address), port(port), tcp(tcp), terminate(false), connected(false),
+        droppedFrames(0) {
+        // Bind immediately, such that port conflicts are reported to the caller
+        createTransfer();
+        thread = std::thread(&Endpoint::sendLoop, this);
+    }
+
+    ~Endpoint() {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            terminate = true;
+        }
+        cond.notify_one();
+        thread.join();
+
+        // Stop transmissions before the frames are released
+        transfer.reset();
+    }
+
+    void post(const std::shared_ptr<Frame>& frame) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if(pending != nullptr && connected) {
+                droppedFrames++;
+            }
+            pending = frame;
+        }
+        cond.notify_one();
+    }
+
+    bool isConnected() const { return connected; }
+    int getDroppedFrames() const { return droppedFrames; }
+
+    std::string takeError() {
+        std::unique_lock<std::mutex> lock(mutex);
+        std::string error;
+        error.swap(lastError);
+        return error;
+    }
+
+private:
+    std::string address;
+    std::string port;
+    bool tcp;
+    std::unique_ptr<AsyncTransfer> transfer;
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool terminate;
+    std::shared_ptr<Frame> pending;
+    std::string lastError;
+    std::atomic<bool> connected;
+    std::atomic<int> droppedFrames;
+
+    // AsyncTransfer keeps references to the frame that is being transmitted
+    // and the frame that is queued after it
+    std::deque<std::shared_ptr<Frame>> inFlight;
+
+    void createTransfer() {
+        inFlight.clear();
+        transfer.reset(new AsyncTransfer(address.c_str(), port.c_str(),
+            tcp ? ImageProtocol::PROTOCOL_TCP : ImageProtocol::PROTOCOL_UDP, true));
+    }
+
+    void sendLoop() {
+        while(true) {
+            std::shared_ptr<Frame> frame;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                // Wake up regularly to accept TCP connections
+                cond.wait_for(lock, std::chrono::milliseconds(10), [this]{
+                    return terminate || pending != nullptr;
+                });
+                if(terminate) {
+                    break;
+                }
+                frame.swap(pending);
+            }
+
+            try {
+                if(transfer == nullptr) {
+                    createTransfer();
+                }
+                if(tcp) {
+                    transfer->tryAccept();
+                }
+                connected = transfer->isConnected();
+                if(frame == nullptr || !connected) {
+                    continue;
+                }
+
+                // Only blocks while the previous frame is still queued
+                transfer->sendImageSetAsync(frame->imageSet, false);
+                inFlight.push_back(frame);
+                while(inFlight.size() > 2) {
+                    inFlight.pop_front();
+                }
+            } catch(const std::exception& ex) {
+                // A failed AsyncTransfer cannot be reused; recreate it
+                // with the next iteration
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    lastError = "Relay on port " + port + ": " + ex.what();
+                }
+                connected = false;
+                transfer.reset();
+                inFlight.clear();
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+        }
+    }
+};
+
+RelayServer::RelayServer(const std::string& address, int basePort, int numEndpoints, bool tcp) {
+    for(int i = 0; i < numEndpoints; i++) {
+        endpoints.emplace_back(new Endpoint(address, std::to_string(basePort + i), tcp));
+    }
+}
+
+RelayServer::~RelayServer() {
+}
+
+std::shared_ptr<RelayServer::Frame> RelayServer::copyFrame(const ImageSet& imageSet) {
+    // Reuse a frame that is no longer referenced by any endpoint
+    std::shared_ptr<Frame> frame = takeFromPool(framePool);
+
+    // The transfer overwrites a few bytes after the end of each image
+    size_t size = 0;
+    for(int i = 0; i < imageSet.getNumberOfImages(); i++) {
+        size += imageSet.getRowStride(i) * imageSet.getHeight() + SPARE_BYTES;
+    }
+    frame->data.resize(size);
+
+    // Copies all meta data, including time stamp and sequence number. The
+    // Q matrix and pixel data point into the receive buffers, which are
+    // reused for the next image set, and are hence copied as well.
+    frame->imageSet = imageSet;
+    if(imageSet.getQMatrix() != nullptr) {
+        memcpy(frame->q, imageSet.getQMatrix(), sizeof(frame->q));
+        frame->imageSet.setQMatrix(frame->q);
+    }
+    size_t offset = 0;
+    for(int i = 0; i < imageSet.getNumberOfImages(); i++) {
+        size_t imageSize = imageSet.getRowStride(i) * imageSet.getHeight();
+        memcpy(&frame->data[offset], imageSet.getPixelData(i), imageSize);
+        frame->imageSet.setPixelData(i, &frame->data[offset]);
+        offset += imageSize + SPARE_BYTES;
+    }
+    return frame;
+}
+
+void RelayServer::relay(const ImageSet& imageSet) {
+    bool anyConnected = false;
+    for(const std::unique_ptr<Endpoint>& endpoint: endpoints) {
+        anyConnected = anyConnected || endpoint->isConnected();
+    }
+
+    // Data is only copied if there is at least one client
+    if(!anyConnected) {
+        return;
+    }
+
+    std::shared_ptr<Frame> frame = copyFrame(imageSet);
+    for(const std::unique_ptr<Endpoint>& endpoint: endpoints) {
+        if(endpoint->isConnected()) {
+            endpoint->post(frame);
+        }
+    }
+}
+
+int RelayServer::getNumConnected() const {
+    int count = 0;
+    for(const std::unique_ptr<Endpoint>& endpoint: endpoints) {
+        count += endpoint->isConnected() ? 1 : 0;
+    }
+    return count;
+}
+
+int RelayServer::getNumDroppedFrames() const {
+    int count = 0;
+    for(const std::unique_ptr<Endpoint>& endpoint: endpoints) {
+        count += endpoint->getDroppedFrames();
+    }
+    return count;
+}
+
+std::string RelayServer::getLastError() {
+    for(const std::unique_ptr<Endpoint>& endpoint: endpoints) {
+        std::string error = endpoint->takeError();
+        if(error != "") {
+            return error;
+        }
+    }
+    return "";
+}
+
+} // namespace
@@ -0,0 +1,97 @@
+/*******************************************************************************
+ * Copyright (c) 2022 Nerian Vision GmbH
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *******************************************************************************/
+
+#ifndef __NERIAN_STEREO_RELAY_SERVER_H__
+#define __NERIAN_STEREO_RELAY_SERVER_H__
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <visiontransfer/asynctransfer.h>
+#include <visiontransfer/imageset.h>
+
+namespace nerian_stereo {
+
+/**
+ * \brief Re-serves received image sets unchanged to downstream clients.
+ *
+ * Each endpoint is an AsyncTransfer server on its own port, which accepts
+ * one client at a time (such as another instance of this driver, or any
+ * other libvisiontransfer client). Image sets are copied once and shared
+ * between all endpoints. Every endpoint transmits from its own thread and
+ * always sends the most recent image set, such that slow clients drop
+ * frames instead of delaying the caller or other clients.
+ */
+class RelayServer {
+public:
+    /**
+     * \brief Creates the server endpoints
+     *
+     * \param address Local address to listen on
+     * \param basePort Port of the first endpoint; further endpoints use the
+     *        following ports
+     * \param numEndpoints Number of endpoints
+     * \param tcp Use TCP instead of UDP
+     */
+    RelayServer(const std::string& address, int basePort, int numEndpoints, bool tcp);
+    ~RelayServer();
+
+    /**
+     * \brief Copies the image set and queues it for transmission to all
+     * connected clients. This method does not block.
+     */
+    void relay(const visiontransfer::ImageSet& imageSet);
+
+    /**
+     * \brief Returns the number of endpoints with a connected client
+     */
+    int getNumConnected() const;
+
+    /**
+     * \brief Returns the number of image sets that were not sent to a
+     * client, because it was still busy with a previous one
+     */
+    int getNumDroppedFrames() const;
+
+    /**
+     * \brief Returns and clears the message of the last transmission error
+     */
+    std::string getLastError();
+
+private:
+    static const int SPARE_BYTES = 16;
+
+    // An image set together with a copy of its pixel data and Q matrix
+    struct Frame {
+        visiontransfer::ImageSet imageSet;
+        std::vector<unsigned char> data;
+        float q[16];
+    };
+
+    class Endpoint;
+
+    std::vector<std::unique_ptr<Endpoint>> endpoints;
+    std::vector<std::shared_ptr<Frame>> framePool;
+
+    std::shared_ptr<Frame> copyFrame(const visiontransfer::ImageSet& imageSet);
+};
+
+} // namespace
+
+#endif
@@ -0,0 +1,355 @@
+/*******************************************************************************
+ * Copyright (c) 2022 Nerian Vision GmbH
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *******************************************************************************/
+
+#include "nerian_stereo/shm_ring.h"
+
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <thread>
+#include <chrono>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace nerian_stereo {
+
+using namespace shm;
+
+namespace {
+
+const uint64_t ALIGNMENT = 64;
+
+// Interval for checking if an idle segment has been replaced
+const std::chrono::milliseconds REPLACED_CHECK_INTERVAL(100);
+
+uint64_t alignUp(uint64_t value, uint64_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+SlotHeader* getSlot(unsigned char* mapping, const RingHeader* header, uint64_t index) {
+    return reinterpret_cast<SlotHeader*>(mapping + sizeof(RingHeader)
+        + (index % header->numSlots) * header->slotStride);
+}
+
+} // namespace
+
+const ShmImage* ShmFrame::find(EntryType type) const {
+    for(const ShmImage& entry: entries) {
+        if(entry.type == type) {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+/******************************** Writer *********************************/
+
+ShmRingWriter::ShmRingWriter(const std::string& name, int numSlots)
+    : name(name), numSlots(numSlots < 2 ? 2 : numSlots), fd(-1), mapping(nullptr),
+    mappingSize(0), header(nullptr), writeCount(0) {
+}
+
+ShmRingWriter::~ShmRingWriter() {
+    close();
+}
+
+void ShmRingWriter::create(uint64_t slotCapacity) {
+    close();
+
+    uint64_t slotStride = alignUp(sizeof(SlotHeader) + slotCapacity, ALIGNMENT);
+    size_t size = sizeof(RingHeader) + numSlots * slotStride;
+
+    // Remove a stale segment of a previous run, which readers might
+    // still have mapped
+    shm_unlink(name.c_str());
+    fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if(fd < 0) {
+        throw std::runtime_error("Unable to create shared memory segment " + name + ": " + strerror(errno));
+    }
+    if(ftruncate(fd, size) != 0) {
+        std::string error = strerror(errno);
+        close();
+        throw std::runtime_error("Unable to resize shared memory segment " + name + ": " + error);
+    }
+    void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(ptr == MAP_FAILED) {
+        std::string error = strerror(errno);
+        close();
+        throw std::runtime_error("Unable to map shared memory segment " + name + ": " + error);
+    }
+    mapping = reinterpret_cast<unsigned char*>(ptr);
+    mappingSize = size;
+
+    // The segment is zero-initialized, which is a valid state for all
+    // sequence locks and counters
+    header = reinterpret_cast<RingHeader*>(mapping);
+    header->version = RING_VERSION;
+    header->numSlots = numSlots;
+    header->slotCapacity = slotCapacity;
+    header->slotStride = slotStride;
+    header->writeCount.store(writeCount, std::memory_order_relaxed);
+    header->closed.store(0, std::memory_order_relaxed);
+
+    // Readers only accept the segment once the magic number is visible
+    std::atomic_thread_fence(std::memory_order_release);
+    header->magic = RING_MAGIC;
+}
+
+void ShmRingWriter::close() {
+    if(header != nullptr) {
+        header->closed.store(1, std::memory_order_release);
+    }
+    if(mapping != nullptr) {
+        munmap(mapping, mappingSize);
+        shm_unlink(name.c_str());
+    }
+    if(fd >= 0) {
+        ::close(fd);
+    }
+    fd = -1;
+    mapping = nullptr;
+    mappingSize = 0;
+    header = nullptr;
+}
+
+uint64_t ShmRingWriter::write(uint32_t sequence, uint32_t stampSec, uint32_t stampNsec,
+        const std::vector<ShmBuffer>& buffers) {
+    // Determine required slot size
+    uint64_t required = 0;
+    int numEntries = 0;
+    for(const ShmBuffer& buffer: buffers) {
+        if(numEntries == MAX_ENTRIES) {
+            break;
+        }
+        required += alignUp(buffer.size, ALIGNMENT);
+        numEntries++;
+    }
+
+    if(header == nullptr || header->slotCapacity < required) {
+        // Grow in steps of 1 MB to avoid frequent re-creation
+        create(alignUp(required, 1 << 20));
+    }
+
+    uint64_t index = writeCount;
+    SlotHeader* slot = getSlot(mapping, header, index);
+    unsigned char* payload = reinterpret_cast<unsigned char*>(slot) + sizeof(SlotHeader);
+
+    // Mark the slot as being written
+    uint64_t lock = slot->seqlock.load(std::memory_order_relaxed);
+    slot->seqlock.store(lock + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot->frameIndex = index;
+    slot->sequence = sequence;
+    slot->stampSec = stampSec;
+    slot->stampNsec = stampNsec;
+    slot->numEntries = numEntries;
+
+    uint64_t offset = 0;
+    for(int i = 0; i < numEntries; i++) {
+        const ShmBuffer& buffer = buffers[i];
+        EntryDescriptor& entry = slot->entries[i];
+        entry.type = buffer.type;
+        entry.width = buffer.width;
+        entry.height = buffer.height;
+        entry.step = buffer.step;
+        entry.offset = offset;
+        entry.size = buffer.size;
+        strncpy(entry.encoding, buffer.encoding.c_str(), ENCODING_LENGTH - 1);
+        entry.encoding[ENCODING_LENGTH - 1] = '\0';
+
+        memcpy(payload + offset, buffer.data, buffer.size);
+        offset += alignUp(buffer.size, ALIGNMENT);
+    }
+
+    // Release the slot and announce the new frame
+    slot->seqlock.store(lock + 2, std::memory_order_release);
+    writeCount = index + 1;
+    header->writeCount.store(writeCount, std::memory_order_release);
+
+    return index;
+}
+
+/******************************** Reader *********************************/
+
+ShmRingReader::ShmRingReader(const std::string& name)
+    : name(name), fd(-1), mapping(nullptr), mappingSize(0), header(nullptr), inode(0),
+    haveLastIndex(false), lastIndex(0), skippedFrames(0) {
+}
+
+ShmRingReader::~ShmRingReader() {
+    close();
+}
+
+bool ShmRingReader::open() {
+    fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if(fd < 0) {
+        return false; // Writer is not running
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(RingHeader)) {
+        close();
+        return false;
+    }
+
+    void* ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if(ptr == MAP_FAILED) {
+        close();
+        return false;
+    }
+    mapping = reinterpret_cast<const unsigned char*>(ptr);
+    mappingSize = st.st_size;
+    header = reinterpret_cast<const RingHeader*>(mapping);
+    inode = st.st_ino;
+    lastActivity = std::chrono::steady_clock::now();
+
+    // Check that the segment has been fully initialized and is compatible
+    bool valid = header->magic == RING_MAGIC;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    valid = valid && header->version == RING_VERSION && header->numSlots > 0
+        && header->slotStride >= sizeof(SlotHeader) + header->slotCapacity
+        && sizeof(RingHeader) + header->numSlots * header->slotStride <= mappingSize;
+    if(!valid) {
+        close();
+        return false;
+    }
+
+    // Frame indices continue when the writer grows the segment, but start
+    // from zero if the writer was restarted
+    if(haveLastIndex && header->writeCount.load(std::memory_order_acquire) <= lastIndex) {
+        haveLastIndex = false;
+    }
+    return true;
+}
+
+void ShmRingReader::close() {
+    if(mapping != nullptr) {
+        munmap(const_cast<unsigned char*>(mapping), mappingSize);
+    }
+    if(fd >= 0) {
+        ::close(fd);
+    }
+    fd = -1;
+    mapping = nullptr;
+    mappingSize = 0;
+    header = nullptr;
+}
+
+bool ShmRingReader::isReplaced() {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if(now - lastActivity < REPLACED_CHECK_INTERVAL) {
+        return false;
+    }
+    lastActivity = now;
+
+    // A restarted writer unlinks the segment and creates a new one
+    int newFd = shm_open(name.c_str(), O_RDONLY, 0);
+    if(newFd < 0) {
+        return true;
+    }
+    struct stat st;
+    bool replaced = fstat(newFd, &st) != 0 || static_cast<uint64_t>(st.st_ino) != inode;
+    ::close(newFd);
+    return replaced;
+}
+
+bool ShmRingReader::readLatest(ShmFrame& frame) {
+    if(header != nullptr && header->closed.load(std::memory_order_acquire)) {
+        close();
+    } else if(header != nullptr && isReplaced()) {
+        // Frame indices of the new writer start from zero
+        close();
+        haveLastIndex = false;
+    }
+    if(header == nullptr && !open()) {
+        return false;
+    }
+
+    // Retry if the writer overtakes us while copying
+    for(int attempt = 0; attempt < 10; attempt++) {
+        uint64_t count = header->writeCount.load(std::memory_order_acquire);
+        if(count == 0 || (haveLastIndex && count - 1 <= lastIndex)) {
+            return false; // Nothing new
+        }
+
+        uint64_t index = count - 1;
+        if(copySlot(index, frame)) {
+            if(haveLastIndex && index > lastIndex + 1) {
+                skippedFrames += index - lastIndex - 1;
+            }
+            haveLastIndex = true;
+            lastIndex = index;
+            lastActivity = std::chrono::steady_clock::now();
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ShmRingReader::copySlot(uint64_t index, ShmFrame& frame) {
+    const SlotHeader* slot = getSlot(const_cast<unsigned char*>(mapping), header, index);
+    const unsigned char* payload = reinterpret_cast<const unsigned char*>(slot) + sizeof(SlotHeader);
+
+    uint64_t lockBefore = slot->seqlock.load(std::memory_order_acquire);
+    if(lockBefore & 1) {
+        return false; // Write in progress
+    }
+
+    if(slot->frameIndex != index || slot->numEntries > static_cast<uint32_t>(MAX_ENTRIES)) {
+        return false;
+    }
+
+    frame.frameIndex = index;
+    frame.sequence = slot->sequence;
+    frame.stampSec = slot->stampSec;
+    frame.stampNsec = slot->stampNsec;
+    frame.entries.resize(slot->numEntries);
+
+    for(uint32_t i = 0; i < slot->numEntries; i++) {
+        const EntryDescriptor& entry = slot->entries[i];
+        if(entry.offset + entry.size > header->slotCapacity) {
+            return false; // Torn descriptor
+        }
+
+        ShmImage& image = frame.entries[i];
+        image.type = static_cast<EntryType>(entry.type);
+        image.width = entry.width;
+        image.height = entry.height;
+        image.step = entry.step;
+        image.encoding.assign(entry.encoding, strnlen(entry.encoding, ENCODING_LENGTH));
+        image.data.resize(entry.size);
+        memcpy(image.data.data(), payload + entry.offset, entry.size);
+    }
+
+    // The copy is only valid if the slot has not been modified meanwhile
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slot->seqlock.load(std::memory_order_relaxed) == lockBefore;
+}
+
+bool ShmRingReader::waitForFrame(ShmFrame& frame, double timeout) {
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now()
+        + std::chrono::microseconds(static_cast<long long>(timeout * 1e6));
+    while(!readLatest(frame)) {
+        if(std::chrono::steady_clock::now() >= end) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+    return true;
+}
+
+} // namespace
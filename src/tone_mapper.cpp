@@ -0,0 +1,149 @@
+/*******************************************************************************
+ * Copyright (c) 2022 Nerian Vision GmbH
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *******************************************************************************/
+
+#include "tone_mapper.h"
+
+#include <cmath>
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace nerian_stereo {
+
+namespace {
+
+// Fraction of pixels that is clipped at either end in auto-range mode
+const double CLIP_FRACTION = 0.005;
+
+// Weight of the current image set in the running range
+const double RANGE_SMOOTHING = 0.1;
+
+} // namespace
+
+ToneMapper::ToneMapper(Mode mode, double gamma)
+    : mode(mode), gamma(gamma > 0 ? gamma : 1.0), histogram(LUT_SIZE), haveRange(false),
+    rangeLow(0), rangeHigh(LUT_SIZE - 1), lutLow(-1), lutHigh(-1) {
+    buildLut(0, LUT_SIZE - 1);
+}
+
+void ToneMapper::buildLut(int low, int high) {
+    if(low == lutLow && high == lutHigh) {
+        return;
+    }
+    lutLow = low;
+    lutHigh = high;
+
+    double invGamma = mode == LINEAR ? 1.0 : 1.0 / gamma;
+    double range = std::max(high - low, 1);
+    for(int i = 0; i < LUT_SIZE; i++) {
+        if(mode == LINEAR) {
+            lut[i] = i >> 4;
+        } else {
+            double normalized = std::min(std::max((i - low) / range, 0.0), 1.0);
+            lut[i] = static_cast<unsigned char>(std::pow(normalized, invGamma) * 255.0 + 0.5);
+        }
+    }
+}
+
+void ToneMapper::updateRange(const unsigned short* image, int width, int height, int rowStride) {
+    if(mode != AUTO_RANGE) {
+        return;
+    }
+
+    // Every fourth pixel of every fourth row is sufficient for the range
+    std::fill(histogram.begin(), histogram.end(), 0);
+    unsigned int count = 0;
+    for(int y = 0; y < height; y += 4) {
+        const unsigned short* row = reinterpret_cast<const unsigned short*>(
+            reinterpret_cast<const unsigned char*>(image) + y*rowStride);
+        for(int x = 0; x < width; x += 4) {
+            histogram[row[x] & (LUT_SIZE - 1)]++;
+        }
+        count += (width + 3) / 4;
+    }
+    if(count == 0) {
+        return;
+    }
+
+    unsigned int clipCount = static_cast<unsigned int>(count * CLIP_FRACTION);
+    int low = 0, high = LUT_SIZE - 1;
+    for(unsigned int sum = histogram[low]; sum <= clipCount && low < LUT_SIZE - 1; sum += histogram[++low]);
+    for(unsigned int sum = histogram[high]; sum <= clipCount && high > 0; sum += histogram[--high]);
+    high = std::max(high, low + 1);
+
+    // Smooth the range over time to avoid flickering
+    if(haveRange) {
+        rangeLow += RANGE_SMOOTHING * (low - rangeLow);
+        rangeHigh += RANGE_SMOOTHING * (high - rangeHigh);
+    } else {
+        rangeLow = low;
+        rangeHigh = high;
+        haveRange = true;
+    }
+
+    buildLut(static_cast<int>(rangeLow + 0.5), static_cast<int>(rangeHigh + 0.5));
+}
+
+void ToneMapper::map(const unsigned short* src, int width, int height, int srcStride,
+        unsigned char* dst, int dstStride) const {
+    for(int y = 0; y < height; y++) {
+        const unsigned short* srcRow = reinterpret_cast<const unsigned short*>(
+            reinterpret_cast<const unsigned char*>(src) + y*srcStride);
+        unsigned char* dstRow = dst + y*dstStride;
+        if(mode == LINEAR) {
+            mapRowLinear(srcRow, dstRow, width);
+        } else {
+            mapRowLut(srcRow, dstRow, width);
+        }
+    }
+}
+
+void ToneMapper::mapRowLinear(const unsigned short* src, unsigned char* dst, int width) const {
+    int x = 0;
+
+#ifdef __SSE2__
+    for(; x + 16 <= width; x += 16) {
+        __m128i low = _mm_srli_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x)), 4);
+        __m128i high = _mm_srli_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x + 8)), 4);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), _mm_packus_epi16(low, high));
+    }
+#endif
+
+    for(; x < width; x++) {
+        dst[x] = lut[src[x] & (LUT_SIZE - 1)];
+    }
+}
+
+void ToneMapper::mapRowLut(const unsigned short* src, unsigned char* dst, int width) const {
+    // SSE2 has no gather instruction, but independent lookups of four
+    // pixels at once keep the loads in flight
+    int x = 0;
+    for(; x + 4 <= width; x += 4) {
+        unsigned char a = lut[src[x] & (LUT_SIZE - 1)];
+        unsigned char b = lut[src[x + 1] & (LUT_SIZE - 1)];
+        unsigned char c = lut[src[x + 2] & (LUT_SIZE - 1)];
+        unsigned char d = lut[src[x + 3] & (LUT_SIZE - 1)];
+        dst[x] = a;
+        dst[x + 1] = b;
+        dst[x + 2] = c;
+        dst[x + 3] = d;
+    }
+    for(; x < width; x++) {
+        dst[x] = lut[src[x] & (LUT_SIZE - 1)];
+    }
+}
+
+} // namespace
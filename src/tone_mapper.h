@@ -0,0 +1,86 @@
+/*******************************************************************************
+ * Copyright (c) 2022 Nerian Vision GmbH
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *******************************************************************************/
+
+#ifndef __NERIAN_STEREO_TONE_MAPPER_H__
+#define __NERIAN_STEREO_TONE_MAPPER_H__
+
+#include <vector>
+#include <stdint.h>
+
+namespace nerian_stereo {
+
+/**
+ * \brief Maps 12-bit images to 8 bits through a 4096-entry lookup table.
+ *
+ * The linear mode divides by 16, which is the same mapping that is used for
+ * the point cloud intensities. The gamma mode applies a gamma curve over the
+ * full 12-bit range. The auto-range mode stretches the range between a low
+ * and a high percentile of a running histogram, which is updated with
+ * updateRange() once per image set, such that the left and right images are
+ * mapped identically.
+ */
+class ToneMapper {
+public:
+    enum Mode {
+        LINEAR,
+        GAMMA,
+        AUTO_RANGE
+    };
+
+    /**
+     * \brief Creates a new tone mapper
+     *
+     * \param mode Mapping mode
+     * \param gamma Gamma value for the gamma and auto-range modes
+     */
+    ToneMapper(Mode mode, double gamma);
+
+    /**
+     * \brief Updates the running histogram with a subsampled 12-bit image
+     * and rebuilds the lookup table. Has no effect unless in auto-range mode.
+     */
+    void updateRange(const unsigned short* image, int width, int height, int rowStride);
+
+    /**
+     * \brief Maps a 12-bit image to 8 bits
+     *
+     * \param src 12-bit image
+     * \param width Width of the image
+     * \param height Height of the image
+     * \param srcStride Row stride of the 12-bit image in bytes
+     * \param dst 8-bit destination image
+     * \param dstStride Row stride of the 8-bit image in bytes
+     */
+    void map(const unsigned short* src, int width, int height, int srcStride,
+        unsigned char* dst, int dstStride) const;
+
+private:
+    static const int LUT_SIZE = 4096;
+
+    Mode mode;
+    double gamma;
+    unsigned char lut[LUT_SIZE];
+    std::vector<unsigned int> histogram;
+    bool haveRange;
+    double rangeLow, rangeHigh;
+    int lutLow, lutHigh;
+
+    void buildLut(int low, int high);
+    void mapRowLinear(const unsigned short* src, unsigned char* dst, int width) const;
+    void mapRowLut(const unsigned short* src, unsigned char* dst, int width) const;
+};
+
+} // namespace
+
+#endif
@@ -0,0 +1,206 @@
+/*******************************************************************************
+ * Copyright (c) 2022 Nerian Vision GmbH
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *******************************************************************************/
+
+#include "voxel_map.h"
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+namespace nerian_stereo {
+
+namespace {
+
+inline uint64_t hashKey(uint64_t key, int shift) {
+    // Fibonacci hashing, which takes the upper bits of the product such
+    // that all coordinates of the packed key contribute
+    return (key * 0x9E3779B97F4A7C15ULL) >> shift;
+}
+
+} // namespace
+
+VoxelMap::VoxelMap(double resolution, double radius, int maxVoxels, int minObservations, double maxAge)
+    : resolution(resolution), radius(radius), maxVoxels(std::max(maxVoxels, 1)),
+    minObservations(std::max(minObservations, 1)), maxAge(maxAge), numVoxels(0), dropped(0), frame(0) {
+
+    // Keep the load factor at or below 0.5 for short probe sequences
+    size_t capacity = 2;
+    hashShift = 63;
+    while(capacity < 2 * static_cast<size_t>(this->maxVoxels)) {
+        capacity *= 2;
+        hashShift--;
+    }
+    table.resize(capacity);
+    mask = capacity - 1;
+    clear();
+}
+
+void VoxelMap::clear() {
+    for(Voxel& voxel: table) {
+        voxel.key = EMPTY_KEY;
+    }
+    numVoxels = 0;
+    dropped = 0;
+    frameTimes.clear();
+    sensorPosition[0] = sensorPosition[1] = sensorPosition[2] = 0.0f;
+}
+
+VoxelMap::Voxel* VoxelMap::findOrInsert(uint64_t key) {
+    uint64_t index = hashKey(key, hashShift);
+    while(true) {
+        Voxel& voxel = table[index];
+        if(voxel.key == key) {
+            return &voxel;
+        } else if(voxel.key == EMPTY_KEY) {
+            if(numVoxels >= maxVoxels) {
+                return nullptr;
+            }
+            voxel.key = key;
+            voxel.sum[0] = voxel.sum[1] = voxel.sum[2] = 0.0f;
+            voxel.points = 0;
+            voxel.lastFrame = frame - 1;
+            voxel.observations = 0;
+            numVoxels++;
+            return &voxel;
+        }
+        index = (index + 1) & mask;
+    }
+}
+
+void VoxelMap::insertExisting(const Voxel& voxel) {
+    uint64_t index = hashKey(voxel.key, hashShift);
+    while(table[index].key != EMPTY_KEY) {
+        index = (index + 1) & mask;
+    }
+    table[index] = voxel;
+    numVoxels++;
+}
+
+void VoxelMap::integrate(const float* points, int pointStride, int width, int height, int step,
+        const float* rotation, const float* translation, double time) {
+    frame++;
+    frameTimes.push_back(std::make_pair(frame, time));
+    std::copy(translation, translation + 3, sensorPosition);
+
+    const float scale = 1.0f / resolution;
+    const float radiusSq = radius * radius;
+    const float* r = rotation;
+    const float* t = translation;
+    step = std::max(step, 1);
+
+    for(int y = 0; y < height; y += step) {
+        const float* row = points + static_cast<size_t>(y) * width * pointStride;
+        for(int x = 0; x < width; x += step) {
+            const float* p = row + x * pointStride;
+
+            // Invalid points have NaN or infinite coordinates and fail the
+            // range check
+            float distSq = p[0]*p[0] + p[1]*p[1] + p[2]*p[2];
+            if(!(distSq <= radiusSq)) {
+                continue;
+            }
+
+            float mx = r[0]*p[0] + r[1]*p[1] + r[2]*p[2] + t[0];
+            float my = r[3]*p[0] + r[4]*p[1] + r[5]*p[2] + t[1];
+            float mz = r[6]*p[0] + r[7]*p[1] + r[8]*p[2] + t[2];
+
+            int64_t ix = static_cast<int64_t>(std::floor(mx * scale)) + KEY_OFFSET;
+            int64_t iy = static_cast<int64_t>(std::floor(my * scale)) + KEY_OFFSET;
+            int64_t iz = static_cast<int64_t>(std::floor(mz * scale)) + KEY_OFFSET;
+            if(ix < 0 || iy < 0 || iz < 0 || ix >= 2*KEY_OFFSET || iy >= 2*KEY_OFFSET || iz >= 2*KEY_OFFSET) {
+                continue;
+            }
+
+            Voxel* voxel = findOrInsert(static_cast<uint64_t>(ix) | (static_cast<uint64_t>(iy) << 21)
+                | (static_cast<uint64_t>(iz) << 42));
+            if(voxel == nullptr) {
+                dropped++;
+                continue;
+            }
+
+            if(voxel->points >= MAX_POINTS) {
+                voxel->sum[0] *= 0.5f;
+                voxel->sum[1] *= 0.5f;
+                voxel->sum[2] *= 0.5f;
+                voxel->points /= 2;
+            }
+            voxel->sum[0] += mx;
+            voxel->sum[1] += my;
+            voxel->sum[2] += mz;
+            voxel->points++;
+
+            if(voxel->lastFrame != frame) {
+                voxel->lastFrame = frame;
+                if(voxel->observations < 0xFFFF) {
+                    voxel->observations++;
+                }
+            }
+        }
+    }
+}
+
+int VoxelMap::extract(std::vector<unsigned char>& data) {
+    // Oldest frame number that has not expired yet
+    double now = frameTimes.empty() ? 0.0 : frameTimes.back().second;
+    while(frameTimes.size() > 1 && now - frameTimes.front().second > maxAge) {
+        frameTimes.pop_front();
+    }
+    uint32_t oldestFrame = frameTimes.empty() ? frame : frameTimes.front().first;
+
+    // Collect the remaining voxels, and rebuild the table without the
+    // removed ones, since open addressing does not support deletion
+    std::vector<Voxel> kept;
+    kept.reserve(numVoxels);
+    const float radiusSq = radius * radius;
+    for(const Voxel& voxel: table) {
+        if(voxel.key == EMPTY_KEY || frame - voxel.lastFrame > frame - oldestFrame) {
+            continue;
+        }
+        float dx = voxel.sum[0] / voxel.points - sensorPosition[0];
+        float dy = voxel.sum[1] / voxel.points - sensorPosition[1];
+        float dz = voxel.sum[2] / voxel.points - sensorPosition[2];
+        if(dx*dx + dy*dy + dz*dz <= radiusSq) {
+            kept.push_back(voxel);
+        }
+    }
+
+    for(Voxel& voxel: table) {
+        voxel.key = EMPTY_KEY;
+    }
+    numVoxels = 0;
+    dropped = 0;
+
+    int extracted = 0;
+    data.resize(kept.size() * 4 * sizeof(float));
+    unsigned char* dst = data.empty() ? nullptr : &data[0];
+    for(const Voxel& voxel: kept) {
+        insertExisting(voxel);
+        if(voxel.observations < minObservations) {
+            continue;
+        }
+
+        float point[3] = {voxel.sum[0] / voxel.points, voxel.sum[1] / voxel.points,
+            voxel.sum[2] / voxel.points};
+        uint32_t observations = voxel.observations;
+        memcpy(dst, point, sizeof(point));
+        memcpy(dst + sizeof(point), &observations, sizeof(observations));
+        dst += 4 * sizeof(float);
+        extracted++;
+    }
+    data.resize(extracted * 4 * sizeof(float));
+
+    return extracted;
+}
+
+} // namespace
@@ -0,0 +1,128 @@
+/*******************************************************************************
+ * Copyright (c) 2022 Nerian Vision GmbH
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *******************************************************************************/
+
+#ifndef __NERIAN_STEREO_VOXEL_MAP_H__
+#define __NERIAN_STEREO_VOXEL_MAP_H__
+
+#include <vector>
+#include <deque>
+#include <stdint.h>
+
+namespace nerian_stereo {
+
+/**
+ * \brief Fuses the point clouds of successive frames into a bounded voxel
+ * map around the sensor.
+ *
+ * Points are transformed into the map frame with the pose of each frame
+ * and accumulated in a hash table of voxels, using open addressing with a
+ * fixed capacity. Each voxel keeps the running mean of its points and the
+ * number of frames in which it has been observed. Voxels observed in fewer
+ * than minObservations frames are treated as outliers and not extracted.
+ *
+ * Voxels that are farther than radius from the sensor, or that have not
+ * been observed for maxAge seconds, are removed when the map is extracted.
+ * If the table is full, new voxels are dropped until the next extraction.
+ */
+class VoxelMap {
+public:
+    /**
+     * \brief Creates a new map
+     *
+     * \param resolution Voxel size in meters
+     * \param radius Radius around the sensor in meters that is kept
+     * \param maxVoxels Maximum number of voxels
+     * \param minObservations Minimum number of frames in which a voxel must
+     *        have been observed to be extracted
+     * \param maxAge Time in seconds after which unobserved voxels are removed
+     */
+    VoxelMap(double resolution, double radius, int maxVoxels, int minObservations, double maxAge);
+
+    /**
+     * \brief Adds the points of an organized point map
+     *
+     * \param points Point map with x, y, z at the beginning of each point
+     * \param pointStride Distance between two points in floats
+     * \param width Width of the point map
+     * \param height Height of the point map
+     * \param step Only every step-th point of every step-th row is used
+     * \param rotation Rotation into the map frame as row-major 3x3 matrix
+     * \param translation Position of the sensor in the map frame
+     * \param time Time stamp of the frame in seconds
+     */
+    void integrate(const float* points, int pointStride, int width, int height, int step,
+        const float* rotation, const float* translation, double time);
+
+    /**
+     * \brief Removes expired voxels and writes the remaining voxels with
+     * sufficient observations as x, y, z floats followed by the number of
+     * observations as 32-bit integer
+     *
+     * \return Number of written voxels
+     */
+    int extract(std::vector<unsigned char>& data);
+
+    /**
+     * \brief Returns the number of voxels that have been dropped since the
+     * last extraction, since the table was full
+     */
+    int getNumDropped() const { return dropped; }
+
+    /**
+     * \brief Removes all voxels
+     */
+    void clear();
+
+private:
+    struct Voxel {
+        uint64_t key;
+        float sum[3];
+        uint32_t points;
+        uint32_t lastFrame;
+        uint16_t observations;
+    };
+
+    static const uint64_t EMPTY_KEY = ~0ULL;
+
+    // Coordinate offset for the voxel key, with 21 bits per axis
+    static const int KEY_OFFSET = 1 << 20;
+
+    // Running sums are halved beyond this number of points, which keeps
+    // them precise and lets the mean follow changes of the scene
+    static const uint32_t MAX_POINTS = 1024;
+
+    float resolution;
+    float radius;
+    int maxVoxels;
+    int minObservations;
+    double maxAge;
+
+    std::vector<Voxel> table;
+    uint64_t mask;
+    int hashShift;
+    int numVoxels;
+    int dropped;
+
+    uint32_t frame;
+    float sensorPosition[3];
+    // Time stamps of the recent frames, in the order of their numbers
+    std::deque<std::pair<uint32_t, double> > frameTimes;
+
+    Voxel* findOrInsert(uint64_t key);
+    void insertExisting(const Voxel& voxel);
+};
+
+} // namespace
+
+#endif